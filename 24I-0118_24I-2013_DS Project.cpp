@@ -2,67 +2,347 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <charconv>
+#include <climits>
+#include <cfloat>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 // Maximum number of connections to create per actor/genre to prevent graph density explosion (To prevent performance issues)
 const int max_links = 25; 
 
+// Links a movie gets to the first movies of each of its genres. A genre holds thousands of movies, so sharing
+// one says far less than sharing an actor or director, and it gets a smaller budget.
+const int genre_links = 3;
+
+// Memory budget of the query result cache (answers plus bookkeeping)
+const size_t cache_budget = 16 * 1024 * 1024;
+
+// Pages the disk storage mode keeps in memory (4 KB each)
+const int disk_pool_pages = 1024;
+
 // Helper Functions
 int get_max(int a, int b) {
     return (a > b) ? a : b;
 }
 
+// Text Kernels
+// Byte tests for format_key and clean_str on a whole block at once: 32 bytes with AVX2, 16 with SSE2.
+// Each returns a bit mask (bit i = byte i); the rest of a string, or all of it without SIMD, goes byte by byte.
+#if defined(__AVX2__)
+#define TEXT_SIMD
+const int text_block = 32;
+const unsigned int text_full = 0xffffffffu;
+
+// Marks the printable ASCII bytes (32..126) and lowercases A..Z in place
+inline unsigned int printable_lower_block(char* p) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i keep = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(31)),
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(127), v));
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    v = _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8(32)));
+    _mm256_storeu_si256((__m256i*)p, v);
+    return (unsigned int)_mm256_movemask_epi8(keep);
+}
+
+// Marks the bytes that are not control characters (32 and up, unsigned)
+inline unsigned int visible_block(const char* p) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    return (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(32)), v));
+}
+#elif defined(__SSE2__)
+#define TEXT_SIMD
+const int text_block = 16;
+const unsigned int text_full = 0xffffu;
+
+inline unsigned int printable_lower_block(char* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i keep = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(31)), _mm_cmplt_epi8(v, _mm_set1_epi8(127)));
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    v = _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(32)));
+    _mm_storeu_si128((__m128i*)p, v);
+    return (unsigned int)_mm_movemask_epi8(keep);
+}
+
+inline unsigned int visible_block(const char* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(32)), v));
+}
+#endif
+
 // Formats a string for searching: removes special chars, trims spaces, and converts to lowercase.
+// Works in place on the (moved or copied) argument.
 string format_key(string str) {
-    string temp = "";
-    for (char c : str) {
-        if (c >= 32 && c <= 126) temp += c; // Keep printable ASCII only
+    size_t n = str.size();
+    size_t i = 0, kept = 0;
+#ifdef TEXT_SIMD
+    for (; i + text_block <= n; i += text_block) {
+        unsigned int keep = printable_lower_block(&str[i]);
+        if (keep == text_full) {
+            if (kept != i) memmove(&str[kept], &str[i], text_block);
+            kept += text_block;
+        } else {
+            for (int b = 0; b < text_block; b++) {
+                if ((keep >> b) & 1) str[kept++] = str[i + b];
+            }
+        }
     }
-    
-    size_t first = temp.find_first_not_of(' ');
-    if (string::npos == first) return "";
-    size_t last = temp.find_last_not_of(' ');
-    temp = temp.substr(first, (last - first + 1));
-    
-    for (size_t i = 0; i < temp.length(); i++) {
-        if (temp[i] >= 'A' && temp[i] <= 'Z') temp[i] += 32;
+#endif
+    for (; i < n; i++) {
+        char c = str[i];
+        if (c >= 32 && c <= 126) str[kept++] = (c >= 'A' && c <= 'Z') ? c + 32 : c; // Keep printable ASCII only
     }
-    return temp;
+    str.resize(kept);
+
+    size_t first = str.find_first_not_of(' ');
+    if (string::npos == first) return "";
+    size_t last = str.find_last_not_of(' ');
+    str.resize(last + 1);
+    str.erase(0, first);
+    return str;
 }
 
 // Cleans a string for display by removing invisible control characters.
 string clean_str(string str) {
-    string clean = "";
-    for (unsigned char c : str) {
-        if (c >= 32) clean += c;
+    size_t n = str.size();
+    size_t i = 0, kept = 0;
+#ifdef TEXT_SIMD
+    for (; i + text_block <= n; i += text_block) {
+        unsigned int keep = visible_block(&str[i]);
+        if (keep == text_full) {
+            if (kept != i) memmove(&str[kept], &str[i], text_block);
+            kept += text_block;
+        } else {
+            for (int b = 0; b < text_block; b++) {
+                if ((keep >> b) & 1) str[kept++] = str[i + b];
+            }
+        }
     }
-    while (!clean.empty() && clean.back() == ' ') clean.pop_back();
-    return clean;
+#endif
+    for (; i < n; i++) {
+        if ((unsigned char)str[i] >= 32) str[kept++] = str[i];
+    }
+    while (kept > 0 && str[kept - 1] == ' ') kept--;
+    str.resize(kept);
+    return str;
+}
+
+// Number parsing on a character range: locale-free and without allocating, with the results a stringstream
+// gives: leading whitespace and a '+' are skipped, parsing stops at the first character that does not fit,
+// text without a number gives 0 and out-of-range values are clamped.
+const char* skip_number_prefix(const char* b, const char* e) {
+    while (b < e && (*b == ' ' || (*b >= '\t' && *b <= '\r'))) b++;
+    if (b < e && *b == '+' && (b + 1 == e || b[1] != '-')) b++;
+    return b;
 }
 
-// Safely converts string to int using stringstream to prevent crashes on bad data.
-int to_int(string s) {
-    if (s.empty()) return 0;
+int parse_int(const char* b, const char* e) {
+    b = skip_number_prefix(b, e);
     int val = 0;
-    stringstream ss(s);
-    ss >> val; 
-    return val;
+    from_chars_result r = from_chars(b, e, val);
+    if (r.ec == errc::result_out_of_range) return (*b == '-') ? INT_MIN : INT_MAX;
+    return (r.ec == errc()) ? val : 0;
 }
 
-// Safely converts string to float using stringstream.
-float to_float(string s) {
-    if (s.empty()) return 0.0f;
+float parse_float(const char* b, const char* e) {
+    b = skip_number_prefix(b, e);
+    const char* digits = (b < e && *b == '-') ? b + 1 : b;
+    if (digits == e || !((*digits >= '0' && *digits <= '9') || *digits == '.')) return 0.0f; // No inf / nan
     float val = 0.0f;
-    stringstream ss(s);
-    ss >> val; 
+    from_chars_result r = from_chars(b, e, val, chars_format::general);
+    if (r.ec == errc::invalid_argument) return 0.0f;
+    bool has_exponent = false;
+    for (const char* p = digits; p < r.ptr; p++) has_exponent = has_exponent || *p == 'e' || *p == 'E';
+    if (!has_exponent && r.ptr < e && (*r.ptr == 'e' || *r.ptr == 'E')) return 0.0f; // Exponent without digits
+    if (r.ec == errc::result_out_of_range) {
+        // Too small values become the nearest denormal or 0, too large ones the largest float
+        double wide = 0.0;
+        bool in_double = (from_chars(b, r.ptr, wide).ec == errc());
+        bool tiny = in_double && wide > -1.0 && wide < 1.0;
+        for (const char* p = digits; !in_double && p + 1 < r.ptr; p++) {
+            if (*p == 'e' || *p == 'E') tiny = (p[1] == '-');
+        }
+        if (tiny) return in_double ? (float)wide : ((*b == '-') ? -0.0f : 0.0f);
+        return (*b == '-') ? -FLT_MAX : FLT_MAX;
+    }
     return val;
 }
 
+// Safely converts string to int (no exceptions, 0 for bad data).
+int to_int(const string& s) { return parse_int(s.data(), s.data() + s.size()); }
+
+// Safely converts string to float.
+float to_float(const string& s) { return parse_float(s.data(), s.data() + s.size()); }
+
+// Number of worker threads used by the parallel routines (at least 1)
+int worker_count() {
+    unsigned int n = thread::hardware_concurrency();
+    return (n == 0) ? 1 : (int)n;
+}
+
+// Loops shorter than this run as one chunk on the calling thread unless the caller asks for smaller chunks
+const int parallel_grain = 512;
+
+// One parallel_for call: chunks are claimed one at a time by the pool threads and by the calling thread
+class ParallelLoop {
+public:
+    int chunks;
+    int claimed;        // Chunks handed out so far (pool lock)
+    int finished;       // Chunks done (pool lock)
+    ParallelLoop* next; // Next loop waiting for threads (pool lock)
+    condition_variable all_done;
+
+    ParallelLoop(int chunk_count) : chunks(chunk_count), claimed(0), finished(0), next(nullptr) {}
+    virtual ~ParallelLoop() {}
+    virtual void run(int chunk) = 0;
+};
+
+template <typename Fn>
+class ParallelLoopFn : public ParallelLoop {
+    Fn& fn;
+    int n;
+    int chunk_size;
+public:
+    ParallelLoopFn(Fn& f, int count, int size) : ParallelLoop((count + size - 1) / size), fn(f), n(count), chunk_size(size) {}
+    void run(int chunk) {
+        int begin = chunk * chunk_size;
+        int end = (n - begin > chunk_size) ? begin + chunk_size : n;
+        fn(begin, end, chunk);
+    }
+};
+
+// Worker Pool
+// worker_count() - 1 threads started on first use and shared by every parallel_for, so a parallel loop costs a
+// wake-up instead of starting and joining threads, and concurrent callers (server connections, shard threads)
+// share the same threads instead of each starting their own. Loops wait in a queue; the calling thread claims
+// chunks of its own loop as well and then waits only for chunks other threads already run, so a loop finishes
+// even when every pool thread is busy and nested loops cannot deadlock.
+class WorkerPool {
+private:
+    mutex lock;
+    condition_variable work_ready;
+    ParallelLoop* head; // Loops with unclaimed chunks, oldest first
+    ParallelLoop* tail;
+    thread* threads;
+    int thread_count;
+    bool stopping;
+
+    // Hands out the next chunk of loop and drops the loop from the queue once all its chunks are claimed
+    int claim(ParallelLoop* loop) {
+        int chunk = loop->claimed++;
+        if (loop->claimed == loop->chunks) {
+            ParallelLoop* prev = nullptr;
+            ParallelLoop* cur = head;
+            while (cur && cur != loop) {
+                prev = cur;
+                cur = cur->next;
+            }
+            if (cur) {
+                if (prev) prev->next = cur->next;
+                else head = cur->next;
+                if (tail == cur) tail = prev;
+                cur->next = nullptr;
+            }
+        }
+        return chunk;
+    }
+
+    void run_chunk(ParallelLoop* loop, int chunk, unique_lock<mutex>& guard) {
+        guard.unlock();
+        loop->run(chunk);
+        guard.lock();
+        if (++loop->finished == loop->chunks) loop->all_done.notify_all();
+    }
+
+    void serve() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            while (!stopping && !head) work_ready.wait(guard);
+            if (!head) return;
+            ParallelLoop* loop = head;
+            int chunk = claim(loop);
+            run_chunk(loop, chunk, guard);
+        }
+    }
+
+public:
+    WorkerPool(int count) : head(nullptr), tail(nullptr), thread_count(count), stopping(false) {
+        threads = new thread[(count > 0) ? count : 1];
+        for (int i = 0; i < thread_count; i++) threads[i] = thread([this]() { serve(); });
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            work_ready.notify_all();
+        }
+        for (int i = 0; i < thread_count; i++) threads[i].join();
+        delete[] threads;
+    }
+
+    // Runs every chunk of loop and returns when all of them are done
+    void run(ParallelLoop& loop) {
+        unique_lock<mutex> guard(lock);
+        if (thread_count > 0) {
+            if (tail) tail->next = &loop;
+            else head = &loop;
+            tail = &loop;
+            work_ready.notify_all();
+        }
+        while (loop.claimed < loop.chunks) {
+            int chunk = claim(&loop);
+            run_chunk(&loop, chunk, guard);
+        }
+        while (loop.finished < loop.chunks) loop.all_done.wait(guard);
+    }
+};
+
+WorkerPool& worker_pool() {
+    static WorkerPool pool(worker_count() - 1);
+    return pool;
+}
+
+// Splits the range [0, n) into contiguous chunks of at least min_chunk items, at most one per worker, and runs
+// fn(begin, end, chunk) on each through the worker pool. chunk is below worker_count(), so it can index
+// per-worker buffers. Runs as a plain call on the current thread when there is nothing to split.
+template <typename Fn>
+void parallel_for(int n, Fn fn, int min_chunk = parallel_grain) {
+    int chunks = worker_count();
+    if (min_chunk < 1) min_chunk = 1;
+    if (chunks > n / min_chunk) chunks = n / min_chunk;
+    if (chunks <= 1) {
+        fn(0, n, 0);
+        return;
+    }
+    ParallelLoopFn<Fn> loop(fn, n, (n + chunks - 1) / chunks);
+    worker_pool().run(loop);
+}
+
 class MovieNode; 
 class AVLTree;
 
-// Generic Linked List (Used for storing lists of actors, genres, and movie neighbors.)
+// Generic Linked List (Used for parsed CSV fields, queues and stacks.)
 template <typename T>
 struct list_node {
     T data;
@@ -160,11 +440,11 @@ public:
 
     bool is_empty() const { return head == nullptr; }
     
-    void print_list() const {
+    void print_list(ostream& out) const {
         list_node<T>* current = head;
         while (current) {
-            cout << current->data;
-            if (current->next) cout << ", ";
+            out << current->data;
+            if (current->next) out << ", ";
             current = current->next;
         }
     }
@@ -203,33 +483,651 @@ public:
     bool empty() const { return list.is_empty(); }
 };
 
+// Heap sort (ascending by operator<), used where results must be merged or searched in order
+template <typename T>
+void heap_sort(T* a, int n) {
+    for (int start = n / 2 - 1, end = n; end > 1; ) {
+        int root;
+        if (start >= 0) root = start--;
+        else {
+            end--;
+            T t = a[0]; a[0] = a[end]; a[end] = t;
+            root = 0;
+        }
+        while (2 * root + 1 < end) {
+            int child = 2 * root + 1;
+            if (child + 1 < end && a[child] < a[child + 1]) child++;
+            if (!(a[root] < a[child])) break;
+            T t = a[root]; a[root] = a[child]; a[child] = t;
+            root = child;
+        }
+    }
+}
+
+// Binary search in a sorted array
+template <typename T>
+bool sorted_contains(const T* a, int n, const T& value) {
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (a[mid] == value) return true;
+        if (a[mid] < value) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return false;
+}
+
+// Growable array (contiguous storage for BFS frontiers, per-thread buffers and per-movie lists)
+template <typename T>
+class my_array {
+    T* items;
+    int count;
+    int cap;
+
+    void grow() {
+        cap = (cap == 0) ? 4 : cap * 2;
+        T* bigger = new T[cap];
+        for (int i = 0; i < count; i++) bigger[i] = items[i];
+        delete[] items;
+        items = bigger;
+    }
+
+public:
+    my_array() : items(nullptr), count(0), cap(0) {}
+    ~my_array() { delete[] items; }
+    my_array(const my_array&) = delete;
+    my_array& operator=(const my_array&) = delete;
+
+    void push(T val) {
+        if (count == cap) grow();
+        items[count++] = val;
+    }
+    void clear() { count = 0; }
+    T pop() { return items[--count]; }
+    T* data() { return items; }
+
+    bool contains(const T& val) const {
+        for (int i = 0; i < count; i++) if (items[i] == val) return true;
+        return false;
+    }
+
+    // Removes the first occurrence, keeping the order of the rest
+    void remove(const T& val) {
+        int i = 0;
+        while (i < count && !(items[i] == val)) i++;
+        if (i == count) return;
+        for (; i + 1 < count; i++) items[i] = items[i + 1];
+        count--;
+    }
+    const T* data() const { return items; }
+
+    // Sorts and drops duplicates
+    void sort_unique() {
+        heap_sort(items, count);
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (kept == 0 || items[kept - 1] < items[i]) items[kept++] = items[i];
+        }
+        count = kept;
+    }
+    int size() const { return count; }
+    int capacity() const { return cap; }
+    T& operator[](int i) { return items[i]; }
+    const T& operator[](int i) const { return items[i]; }
+
+    void swap(my_array& other) {
+        T* ti = items; items = other.items; other.items = ti;
+        int tc = count; count = other.count; other.count = tc;
+        tc = cap; cap = other.cap; other.cap = tc;
+    }
+};
+
+// Memory Report
+// Heap bytes and allocation counts per data structure, filled in by the account() methods of the structures.
+// Bytes are what the program asks new for (array lengths times element sizes, string capacities); the
+// allocator's own headers and rounding are not included. Strings short enough to live inside the string
+// object (small string optimization) take no heap bytes of their own.
+class MemoryReport {
+public:
+    // The n largest values seen, with a label each (ties keep the first one offered)
+    class Top {
+    private:
+        static const int max_n = 8;
+        long long value[max_n];
+        string label[max_n];
+        int n;
+        int used;
+
+    public:
+        Top(int count) : n(count < max_n ? count : max_n), used(0) {}
+
+        void offer(long long v, const string& name) {
+            if (n == 0 || (used == n && v <= value[n - 1])) return;
+            int pos = (used < n) ? used++ : n - 1;
+            while (pos > 0 && value[pos - 1] < v) {
+                value[pos] = value[pos - 1];
+                label[pos] = label[pos - 1];
+                pos--;
+            }
+            value[pos] = v;
+            label[pos] = name;
+        }
+
+        // "a (12), b (9), ..."
+        string join() const {
+            stringstream ss;
+            for (int i = 0; i < used; i++) ss << (i ? ", " : "") << label[i] << " (" << value[i] << ")";
+            return ss.str();
+        }
+    };
+
+private:
+    struct Part {
+        string name;
+        string unit; // What items counts ("" = not shown)
+        long long bytes;
+        long long allocs;
+        long long items;
+    };
+    my_array<Part> parts;
+    my_array<string> notes;
+
+public:
+    // Index of the named part, added on first use
+    int part(const string& name, const string& unit = "") {
+        for (int i = 0; i < parts.size(); i++) if (parts[i].name == name) return i;
+        Part p;
+        p.name = name;
+        p.unit = unit;
+        p.bytes = p.allocs = p.items = 0;
+        parts.push(p);
+        return parts.size() - 1;
+    }
+
+    void add(int p, long long bytes, long long allocs = 1) {
+        parts[p].bytes += bytes;
+        parts[p].allocs += allocs;
+    }
+
+    void count(int p, long long items) { parts[p].items += items; }
+
+    // Heap bytes of a string: none while the text fits inside the string object
+    static long long heap_bytes(const string& s) {
+        const char* text = s.data();
+        const char* self = (const char*)&s;
+        if (text >= self && text < self + sizeof(string)) return 0;
+        return (long long)s.capacity() + 1;
+    }
+
+    void add_string(int p, const string& s) {
+        long long b = heap_bytes(s);
+        if (b > 0) add(p, b);
+    }
+
+    template <typename T>
+    void add_array(int p, const my_array<T>& a) {
+        if (a.capacity() > 0) add(p, (long long)a.capacity() * sizeof(T));
+    }
+
+    void note(const string& line) { notes.push(line); }
+
+    void print(ostream& out, int movies) const {
+        long long bytes = 0, allocs = 0;
+        out << "\n--- Memory Report ---\n";
+        for (int i = 0; i < parts.size(); i++) {
+            const Part& p = parts[i];
+            out << p.name << ": " << p.bytes << " bytes | " << p.allocs << " allocations";
+            if (p.unit != "") out << " | " << p.items << " " << p.unit;
+            out << "\n";
+            bytes += p.bytes;
+            allocs += p.allocs;
+        }
+        out << "Total: " << bytes << " bytes (" << bytes / 1024 << " KB) | " << allocs << " allocations";
+        if (movies > 0) out << " | " << bytes / movies << " bytes per movie";
+        out << "\n";
+        for (int i = 0; i < notes.size(); i++) out << notes[i] << "\n";
+    }
+};
+
+// Varint Coding
+// Compact mode stores id lists as zigzag-mapped deltas in 7-bit groups (high bit set = more bytes follow),
+// so ids close to the previous one take a single byte.
+unsigned int zigzag(int v) { return ((unsigned int)v << 1) ^ (unsigned int)(v >> 31); }
+int unzigzag(unsigned int u) { return (int)(u >> 1) ^ -(int)(u & 1); }
+
+int varint_size(unsigned int v) {
+    int n = 1;
+    while (v >= 0x80) { v >>= 7; n++; }
+    return n;
+}
+
+unsigned char* put_varint(unsigned char* out, unsigned int v) {
+    while (v >= 0x80) {
+        *out++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char)v;
+    return out;
+}
+
+unsigned int get_varint(const unsigned char*& p) {
+    unsigned int v = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        v |= (unsigned int)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= (unsigned int)(*p++) << shift;
+    return v;
+}
+
+// Bytes needed to pack the ids as deltas
+int packed_size(const int* ids, int count) {
+    int bytes = 0, prev = 0;
+    for (int i = 0; i < count; i++) {
+        bytes += varint_size(zigzag(ids[i] - prev));
+        prev = ids[i];
+    }
+    return bytes;
+}
+
+unsigned char* pack_ids(const int* ids, int count, unsigned char* out) {
+    int prev = 0;
+    for (int i = 0; i < count; i++) {
+        out = put_varint(out, zigzag(ids[i] - prev));
+        prev = ids[i];
+    }
+    return out;
+}
+
+// Walks one id list, either a plain int range or a packed byte range decoded on the fly
+struct IdCursor {
+    const int* p;
+    const int* end;
+    const unsigned char* b;
+    const unsigned char* b_end;
+    int prev;
+
+    IdCursor() : p(nullptr), end(nullptr), b(nullptr), b_end(nullptr), prev(0) {}
+    IdCursor(const int* begin, const int* stop) : p(begin), end(stop), b(nullptr), b_end(nullptr), prev(0) {}
+    IdCursor(const unsigned char* begin, const unsigned char* stop)
+        : p(nullptr), end(nullptr), b(begin), b_end(stop), prev(0) {}
+
+    bool next(int& id) {
+        if (p) {
+            if (p == end) return false;
+            id = *p++;
+            return true;
+        }
+        if (b == b_end) return false;
+        prev += unzigzag(get_varint(b));
+        id = prev;
+        return true;
+    }
+};
+
+// Polynomial string hash shared by the index tables
+// Eight bytes per step: h * 31^8 + c0 * 31^7 + ... + c7 equals eight steps of h * 31 + c (mod 2^64),
+// but the products do not wait on each other
+unsigned long str_hash(const string& key) {
+    static const unsigned long pow31[9] = { 1UL, 31UL, 961UL, 29791UL, 923521UL, 28629151UL, 887503681UL,
+                                            27512614111UL, 852891037441UL };
+    const char* d = key.data();
+    size_t n = key.size();
+    size_t i = 0;
+    unsigned long h = 0;
+    for (; i + 8 <= n; i += 8, d += 8) {
+        h = h * pow31[8] + (unsigned long)d[0] * pow31[7] + (unsigned long)d[1] * pow31[6] +
+            (unsigned long)d[2] * pow31[5] + (unsigned long)d[3] * pow31[4] + (unsigned long)d[4] * pow31[3] +
+            (unsigned long)d[5] * pow31[2] + (unsigned long)d[6] * pow31[1] + (unsigned long)d[7];
+    }
+    for (; i < n; i++, d++) h = (h * 31) + *d;
+    return h;
+}
+
+// Name Dictionary
+// Every distinct actor, director and genre name is stored once (with its search key); movies keep name ids.
+// Entries live in fixed chunks and are never moved or removed, so readers can look up the ids they got from
+// a published version while a writer keeps adding names. Adding is locked (several engines may share it).
+class NameDict {
+private:
+    static const int chunk_bits = 10;
+    static const int chunk_size = 1 << chunk_bits;
+    static const int max_chunks = 16384;
+    struct Entry {
+        string name;
+        string key;
+    };
+
+    Entry* chunks[max_chunks];
+    atomic<int> count;
+    int* slots; // Open addressing: name -> id (-1 = empty), writer side only
+    int cap;
+    mutex lock;
+
+    Entry& at(int id) const { return chunks[id >> chunk_bits][id & (chunk_size - 1)]; }
+
+    void grow_slots() {
+        int new_cap = (cap == 0) ? 1024 : cap * 2;
+        int* bigger = new int[new_cap];
+        for (int i = 0; i < new_cap; i++) bigger[i] = -1;
+        for (int id = 0; id < count.load(); id++) {
+            int i = str_hash(at(id).name) & (new_cap - 1);
+            while (bigger[i] != -1) i = (i + 1) & (new_cap - 1);
+            bigger[i] = id;
+        }
+        delete[] slots;
+        slots = bigger;
+        cap = new_cap;
+    }
+
+public:
+    NameDict() : count(0), slots(nullptr), cap(0) {
+        for (int c = 0; c < max_chunks; c++) chunks[c] = nullptr;
+    }
+
+    ~NameDict() {
+        for (int c = 0; c < max_chunks; c++) delete[] chunks[c];
+        delete[] slots;
+    }
+
+    NameDict(const NameDict&) = delete;
+    NameDict& operator=(const NameDict&) = delete;
+
+    // Id of the name, added on first use
+    int intern(const string& name) {
+        lock_guard<mutex> guard(lock);
+        int n = count.load();
+        if ((n + 1) * 2 > cap) grow_slots();
+        int i = str_hash(name) & (cap - 1);
+        while (slots[i] != -1) {
+            if (at(slots[i]).name == name) return slots[i];
+            i = (i + 1) & (cap - 1);
+        }
+        if ((n >> chunk_bits) >= max_chunks) {
+            cout << "Name dictionary full." << endl;
+            exit(1);
+        }
+        if (!chunks[n >> chunk_bits]) chunks[n >> chunk_bits] = new Entry[chunk_size];
+        at(n).name = name;
+        at(n).key = format_key(name);
+        slots[i] = n;
+        count.store(n + 1);
+        return n;
+    }
+
+    const string& name(int id) const { return at(id).name; }
+    const string& key(int id) const { return at(id).key; }
+    int size() const { return count.load(); }
+
+    // Chunks, name and key strings, and the lookup slots
+    void account(MemoryReport& r) {
+        lock_guard<mutex> guard(lock);
+        int n = count.load();
+        if (n == 0) return;
+        int p = r.part("Name dictionary", "names");
+        for (int c = 0; c < max_chunks && chunks[c]; c++) r.add(p, (long long)chunk_size * sizeof(Entry));
+        for (int id = 0; id < n; id++) {
+            r.add_string(p, at(id).name);
+            r.add_string(p, at(id).key);
+        }
+        if (slots) r.add(p, (long long)cap * sizeof(int));
+        r.count(p, n);
+    }
+};
+
+NameDict names;
+
+// Prints the detail block of the title search (cast and genres already joined with ", ")
+void print_details(ostream& out, const string& title, int year, const string& director, float rating,
+                   const string& cast, const string& genres) {
+    out << "---------------------------------\n";
+    out << "Title:    " << title << " (" << year << ")\n";
+    out << "Director: " << director << '\n';
+    out << "Rating:   " << rating << "/10\n";
+    out << "Cast:     " << cast << '\n';
+    out << "Genres:   " << genres << '\n';
+    out << "---------------------------------\n";
+}
+
+// Genre Bits
+// Bit of each genre in a movie's genre mask (and MovieSignature word 0), given out in first-seen order.
+// Genres beyond the 64th share bits by hash: from then on a set bit only says the movie may have the genre.
+class GenreBits {
+private:
+    static const int slots = 256; // Open addressing over genre keys
+    string keys[slots];
+    int bits[slots];
+    int entries;
+    int exact; // Bits given out so far
+    atomic<bool> crowded; // Some bit is shared
+    mutex lock;
+
+public:
+    GenreBits() : entries(0), exact(0), crowded(false) {
+        for (int i = 0; i < slots; i++) bits[i] = -1;
+    }
+
+    // Bit of a genre key; -1 if the genre was never seen and add is false
+    int find(const string& key, bool add) {
+        lock_guard<mutex> guard(lock);
+        int i = str_hash(key) % slots;
+        for (int probe = 0; probe < slots && bits[i] != -1; probe++) {
+            if (keys[i] == key) return bits[i];
+            i = (i + 1) % slots;
+        }
+        if (!add) return -1;
+        int bit = exact;
+        if (exact < 64) exact++;
+        else {
+            bit = (int)(str_hash(key) % 64);
+            crowded = true;
+        }
+        if (bits[i] == -1 && entries < slots - 1) {
+            keys[i] = key;
+            bits[i] = bit;
+            entries++;
+        }
+        return bit;
+    }
+
+    // True while every genre has a bit of its own, so that masks can be tested without the genre lists
+    bool exact_masks() const { return !crowded; }
+};
+
+GenreBits genre_bits;
+
+// Movie Record
+// Read-only copy of a movie's attributes as published to readers (see CatalogVersion).
+// A record never changes once built: an edit makes a new record, and the old one stays alive until the last
+// version showing it is reclaimed. Reference counts are only touched by the (single) writer.
+// Names are ids into the NameDict. In compact mode the search key is left empty; key() derives it from the title.
+struct MovieRecord {
+    string title;
+    string search_key;
+    unsigned long key_hash; // str_hash(search_key)
+    int director;
+    int year;
+    float rating;
+    int duration;
+    int* actors;
+    int actor_count;
+    int* genres;
+    int genre_count;
+    unsigned long long genre_mask; // See GenreBits
+    int refs;
+
+    MovieRecord() : key_hash(0), director(0), year(0), rating(0.0f), duration(0), actors(nullptr), actor_count(0),
+                    genres(nullptr), genre_count(0), genre_mask(0), refs(0) {}
+    ~MovieRecord() {
+        delete[] actors;
+        delete[] genres;
+    }
+
+    const string& director_name() const { return names.name(director); }
+    const string& actor(int i) const { return names.name(actors[i]); }
+    const string& genre(int i) const { return names.name(genres[i]); }
+
+    // Genre test on the mask, falling back to the list only when masks are not exact
+    bool has_genre(const string& key) const {
+        int bit = genre_bits.find(key, false);
+        if (bit == -1 || !(genre_mask >> bit & 1)) return false;
+        if (genre_bits.exact_masks()) return true;
+        for (int i = 0; i < genre_count; i++) if (names.key(genres[i]) == key) return true;
+        return false;
+    }
+
+    static string join_names(const int* ids, int count) {
+        string joined = "";
+        for (int i = 0; i < count; i++) {
+            joined += names.name(ids[i]);
+            if (i + 1 < count) joined += ", ";
+        }
+        return joined;
+    }
+
+    void show_details(const string& title, ostream& out) const {
+        print_details(out, title, year, director_name(), rating, join_names(actors, actor_count),
+                      join_names(genres, genre_count));
+    }
+
+    // The search key; scratch holds it when compact mode left it out
+    const string& key(string& scratch) const {
+        if (!search_key.empty()) return search_key;
+        scratch = format_key(title);
+        return scratch;
+    }
+
+    // Copy with another year and rating (with its own name arrays, no references yet)
+    MovieRecord* with_fields(int new_year, float new_rating) const {
+        MovieRecord* m = new MovieRecord();
+        m->title = title;
+        m->search_key = search_key;
+        m->key_hash = key_hash;
+        m->director = director;
+        m->year = new_year;
+        m->rating = new_rating;
+        m->duration = duration;
+        m->actor_count = actor_count;
+        m->actors = new int[actor_count > 0 ? actor_count : 1];
+        for (int i = 0; i < actor_count; i++) m->actors[i] = actors[i];
+        m->genre_count = genre_count;
+        m->genres = new int[genre_count > 0 ? genre_count : 1];
+        for (int i = 0; i < genre_count; i++) m->genres[i] = genres[i];
+        m->genre_mask = genre_mask;
+        return m;
+    }
+};
+
+void release_record(MovieRecord* rec) {
+    if (rec && --rec->refs == 0) delete rec;
+}
+
+// Copies a list of name ids into a new array
+int* ids_to_array(const my_array<int>& list, int& count) {
+    count = list.size();
+    int* arr = new int[count > 0 ? count : 1];
+    for (int i = 0; i < count; i++) arr[i] = list[i];
+    return arr;
+}
+
+// Neighbor List
+// A movie's links in link order, stored as varint deltas of the neighbors' uids (permanent movie numbers,
+// see AVLTree::track): about two bytes per link instead of a separately allocated list cell.
+class NeighborList {
+private:
+    unsigned char* bytes;
+    int used;
+    int cap;
+    int count;
+    int last; // Uid of the last entry (base of the next delta)
+
+public:
+    NeighborList() : bytes(nullptr), used(0), cap(0), count(0), last(0) {}
+    ~NeighborList() { delete[] bytes; }
+    NeighborList(const NeighborList&) = delete;
+    NeighborList& operator=(const NeighborList&) = delete;
+
+    int size() const { return count; }
+    int capacity() const { return cap; } // Bytes allocated
+    IdCursor cursor() const { return IdCursor(bytes, bytes + used); }
+
+    bool contains(int uid) const {
+        IdCursor c = cursor();
+        int id;
+        while (c.next(id)) if (id == uid) return true;
+        return false;
+    }
+
+    void push(int uid) {
+        if (used + 5 > cap) {
+            cap = (cap == 0) ? 8 : cap * 2;
+            unsigned char* bigger = new unsigned char[cap];
+            for (int i = 0; i < used; i++) bigger[i] = bytes[i];
+            delete[] bytes;
+            bytes = bigger;
+        }
+        used = put_varint(bytes + used, zigzag(uid - last)) - bytes;
+        last = uid;
+        count++;
+    }
+
+    // Removes one uid, re-encoding the rest in order
+    void remove(int uid) {
+        my_array<int> keep;
+        IdCursor c = cursor();
+        int id;
+        bool found = false;
+        while (c.next(id)) {
+            if (id == uid && !found) found = true;
+            else keep.push(id);
+        }
+        if (!found) return;
+        used = count = last = 0;
+        for (int i = 0; i < keep.size(); i++) push(keep[i]);
+    }
+
+    // Removes every uid marked in gone (indexed by uid), re-encoding the rest in order
+    void remove_marked(const bool* gone) {
+        my_array<int> keep;
+        IdCursor c = cursor();
+        int id;
+        while (c.next(id)) if (!gone[id]) keep.push(id);
+        if (keep.size() == count) return;
+        used = count = last = 0;
+        for (int i = 0; i < keep.size(); i++) push(keep[i]);
+    }
+
+    void clear() { used = count = last = 0; }
+};
+
 // MovieNode Class
-// Represents a single movie and its attributes.
+// Represents a single movie and its attributes in sharded mode (see Shard).
 // Also acts as a Graph Vertex and AVL Tree Node.
 class MovieNode {
 public:
     string title;
     string search_key; 
-    string director;
+    int director; // Name id (see NameDict)
     int year;
     float rating;
     int duration;
 
-    // Attributes stored as lists
-    LinkedList<string> actors;
-    LinkedList<string> genres;
+    // Attributes stored as lists of name ids
+    my_array<int> actors;
+    my_array<int> genres;
+    unsigned long long genre_mask; // See GenreBits
 
     // AVL Tree pointers
     MovieNode* left;
     MovieNode* right;
     int height;
 
-    // Graph Edge List (Adjacency List)
-    LinkedList<MovieNode*> neighbors; 
+    // Graph Edge List (Adjacency List) of neighbor uids
+    NeighborList neighbors; 
     
-    // Traversal flags
-    bool visited;
-    MovieNode* parent; // For path reconstruction
+    int uid; // Permanent number of this node (see AVLTree::track)
+    int mid; // Movie id in sharded mode (see ShardedEngine), moves with the data; -1 otherwise
 
     MovieNode(string t, int y, float r, int dur, string dir) {
         title = clean_str(t); 
@@ -237,32 +1135,42 @@ public:
         year = y;
         rating = r;
         duration = dur;
-        director = dir;
+        director = names.intern(dir);
+        genre_mask = 0;
         left = right = nullptr;
         height = 1;
-        visited = false;
-        parent = nullptr;
+        uid = -1;
+        mid = -1;
     }
 
+    const string& director_name() const { return names.name(director); }
+
     void add_actor(string name) { 
-        if(!actors.has_item(name)) actors.insert(name); 
+        int id = names.intern(name);
+        if(!actors.contains(id)) {
+            actors.push(id); 
+        }
     }
     
     void add_genre(string name) { 
-        if(!genres.has_item(name)) genres.insert(name); 
+        int id = names.intern(name);
+        if(!genres.contains(id)) {
+            genres.push(id); 
+            if (names.key(id) != "") genre_mask |= 1ULL << genre_bits.find(names.key(id), true);
+        }
     }
     
     // Creates a graph edge between this movie and another
     void add_link(MovieNode* other) {
         if (other == this) return; 
-        if (!neighbors.has_item(other)) {
-            neighbors.insert(other);
+        if (!neighbors.contains(other->uid)) {
+            neighbors.push(other->uid);
         }
     }
 
-    void set_rating(float r) {
+    void set_rating(float r, ostream& out) {
         this->rating = r;
-        cout << "Rating for '" << title << "' updated to " << r << "/10" << endl;
+        out << "Rating for '" << title << "' updated to " << r << "/10" << endl;
     }
 
     // Copies data from another node (used during AVL deletion)
@@ -273,133 +1181,890 @@ public:
         this->year = other->year;
         this->rating = other->rating;
         this->duration = other->duration;
+        this->mid = other->mid;
+        this->genre_mask = other->genre_mask;
 
         this->actors.clear();
         this->genres.clear();
         this->neighbors.clear(); 
 
-        this->actors.head = other->actors.head;
-        this->actors.tail = other->actors.tail;
-        this->genres.head = other->genres.head;
-        this->genres.tail = other->genres.tail;
-        
-        other->actors.head = other->actors.tail = nullptr;
-        other->genres.head = other->genres.tail = nullptr;
-    }
-
-    void show_details() const {
-        cout << "---------------------------------" << endl;
-        cout << "Title:    " << title << " (" << year << ")" << endl;
-        cout << "Director: " << director << endl;
-        cout << "Rating:   " << rating << "/10" << endl;
-        cout << "Cast:     "; actors.print_list(); cout << endl;
-        cout << "Genres:   "; genres.print_list(); cout << endl;
-        cout << "---------------------------------" << endl;
+        // Takes over the other node's lists (it is deleted right after)
+        this->actors.swap(other->actors);
+        this->genres.swap(other->genres);
     }
 };
 
-// Hash Table Class
-// Used to index movies by Actor, Genre, or Director.
-struct ActorNode {
-    string key; 
-    LinkedList<MovieNode*> movies; 
-    ActorNode* next; 
-    ActorNode(string k) : key(k), next(nullptr) {}
+// Entity Types
+// Actors, directors and genres are indexed separately. Each type has its own table size and link budget:
+// a movie joining a key is linked to the first `links` movies already under it.
+enum EntityType { ENTITY_ACTOR, ENTITY_DIRECTOR, ENTITY_GENRE };
+const int entity_type_count = 3;
+
+// Sets of entity types, for searches over several of them
+const int any_entity = 7;
+const int person_entity = (1 << ENTITY_ACTOR) | (1 << ENTITY_DIRECTOR);
+
+struct EntityPolicy {
+    const char* name; // Also the search prefix that limits a search to the type ("actor:Tom Hanks")
+    int buckets;
+    int links;
 };
 
-class HashTable {
-private:
-    static const int tbl_size = 20011; // Large prime number to reduce collisions
-    ActorNode* table[tbl_size];
+const EntityPolicy entity_policy[entity_type_count] = {
+    { "actor", 20011, max_links },
+    { "director", 4099, max_links },
+    { "genre", 61, genre_links },
+};
 
-    int calc_hash(string key) const {
-        unsigned long h = 0;
-        for (char c : key) h = (h * 31) + c;
-        return h % tbl_size;
+// Splits an optional "actor:", "director:" or "genre:" prefix off a search text. Returns the set of types
+// to search: the prefixed type, or all of the default types if there is no prefix.
+int entity_types_of(const string& text, int default_types, string& name) {
+    for (int t = 0; t < entity_type_count; t++) {
+        size_t len = strlen(entity_policy[t].name);
+        if (text.size() <= len || text[len] != ':') continue;
+        bool same = true;
+        for (size_t i = 0; i < len && same; i++) same = (text[i] | 0x20) == entity_policy[t].name[i];
+        if (!same) continue;
+        size_t at = len + 1;
+        while (at < text.size() && text[at] == ' ') at++;
+        name = text.substr(at);
+        return 1 << t;
     }
+    name = text;
+    return default_types;
+}
 
-public:
-    HashTable() {
-        for (int i = 0; i < tbl_size; i++) table[i] = nullptr;
+// Key of an entity in stores that keep all types in one table (disk and sharded mode)
+string entity_key(int type, const string& key) {
+    return string(1, entity_policy[type].name[0]) + ':' + key;
+}
+
+// Movies found by an entity search over a set of types: the lists of the types joined in type order, every
+// movie once. list_of(type, key, ids) fills one list and returns false if the key was never indexed under
+// the type. False if no list was found.
+template <typename ListFn>
+bool entity_lists(int types, const string& name, ListFn list_of, my_array<int>& out) {
+    out.clear();
+    string key = format_key(name);
+    if (key == "") return false;
+    bool found = false;
+    my_array<int> part, seen;
+    for (int t = 0; t < entity_type_count; t++) {
+        if (!(types >> t & 1) || !list_of(t, key, part)) continue;
+        if (!found) {
+            found = true;
+            out.swap(part);
+            continue;
+        }
+        seen.clear();
+        for (int i = 0; i < out.size(); i++) seen.push(out[i]);
+        seen.sort_unique();
+        for (int i = 0; i < part.size(); i++) {
+            if (!sorted_contains(seen.data(), seen.size(), part[i])) out.push(part[i]);
+        }
     }
+    return found;
+}
 
-    ~HashTable() {
-        for (int i = 0; i < tbl_size; i++) {
-            ActorNode* curr = table[i];
-            while (curr != nullptr) {
-                ActorNode* temp = curr;
-                curr = curr->next;
-                delete temp;
+// Entity search text (with an optional type prefix) over the default types
+template <typename ListFn>
+bool entity_search(const string& text, int default_types, ListFn list_of, my_array<int>& out) {
+    string name;
+    int types = entity_types_of(text, default_types, name);
+    return entity_lists(types, name, list_of, out);
+}
+
+// Persistent Nodes
+// The parts that catalog versions share (see CatalogVersion). A node never changes once a published version
+// can reach it: a write copies the nodes on the way to what it changes (path copying), and the next version
+// points to those copies and to every node of the previous one that the write did not touch.
+// refs counts the versions and nodes pointing to a node; only the writer changes it (readers never free
+// anything, see VersionStore). stamp is the number of the version a node was made for: a write changes the
+// nodes it made itself in place, so a part touched twice in one write is copied once.
+template <typename T>
+T* retain(T* p) {
+    if (p) p->refs++;
+    return p;
+}
+
+// Id List
+// Immutable list of movie uids: a movie's links or the movies under an entity key. Up to leaf_size ids sit in
+// one leaf; a longer list is a table of leaves, so adding or removing an id copies one leaf and the table
+// instead of the whole list. nullptr is the empty list. Leaves are written as plain ints; in compact mode the
+// leaves a write made are packed as varint deltas before its version is published (see Draft::seal).
+struct IdList {
+    static const int leaf_size = 64;
+    int refs;
+    long long stamp;
+    int count;             // Ids in the whole list
+    int cap;               // Slots allocated in ids (leaf) or part (table)
+    int* ids;              // Plain leaf
+    unsigned char* packed; // Packed leaf
+    int packed_bytes;
+    IdList** part;         // Table: its leaves in order
+    int parts;
+
+    IdList(long long s) : refs(1), stamp(s), count(0), cap(0), ids(nullptr), packed(nullptr), packed_bytes(0),
+                          part(nullptr), parts(0) {}
+    ~IdList() {
+        for (int i = 0; i < parts; i++) release(part[i]);
+        delete[] ids;
+        delete[] packed;
+        delete[] part;
+    }
+    IdList(const IdList&) = delete;
+    IdList& operator=(const IdList&) = delete;
+
+    static void release(IdList* l) {
+        if (l && --l->refs == 0) delete l;
+    }
+
+    static int size(const IdList* l) { return l ? l->count : 0; }
+
+    // The ids of one leaf
+    IdCursor leaf_cursor() const {
+        if (packed) return IdCursor(packed, packed + packed_bytes);
+        return IdCursor(ids, ids + count);
+    }
+
+    // Position of id in a leaf, -1 if it is not there
+    static int index_of(const IdList* leaf, int id) {
+        IdCursor c = leaf->leaf_cursor();
+        int x;
+        for (int i = 0; c.next(x); i++) if (x == id) return i;
+        return -1;
+    }
+
+    static int first(const IdList* leaf) {
+        IdCursor c = leaf->leaf_cursor();
+        int x = -1;
+        c.next(x);
+        return x;
+    }
+
+    // Last id of a list, -1 if it is empty
+    static int last(const IdList* l) {
+        if (!l) return -1;
+        if (l->part) l = l->part[l->parts - 1];
+        if (l->ids) return l->ids[l->count - 1];
+        IdCursor c = l->leaf_cursor();
+        int x = -1;
+        while (c.next(x)) {}
+        return x;
+    }
+
+    static bool contains(const IdList* l, int id);
+
+    // Bytes and allocations of a list; tables count their leaves too
+    static void account(const IdList* l, MemoryReport& r, int p) {
+        if (!l) return;
+        if (l->part) {
+            r.add(p, sizeof(IdList) + (long long)l->cap * sizeof(IdList*), 2);
+            for (int i = 0; i < l->parts; i++) account(l->part[i], r, p);
+            return;
+        }
+        r.add(p, sizeof(IdList) + (l->ids ? (long long)l->cap * sizeof(int) : l->packed_bytes), 2);
+    }
+};
+
+// Walks an IdList leaf by leaf
+class ListCursor {
+private:
+    const IdList* list;
+    int next_part;
+    IdCursor cur;
+
+public:
+    ListCursor(const IdList* l) : list(l), next_part(0) {
+        if (l && !l->part) cur = l->leaf_cursor();
+    }
+
+    bool next(int& id) {
+        while (!cur.next(id)) {
+            if (!list || !list->part || next_part == list->parts) return false;
+            cur = list->part[next_part++]->leaf_cursor();
+        }
+        return true;
+    }
+};
+
+bool IdList::contains(const IdList* l, int id) {
+    ListCursor c(l);
+    int x;
+    while (c.next(x)) if (x == id) return true;
+    return false;
+}
+
+// Draft
+// The list operations of one write. stamp is the number of the version being built; in compact mode the leaves
+// the write made are remembered (one reference each) and packed by seal() once the write is done.
+// ref is the caller's reference to a list: an operation never changes a node of an older version, it puts the
+// changed copy into ref instead.
+class Draft {
+private:
+    my_array<IdList*> fresh;
+
+    IdList* new_leaf(int capacity) {
+        IdList* l = new IdList(stamp);
+        l->cap = capacity;
+        l->ids = new int[capacity];
+        if (compact) fresh.push(retain(l));
+        return l;
+    }
+
+    // Makes slot a plain leaf of this write with room for extra more ids
+    void own_leaf(IdList*& slot, int extra) {
+        IdList* l = slot;
+        int want = l->count + extra;
+        if (l->stamp == stamp) {
+            if (want <= l->cap) return;
+            int grown = get_max(l->cap * 2, 4);
+            if (grown > IdList::leaf_size) grown = IdList::leaf_size;
+            int* bigger = new int[grown];
+            for (int i = 0; i < l->count; i++) bigger[i] = l->ids[i];
+            delete[] l->ids;
+            l->ids = bigger;
+            l->cap = grown;
+            return;
+        }
+        IdList* copy = new_leaf(get_max(want, 1));
+        IdCursor c = l->leaf_cursor();
+        int id;
+        while (c.next(id)) copy->ids[copy->count++] = id;
+        IdList::release(l);
+        slot = copy;
+    }
+
+    // Makes ref a table of this write with room for extra more leaves
+    void own_table(IdList*& ref, int extra) {
+        IdList* t = ref;
+        int want = t->parts + extra;
+        if (t->stamp == stamp && want <= t->cap) return;
+        int capacity = (t->stamp == stamp) ? t->cap * 2 : want + 1;
+        IdList** bigger = new IdList*[capacity];
+        if (t->stamp == stamp) {
+            for (int i = 0; i < t->parts; i++) bigger[i] = t->part[i];
+            delete[] t->part;
+            t->part = bigger;
+            t->cap = capacity;
+            return;
+        }
+        IdList* copy = new IdList(stamp);
+        for (int i = 0; i < t->parts; i++) bigger[i] = retain(t->part[i]);
+        copy->part = bigger;
+        copy->cap = capacity;
+        copy->parts = t->parts;
+        copy->count = t->count;
+        IdList::release(t);
+        ref = copy;
+    }
+
+    static void erase_at(IdList* leaf, int at) {
+        for (int i = at; i + 1 < leaf->count; i++) leaf->ids[i] = leaf->ids[i + 1];
+        leaf->count--;
+    }
+
+public:
+    long long stamp;
+    bool compact;
+
+    Draft(long long s, bool compact_mode) : stamp(s), compact(compact_mode) {}
+    ~Draft() {
+        for (int i = 0; i < fresh.size(); i++) IdList::release(fresh[i]);
+    }
+    Draft(const Draft&) = delete;
+    Draft& operator=(const Draft&) = delete;
+
+    // Adds id at the end of the list
+    void push(IdList*& ref, int id) {
+        if (!ref) {
+            ref = new_leaf(4);
+            ref->ids[ref->count++] = id;
+            return;
+        }
+        if (!ref->part && ref->count < IdList::leaf_size) {
+            own_leaf(ref, 1);
+            ref->ids[ref->count++] = id;
+            return;
+        }
+        if (!ref->part) { // A full leaf becomes the first leaf of a table
+            IdList* table = new IdList(stamp);
+            table->cap = 4;
+            table->part = new IdList*[table->cap];
+            table->part[table->parts++] = ref;
+            table->count = ref->count;
+            ref = table;
+        }
+        if (ref->part[ref->parts - 1]->count == IdList::leaf_size) {
+            own_table(ref, 1);
+            ref->part[ref->parts++] = new_leaf(4);
+        } else own_table(ref, 0);
+        IdList*& leaf = ref->part[ref->parts - 1];
+        own_leaf(leaf, 1);
+        leaf->ids[leaf->count++] = id;
+        ref->count++;
+    }
+
+    // Removes the first occurrence of id; false if it is not there. sorted: the list is ascending, so only the
+    // leaf that can hold id is searched.
+    bool remove(IdList*& ref, int id, bool sorted) {
+        if (!ref) return false;
+        if (!ref->part) {
+            int at = IdList::index_of(ref, id);
+            if (at == -1) return false;
+            own_leaf(ref, 0);
+            erase_at(ref, at);
+            if (ref->count == 0) {
+                IdList::release(ref);
+                ref = nullptr;
+            }
+            return true;
+        }
+        for (int p = 0; p < ref->parts; p++) {
+            if (sorted && p + 1 < ref->parts && IdList::first(ref->part[p + 1]) <= id) continue;
+            int at = IdList::index_of(ref->part[p], id);
+            if (at == -1) {
+                if (sorted) return false;
+                continue;
+            }
+            own_table(ref, 0);
+            IdList*& leaf = ref->part[p];
+            own_leaf(leaf, 0);
+            erase_at(leaf, at);
+            ref->count--;
+            if (leaf->count == 0) { // Empty leaves are dropped
+                IdList::release(leaf);
+                for (int q = p; q + 1 < ref->parts; q++) ref->part[q] = ref->part[q + 1];
+                ref->parts--;
+            }
+            if (ref->count == 0) {
+                IdList::release(ref);
+                ref = nullptr;
             }
+            return true;
         }
+        return false;
     }
 
-    // Inserts a movie into a specific bucket (Key: Actor/Genre Name)
-    // Also builds the Graph: If movies share a bucket, they are connected.
-    void insert_item(string raw_key, MovieNode* movie) {
-        string k = format_key(raw_key);
-        if (k == "") return;
-        
-        int idx = calc_hash(k);
-        ActorNode* curr = table[idx];
-
-        while (curr != nullptr) {
-            if (curr->key == k) {
-                if (curr->movies.has_item(movie)) return;
-
-                // Create graph edges with existing movies in this bucket
-                list_node<MovieNode*>* existing = curr->movies.head;
-                int count = 0;
-                while (existing != nullptr && count < max_links) {
-                    movie->add_link(existing->data);
-                    existing->data->add_link(movie);
-                    existing = existing->next;
-                    count++;
-                }
-                curr->movies.insert(movie);
-                return;
+    // Packs the leaves this write made and still uses (compact mode); the write must be done
+    void seal() {
+        for (int i = 0; i < fresh.size(); i++) {
+            IdList* l = fresh[i];
+            if (l->refs > 1 && l->ids) {
+                l->packed_bytes = packed_size(l->ids, l->count);
+                l->packed = new unsigned char[l->packed_bytes > 0 ? l->packed_bytes : 1];
+                pack_ids(l->ids, l->count, l->packed);
+                delete[] l->ids;
+                l->ids = nullptr;
+                l->cap = 0;
+            }
+            IdList::release(l);
+        }
+        fresh.clear();
+    }
+};
+
+// Radix Table
+// Persistent array of slots indexed by small numbers (uids, bucket numbers): a tree of 64-way nodes, so a
+// change copies one node per level. Slot types give retain() and release() for the references a slot holds;
+// a slot that was never set is all zeros.
+template <typename Slot>
+class RadixTable {
+private:
+    static const int bits = 6;
+    static const int fan = 1 << bits;
+    struct Node {
+        int refs;
+        long long stamp;
+    };
+    struct Inner : Node {
+        Node* child[fan];
+    };
+    struct Leaf : Node {
+        Slot slot[fan];
+    };
+
+    Node* root;
+    int levels; // 0 = empty, 1 = the root is a leaf
+
+    static void release(Node* n, int level) {
+        if (!n || --n->refs > 0) return;
+        if (level == 1) {
+            Leaf* leaf = (Leaf*)n;
+            for (int i = 0; i < fan; i++) Slot::release(leaf->slot[i]);
+            delete leaf;
+        } else {
+            Inner* inner = (Inner*)n;
+            for (int i = 0; i < fan; i++) release(inner->child[i], level - 1);
+            delete inner;
+        }
+    }
+
+    // Makes n a node of this write: created if missing, else copied unless the write made it
+    static void own_node(Node*& n, int level, long long stamp) {
+        if (n && n->stamp == stamp) return;
+        Node* fresh;
+        if (level == 1) {
+            Leaf* leaf = new Leaf();
+            for (int i = 0; n && i < fan; i++) {
+                leaf->slot[i] = ((Leaf*)n)->slot[i];
+                Slot::retain(leaf->slot[i]);
             }
-            curr = curr->next;
+            fresh = leaf;
+        } else {
+            Inner* inner = new Inner();
+            for (int i = 0; n && i < fan; i++) inner->child[i] = retain(((Inner*)n)->child[i]);
+            fresh = inner;
+        }
+        fresh->refs = 1;
+        fresh->stamp = stamp;
+        release(n, level);
+        n = fresh;
+    }
+
+    template <typename Fn>
+    static void walk(const Node* n, int level, int base, Fn& fn) {
+        if (!n) return;
+        if (level == 1) {
+            for (int i = 0; i < fan; i++) fn(base + i, ((const Leaf*)n)->slot[i]);
+            return;
+        }
+        int span = 1 << (bits * (level - 1));
+        for (int i = 0; i < fan; i++) walk(((const Inner*)n)->child[i], level - 1, base + i * span, fn);
+    }
+
+    static void account_nodes(const Node* n, int level, MemoryReport& r, int p) {
+        if (!n) return;
+        if (level == 1) {
+            r.add(p, sizeof(Leaf));
+            return;
         }
+        r.add(p, sizeof(Inner));
+        for (int i = 0; i < fan; i++) account_nodes(((const Inner*)n)->child[i], level - 1, r, p);
+    }
 
-        ActorNode* new_node = new ActorNode(k);
-        new_node->movies.insert(movie);
-        new_node->next = table[idx];
-        table[idx] = new_node;
+public:
+    RadixTable() : root(nullptr), levels(0) {}
+    ~RadixTable() { release(root, levels); }
+    RadixTable(const RadixTable&) = delete;
+    RadixTable& operator=(const RadixTable&) = delete;
+
+    // Starts out as the other table (a new version shares every node with the previous one)
+    void share(const RadixTable& other) {
+        release(root, levels);
+        root = retain(other.root);
+        levels = other.levels;
     }
 
-    LinkedList<MovieNode*>* find_item(string key) {
-        string k = format_key(key);
-        int idx = calc_hash(k);
-        ActorNode* curr = table[idx];
-        while (curr != nullptr) {
-            if (curr->key == k) return &curr->movies;
-            curr = curr->next;
+    int capacity() const { return levels == 0 ? 0 : 1 << (bits * levels); }
+
+    // Slot i, nullptr if it was never set
+    const Slot* find(int i) const {
+        if (i < 0 || i >= capacity()) return nullptr;
+        const Node* n = root;
+        for (int level = levels; n; level--) {
+            int digit = (i >> (bits * (level - 1))) & (fan - 1);
+            if (level == 1) return &((const Leaf*)n)->slot[digit];
+            n = ((const Inner*)n)->child[digit];
         }
         return nullptr;
     }
 
-    // Removes a specific movie reference from an index bucket
-    void remove_ref(string key, MovieNode* node) {
-        string k = format_key(key);
-        int idx = calc_hash(k);
-        ActorNode* curr = table[idx];
-        while (curr != nullptr) {
-            if (curr->key == k) {
-                curr->movies.remove(node);
-                return;
+    // Slot i in nodes of this write (the tree grows to reach i). Stays valid until the write is done: a node the
+    // write made is never copied again.
+    Slot& own(int i, long long stamp) {
+        if (levels == 0) levels = 1;
+        while (i >= capacity()) {
+            Inner* up = new Inner();
+            up->refs = 1;
+            up->stamp = stamp;
+            up->child[0] = root;
+            root = up;
+            levels++;
+        }
+        Node** at = &root;
+        for (int level = levels; ; level--) {
+            own_node(*at, level, stamp);
+            int digit = (i >> (bits * (level - 1))) & (fan - 1);
+            if (level == 1) return ((Leaf*)*at)->slot[digit];
+            at = &((Inner*)*at)->child[digit];
+        }
+    }
+
+    // Calls fn(i, slot) for every slot of the existing leaves, in index order
+    template <typename Fn>
+    void each(Fn fn) const { walk(root, levels, 0, fn); }
+
+    void account(MemoryReport& r, int p) const { account_nodes(root, levels, r, p); }
+};
+
+// One movie of a MovieTable
+struct MovieSlot {
+    MovieRecord* rec; // nullptr = no movie has this uid (any more)
+    IdList* links;    // Uids of the linked movies, in link order
+
+    static void retain(MovieSlot& s) {
+        if (s.rec) s.rec->refs++;
+        ::retain(s.links);
+    }
+    static void release(MovieSlot& s) {
+        release_record(s.rec);
+        IdList::release(s.links);
+    }
+};
+
+// Movie Table
+// The movies of one version by uid, with their graph links. Uids are handed out in the order movies are added
+// and never reused, so they double as graph vertex ids and stay valid from version to version.
+// Every link is stored in the lists of both of its movies.
+class MovieTable {
+public:
+    RadixTable<MovieSlot> slots;
+    int bound;            // Uids handed out so far
+    int count;            // Movies
+    long long edge_count; // Entries of all link lists
+
+    MovieTable() : bound(0), count(0), edge_count(0) {}
+
+    void share(const MovieTable& other) {
+        slots.share(other.slots);
+        bound = other.bound;
+        count = other.count;
+        edge_count = other.edge_count;
+    }
+
+    const MovieRecord* record(int uid) const {
+        const MovieSlot* s = slots.find(uid);
+        return s ? s->rec : nullptr;
+    }
+    const IdList* links(int uid) const {
+        const MovieSlot* s = slots.find(uid);
+        return s ? s->links : nullptr;
+    }
+    int degree(int uid) const { return IdList::size(links(uid)); }
+    ListCursor edges(int uid) const { return ListCursor(links(uid)); }
+};
+
+// One key of an EntityPostings chain
+struct PostingNode {
+    int refs;
+    long long stamp;
+    int key;            // Name id whose search key this is (see NameDict)
+    IdList* movies;     // Uids in the order they were indexed (ascending)
+    PostingNode* next;
+
+    // Drops one reference; a node left without any is freed, and so on down the chain
+    static void release(PostingNode* p) {
+        while (p && --p->refs == 0) {
+            PostingNode* next = p->next;
+            IdList::release(p->movies);
+            delete p;
+            p = next;
+        }
+    }
+};
+
+struct PostingBucket {
+    PostingNode* head;
+
+    static void retain(PostingBucket& b) { ::retain(b.head); }
+    static void release(PostingBucket& b) { PostingNode::release(b.head); }
+};
+
+// Entity Postings
+// One entity type's keys (see EntityPolicy) in one version: hash buckets in a RadixTable, each a chain of keys
+// with the uids of their movies. New keys go to the front of their chain; a key stays when its last movie is
+// removed. Changing a key copies its bucket's path and the chain up to the key.
+class EntityPostings {
+private:
+    int type;
+    RadixTable<PostingBucket> buckets;
+
+    int bucket_of(const string& key) const { return (int)(str_hash(key) % entity_policy[type].buckets); }
+
+public:
+    EntityPostings() : type(0) {}
+
+    void init(int t) { type = t; }
+    void share(const EntityPostings& other) {
+        type = other.type;
+        buckets.share(other.buckets);
+    }
+
+    const PostingNode* find(const string& key) const {
+        const PostingBucket* b = buckets.find(bucket_of(key));
+        for (const PostingNode* p = b ? b->head : nullptr; p; p = p->next) {
+            if (names.key(p->key) == key) return p;
+        }
+        return nullptr;
+    }
+
+    // The key's node as a node of this write, so its movies can change. A missing key is added with the name id
+    // if add is set; otherwise nullptr is returned.
+    PostingNode* own(const string& key, int name, bool add, long long stamp) {
+        bool exists = find(key) != nullptr;
+        if (!exists && !add) return nullptr;
+        PostingBucket& b = buckets.own(bucket_of(key), stamp);
+        if (!exists) {
+            PostingNode* p = new PostingNode();
+            p->refs = 1;
+            p->stamp = stamp;
+            p->key = name;
+            p->movies = nullptr;
+            p->next = b.head;
+            b.head = p;
+            return p;
+        }
+        for (PostingNode** at = &b.head; ; at = &(*at)->next) {
+            PostingNode* p = *at;
+            if (p->stamp != stamp) {
+                PostingNode* copy = new PostingNode();
+                copy->refs = 1;
+                copy->stamp = stamp;
+                copy->key = p->key;
+                copy->movies = retain(p->movies);
+                copy->next = retain(p->next);
+                PostingNode::release(p);
+                *at = p = copy;
+            }
+            if (names.key(p->key) == key) return p;
+        }
+    }
+
+    // Calls fn(node) for every key, in bucket order
+    template <typename Fn>
+    void each_key(Fn fn) const {
+        buckets.each([&fn](int, const PostingBucket& b) {
+            for (const PostingNode* p = b.head; p; p = p->next) fn(p);
+        });
+    }
+
+    void show_stats(ostream& out) const {
+        int keys = 0, postings = 0, largest_count = 0;
+        const PostingNode* largest = nullptr;
+        each_key([&](const PostingNode* p) {
+            keys++;
+            postings += IdList::size(p->movies);
+            if (!largest || IdList::size(p->movies) > largest_count) {
+                largest = p;
+                largest_count = IdList::size(p->movies);
             }
-            curr = curr->next;
+        });
+        out << entity_policy[type].name << ": " << keys << " keys in " << entity_policy[type].buckets
+            << " buckets | " << postings << " postings | links per key: " << entity_policy[type].links;
+        if (largest) out << " | largest: " << names.key(largest->key) << " (" << largest_count << ")";
+        out << "\n";
+    }
+
+    // Bucket nodes and keys, and the movie lists; largest gets every key's movie count
+    void account(MemoryReport& r, MemoryReport::Top& largest) const {
+        string name = entity_policy[type].name;
+        int keys = r.part(name + " index buckets", "keys");
+        int postings = r.part(name + " index postings", "postings");
+        buckets.account(r, keys);
+        each_key([&](const PostingNode* p) {
+            r.add(keys, sizeof(PostingNode));
+            r.count(keys, 1);
+            IdList::account(p->movies, r, postings);
+            r.count(postings, IdList::size(p->movies));
+            largest.offer(IdList::size(p->movies), names.key(p->key));
+        });
+    }
+};
+
+// Title Tree
+// Persistent AVL tree of one version's movies by search key. A node holds the movie's current record, so an
+// edit copies the path to its node; inserts and removes copy the paths they rebalance (see Persistent Nodes).
+struct TitleNode {
+    int refs;
+    long long stamp;
+    MovieRecord* rec;
+    int uid;
+    int height;
+    TitleNode* left;
+    TitleNode* right;
+
+    static void release(TitleNode* n) {
+        if (!n || --n->refs > 0) return;
+        release(n->left);
+        release(n->right);
+        release_record(n->rec);
+        delete n;
+    }
+};
+
+class TitleTree {
+private:
+    TitleNode* root;
+
+    static int height(const TitleNode* n) { return n ? n->height : 0; }
+    static int balance_of(const TitleNode* n) { return n ? height(n->left) - height(n->right) : 0; }
+    static void fix_height(TitleNode* n) { n->height = 1 + get_max(height(n->left), height(n->right)); }
+
+    // n as a node of this write: n itself if the write made it, else a copy that takes its place
+    static TitleNode* own(TitleNode* n, long long stamp) {
+        if (n->stamp == stamp) return n;
+        TitleNode* copy = new TitleNode(*n);
+        copy->refs = 1;
+        copy->stamp = stamp;
+        copy->rec->refs++;
+        retain(copy->left);
+        retain(copy->right);
+        TitleNode::release(n);
+        return copy;
+    }
+
+    // Rotations on nodes of this write only move references, so no counts change
+    static TitleNode* rot_right(TitleNode* y, long long stamp) {
+        TitleNode* x = y->left = own(y->left, stamp);
+        y->left = x->right;
+        x->right = y;
+        fix_height(y);
+        fix_height(x);
+        return x;
+    }
+
+    static TitleNode* rot_left(TitleNode* x, long long stamp) {
+        TitleNode* y = x->right = own(x->right, stamp);
+        x->right = y->left;
+        y->left = x;
+        fix_height(x);
+        fix_height(y);
+        return y;
+    }
+
+    static TitleNode* rebalance(TitleNode* n, long long stamp) {
+        fix_height(n);
+        int bal = balance_of(n);
+        if (bal > 1) {
+            if (balance_of(n->left) < 0) n->left = rot_left(own(n->left, stamp), stamp);
+            return rot_right(n, stamp);
+        }
+        if (bal < -1) {
+            if (balance_of(n->right) > 0) n->right = rot_right(own(n->right, stamp), stamp);
+            return rot_left(n, stamp);
+        }
+        return n;
+    }
+
+    static TitleNode* insert_rec(TitleNode* n, TitleNode* fresh, const string& key, long long stamp) {
+        if (!n) return fresh;
+        n = own(n, stamp);
+        string scratch;
+        if (key < n->rec->key(scratch)) n->left = insert_rec(n->left, fresh, key, stamp);
+        else n->right = insert_rec(n->right, fresh, key, stamp);
+        return rebalance(n, stamp);
+    }
+
+    static TitleNode* remove_rec(TitleNode* n, const string& key, long long stamp) {
+        if (!n) return n;
+        string scratch;
+        int cmp = key.compare(n->rec->key(scratch));
+        n = own(n, stamp);
+        if (cmp < 0) n->left = remove_rec(n->left, key, stamp);
+        else if (cmp > 0) n->right = remove_rec(n->right, key, stamp);
+        else if (!n->left || !n->right) {
+            TitleNode* child = n->left ? n->left : n->right;
+            n->left = n->right = nullptr;
+            TitleNode::release(n);
+            return child;
+        } else {
+            // Two children: the in-order successor's movie moves into this node
+            const TitleNode* next = n->right;
+            while (next->left) next = next->left;
+            MovieRecord* rec = next->rec;
+            rec->refs++;
+            release_record(n->rec);
+            n->rec = rec;
+            n->uid = next->uid;
+            string next_scratch;
+            n->right = remove_rec(n->right, rec->key(next_scratch), stamp);
+        }
+        return rebalance(n, stamp);
+    }
+
+    static TitleNode* replace_rec(TitleNode* n, const string& key, MovieRecord* rec, long long stamp) {
+        n = own(n, stamp);
+        string scratch;
+        int cmp = key.compare(n->rec->key(scratch));
+        if (cmp < 0) n->left = replace_rec(n->left, key, rec, stamp);
+        else if (cmp > 0) n->right = replace_rec(n->right, key, rec, stamp);
+        else {
+            rec->refs++;
+            release_record(n->rec);
+            n->rec = rec;
+        }
+        return n;
+    }
+
+public:
+    // In-order walk (title order) with an explicit stack of the nodes whose right subtrees are still to come
+    class Cursor {
+    private:
+        my_array<const TitleNode*> stack;
+
+        void push_left(const TitleNode* n) {
+            for (; n; n = n->left) stack.push(n);
+        }
+
+    public:
+        Cursor(const TitleTree& tree) { push_left(tree.root); }
+
+        // Next movie in title order, nullptr after the last
+        const TitleNode* next() {
+            if (stack.size() == 0) return nullptr;
+            const TitleNode* n = stack.pop();
+            push_left(n->right);
+            return n;
+        }
+    };
+
+    TitleTree() : root(nullptr) {}
+    ~TitleTree() { TitleNode::release(root); }
+    TitleTree(const TitleTree&) = delete;
+    TitleTree& operator=(const TitleTree&) = delete;
+
+    void share(const TitleTree& other) {
+        TitleNode::release(root);
+        root = retain(other.root);
+    }
+
+    const TitleNode* find(const string& key) const {
+        const TitleNode* n = root;
+        string scratch;
+        while (n) {
+            int cmp = key.compare(n->rec->key(scratch));
+            if (cmp == 0) return n;
+            n = (cmp < 0) ? n->left : n->right;
         }
+        return nullptr;
+    }
+
+    // The key must not be in the tree yet
+    void insert(MovieRecord* rec, int uid, long long stamp) {
+        TitleNode* fresh = new TitleNode();
+        fresh->refs = 1;
+        fresh->stamp = stamp;
+        fresh->rec = rec;
+        rec->refs++;
+        fresh->uid = uid;
+        fresh->height = 1;
+        fresh->left = fresh->right = nullptr;
+        string scratch;
+        root = insert_rec(root, fresh, rec->key(scratch), stamp);
     }
+
+    // The key must be in the tree
+    void remove(const string& key, long long stamp) { root = remove_rec(root, key, stamp); }
+    void set_record(const string& key, MovieRecord* rec, long long stamp) { root = replace_rec(root, key, rec, stamp); }
 };
 
 // AVL Tree Class
-// Stores movies sorted by title, ensuring balanced height for efficient search.
+// Stores movies sorted by title, ensuring balanced height for efficient search (one tree per Shard).
 class AVLTree {
 private:
     MovieNode* root;
-    HashTable* indexer; 
+    my_array<MovieNode*> by_uid; // Uid -> node (nullptr once deleted); uids are never reused
 
     int get_h(const MovieNode* n) const {
         if (n == nullptr) return 0;
@@ -474,43 +2139,6 @@ private:
         return curr;
     }
 
-    // Cleans up pointers in the Hash Table and Neighbor lists before deleting a node
-    void clear_node_refs(MovieNode* node) {
-        if (!node || !indexer) return;
-        list_node<MovieNode*>* n_ptr = node->neighbors.head;
-        while (n_ptr) {
-            if (n_ptr->data) {
-                n_ptr->data->neighbors.remove(node);
-            }
-            n_ptr = n_ptr->next;
-        }
-        list_node<string>* a_ptr = node->actors.head;
-        while (a_ptr) {
-            indexer->remove_ref(a_ptr->data, node);
-            a_ptr = a_ptr->next;
-        }
-        list_node<string>* g_ptr = node->genres.head;
-        while (g_ptr) {
-            indexer->remove_ref(g_ptr->data, node);
-            g_ptr = g_ptr->next;
-        }
-    }
-
-    // Re-adds node attributes to the Hash Table (used after swapping data during deletion)
-    void reindex(MovieNode* node) {
-        if (!indexer) return;
-        list_node<string>* a_ptr = node->actors.head;
-        while (a_ptr) {
-            indexer->insert_item(a_ptr->data, node);
-            a_ptr = a_ptr->next;
-        }
-        list_node<string>* g_ptr = node->genres.head;
-        while (g_ptr) {
-            indexer->insert_item(g_ptr->data, node);
-            g_ptr = g_ptr->next;
-        }
-    }
-
     // Recursively deletes a node by key and rebalances
     MovieNode* delete_rec(MovieNode* root, string key) {
         if (root == nullptr) return root;
@@ -523,22 +2151,19 @@ private:
                 MovieNode* temp = root->left ? root->left : root->right;
                 if (temp == nullptr) {
                     temp = root;
-                    clear_node_refs(temp);
                     root = nullptr;
+                    by_uid[temp->uid] = nullptr;
                     delete temp;
                 } else {
                     MovieNode* to_del = root;
                     root = temp; 
-                    clear_node_refs(to_del);
+                    by_uid[to_del->uid] = nullptr;
                     delete to_del;
                 }
             } else {
                 // Node with two children: Get inorder successor
                 MovieNode* temp = get_min(root->right);
-                clear_node_refs(temp);
-                clear_node_refs(root);
                 root->copy_data(temp); 
-                reindex(root);
                 root->right = delete_rec(root->right, temp->search_key);
             }
         }
@@ -568,36 +2193,6 @@ private:
         return search_rec(root->right, key);
     }
 
-    void inorder_rec(const MovieNode* root) const {
-        if (root != nullptr) {
-            inorder_rec(root->left);
-            cout << root->title << " (" << root->year << ")\n";
-            inorder_rec(root->right);
-        }
-    }
-    
-    // Recursive traversal for Year Search
-    void search_year_rec(const MovieNode* root, int y, bool& f) const {
-        if(!root) return;
-        search_year_rec(root->left, y, f);
-        if(root->year == y) {
-            cout << "- " << root->title << endl;
-            f = true;
-        }
-        search_year_rec(root->right, y, f);
-    }
-
-    // Recursive traversal for Rating Search
-    void search_rating_rec(const MovieNode* root, float min, float max, bool& f) const {
-        if(!root) return;
-        search_rating_rec(root->left, min, max, f);
-        if(root->rating >= min && root->rating <= max) {
-            cout << "- " << root->title << " [" << root->rating << "]" << endl;
-            f = true;
-        }
-        search_rating_rec(root->right, min, max, f);
-    }
-    
     void destroy_rec(MovieNode* node) {
         if (node) {
             destroy_rec(node->left);
@@ -606,358 +2201,6147 @@ private:
         }
     }
 
-    void reset_flags(MovieNode* node) {
-        if(!node) return;
-        node->visited = false;
-        node->parent = nullptr;
-        reset_flags(node->left);
-        reset_flags(node->right);
-    }
-
 public:
-    AVLTree() : root(nullptr), indexer(nullptr) {}
+    // In-order walk (title order) with an explicit stack of the nodes whose right subtrees are still to come
+    class Cursor {
+    private:
+        my_array<MovieNode*> stack;
+
+        void push_left(MovieNode* n) {
+            for (; n; n = n->left) stack.push(n);
+        }
+
+    public:
+        Cursor(const AVLTree& tree) { push_left(tree.root); }
+
+        // Next movie in title order, nullptr after the last
+        MovieNode* next() {
+            if (stack.size() == 0) return nullptr;
+            MovieNode* n = stack.pop();
+            push_left(n->right);
+            return n;
+        }
+    };
+
+    AVLTree() : root(nullptr) {}
     ~AVLTree() { destroy_rec(root); }
 
-    void set_idx(HashTable* ht) { indexer = ht; }
+    // Gives a new node its uid; must happen before the node is indexed (linking uses uids)
+    void track(MovieNode* n) {
+        n->uid = by_uid.size();
+        by_uid.push(n);
+    }
+    int uid_count() const { return by_uid.size(); }
+
     void insert(MovieNode* n) { root = insert_rec(root, n); }
     
-    void remove_node(string t) {
+    void remove_node(string t, ostream& out) {
         if (!find_movie(t)) {
-            cout << "Movie not found.\n";
+            out << "Movie not found.\n";
             return;
         }
         root = delete_rec(root, format_key(t));
-        cout << "Movie '" << t << "' deleted.\n";
+        out << "Movie '" << t << "' deleted.\n";
     }
     
     MovieNode* find_movie(string t) { return search_rec(root, format_key(t)); }
-    void print_all() const { inorder_rec(root); }
     
-    void find_by_year(int y) const {
-        bool f = false;
-        cout << "\n--- Movies from " << y << " ---\n";
-        search_year_rec(root, y, f);
-        if(!f) cout << "None found.\n";
-    }
-
-    void find_by_rating(float min, float max) const {
-        bool f = false;
-        cout << "\n--- Movies rated " << min << " to " << max << " ---\n";
-        search_rating_rec(root, min, max, f);
-        if(!f) cout << "None found.\n";
+    // The nodes split into movie data, strings, id lists, graph links and the tree's own pointers and heights
+    // (with the uid table). most gets every movie's link count.
+    void account(MemoryReport& r, MemoryReport::Top& most) const {
+        int nodes = r.part("Movie nodes", "movies");
+        int strings = r.part("Movie strings");
+        int lists = r.part("Cast and genre lists", "names");
+        int links = r.part("Graph links", "links");
+        int avl = r.part("AVL overhead");
+        long long avl_bytes = 2 * sizeof(MovieNode*) + sizeof(int);
+        Cursor c(*this);
+        while (const MovieNode* m = c.next()) {
+            r.add(nodes, sizeof(MovieNode) - avl_bytes);
+            r.count(nodes, 1);
+            r.add(avl, avl_bytes, 0);
+            r.add_string(strings, m->title);
+            r.add_string(strings, m->search_key);
+            r.add_array(lists, m->actors);
+            r.add_array(lists, m->genres);
+            r.count(lists, m->actors.size() + m->genres.size());
+            if (m->neighbors.capacity() > 0) r.add(links, m->neighbors.capacity());
+            r.count(links, m->neighbors.size());
+            most.offer(m->neighbors.size(), m->title);
+        }
+        r.add_array(avl, by_uid);
     }
-    
-    void clear_flags() { reset_flags(root); }
 };
 
-// Graph Class
-// Handles Recommendations (BFS/DFS) and Shortest Path logic.
-class Graph {
-public:
-    // Recommendation using Breadth-First Search (BFS)
-    // Finds immediate and close neighbors first.
-    void recommend_bfs(MovieNode* start, AVLTree& tree, int limit) {
-        if (!start) return;
-        tree.clear_flags(); 
+// Writes the indexes of the k highest scores in score[0..n) into out[] (best first, ties in index order),
+// returns how many were written
+int top_k_scores(const float* score, int n, int k, int* out) {
+    int found = 0;
+    for (int v = 0; v < n; v++) {
+        if (found == k && score[v] <= score[out[k - 1]]) continue;
+        int pos = (found < k) ? found++ : k - 1;
+        while (pos > 0 && score[out[pos - 1]] < score[v]) {
+            out[pos] = out[pos - 1];
+            pos--;
+        }
+        out[pos] = v;
+    }
+    return found;
+}
 
-        my_queue<MovieNode*> q; 
-        q.enqueue(start);
-        start->visited = true;
+// Movie Signature
+// Fixed-width bitset of a movie's genres and people for similarity search.
+// Word 0 holds the genres (see GenreBits), words 1..3 the actors and director hashed into 192 bits.
+struct alignas(32) MovieSignature {
+    static const int words = 4;
+    static const int person_bits = 192;
+    unsigned long long w[words];
 
-        cout << "\n--- Top " << limit << " Recommendations for '" << start->title << "' ---\n";
-        int count = 0;
-        
-        while (!q.empty()) {
-            MovieNode* curr = q.dequeue();
-            list_node<MovieNode*>* n_ptr = curr->neighbors.head;
-            while (n_ptr != nullptr) {
-                MovieNode* neighbor = n_ptr->data;
-                if (neighbor && !neighbor->visited) {
-                    neighbor->visited = true;
-                    q.enqueue(neighbor);
-                    if (neighbor != start) {
-                        cout << "-> " << neighbor->title << " (" << neighbor->rating << "/10)\n";
-                        count++;
-                    }
-                }
-                n_ptr = n_ptr->next;
-                if (count >= limit) return;
-            }
-        }
-        if (count == 0) cout << "No related movies found.\n";
+    MovieSignature() {
+        for (int i = 0; i < words; i++) w[i] = 0;
     }
 
-    // Recommendation using Depth-First Search (DFS)
-    // Explores deep into a specific genre/actor chain.
-    void recommend_dfs(MovieNode* start, AVLTree& tree, int limit) {
-        if (!start) return;
-        tree.clear_flags();
+    void add_genre(const string& key) {
+        if (key != "") w[0] |= 1ULL << genre_bits.find(key, true);
+    }
 
-        my_stack<MovieNode*> s;
-        s.push(start);
-        start->visited = true;
+    void add_person(const string& key) {
+        if (key == "") return;
+        int bit = (int)(str_hash(key) % person_bits);
+        w[1 + bit / 64] |= 1ULL << (bit % 64);
+    }
+};
 
-        cout << "\n--- DFS Recommendation for '" << start->title << "' ---\n";
-        int count = 0;
+#if defined(__AVX2__)
+// Bits set in each 64-bit lane: 4-bit table lookups (pshufb), then byte sums per lane
+inline __m256i popcount_lanes(__m256i v) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+                                     _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+#endif
 
+// Jaccard similarity |a & b| / |a | b| of two signatures (0 if both are empty); genres_only compares word 0
+inline float jaccard(const MovieSignature& a, const MovieSignature& b, bool genres_only) {
+    int common = 0, all = 0;
+    if (genres_only) {
+        common = __builtin_popcountll(a.w[0] & b.w[0]);
+        all = __builtin_popcountll(a.w[0] | b.w[0]);
+    } else {
+#if defined(__AVX2__)
+        __m256i va = _mm256_load_si256((const __m256i*)a.w);
+        __m256i vb = _mm256_load_si256((const __m256i*)b.w);
+        // Common count in the low and union count in the high half of every lane, then one horizontal sum
+        __m256i both = _mm256_add_epi64(popcount_lanes(_mm256_and_si256(va, vb)),
+                                        _mm256_slli_epi64(popcount_lanes(_mm256_or_si256(va, vb)), 32));
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(both), _mm256_extracti128_si256(both, 1));
+        unsigned long long total = (unsigned long long)_mm_cvtsi128_si64(sum) + (unsigned long long)_mm_extract_epi64(sum, 1);
+        common = (int)(total & 0xffffffff);
+        all = (int)(total >> 32);
+#else
+        for (int i = 0; i < MovieSignature::words; i++) {
+            common += __builtin_popcountll(a.w[i] & b.w[i]);
+            all += __builtin_popcountll(a.w[i] | b.w[i]);
+        }
+#endif
+    }
+    return (all == 0) ? 0.0f : (float)common / all;
+}
+
+// Similarity Index
+// Signatures of all movies of one catalog state, in title order, built on first use.
+// Searches are brute force: the worker threads each scan a slice of the signatures and keep their own top k,
+// then the slices' candidates are merged.
+class SimilarityIndex {
+private:
+    MovieSignature* sigs;
+    int n;
+    atomic<bool> ready;
+    mutex build_lock;
+
+public:
+    SimilarityIndex() : sigs(nullptr), n(0), ready(false) {}
+    ~SimilarityIndex() { delete[] sigs; }
+
+    // Fills signature i with fill(i, sig) for every movie; the first caller builds, later callers reuse
+    template <typename Fn>
+    void build(int count, Fn fill) {
+        if (ready) return;
+        lock_guard<mutex> guard(build_lock);
+        if (ready) return;
+        sigs = new MovieSignature[count > 0 ? count : 1];
+        n = count;
+        parallel_for(n, [&](int begin, int end, int) {
+            for (int i = begin; i < end; i++) fill(i, sigs[i]);
+        });
+        ready = true;
+    }
+
+    // Forgets the signatures (the caller makes sure no search is running)
+    void clear() {
+        delete[] sigs;
+        sigs = nullptr;
+        n = 0;
+        ready = false;
+    }
+
+    const MovieSignature& at(int i) const { return sigs[i]; }
+    int size() const { return n; }
+
+    void account(MemoryReport& r) const {
+        if (!ready) return;
+        int p = r.part("Similarity signatures", "movies");
+        r.add(p, (long long)(n > 0 ? n : 1) * sizeof(MovieSignature));
+        r.count(p, n);
+    }
+
+    // Writes the indexes of the best k matches for q into out[] with their scores (best first, ties in title
+    // order) and returns how many there are. skip is left out (-1 for none); movies with nothing in common are
+    // not returned.
+    int top_k(const MovieSignature& q, bool genres_only, int k, int skip, int* out, float* score_out) const {
+        if (k <= 0 || n == 0) return 0;
+        if (k > n) k = n;
+        int workers = worker_count();
+        int* cand = new int[workers * k];
+        float* cand_score = new float[workers * k];
+        int* cand_count = new int[workers];
+        for (int w = 0; w < workers; w++) cand_count[w] = 0;
+
+        parallel_for(n, [&](int begin, int end, int w) {
+            int* best = cand + w * k;
+            float* best_score = cand_score + w * k;
+            int found = 0;
+            for (int i = begin; i < end; i++) {
+                float s = jaccard(sigs[i], q, genres_only);
+                if (s <= 0.0f || i == skip) continue;
+                if (found == k && s <= best_score[k - 1]) continue;
+                int pos = (found < k) ? found++ : k - 1;
+                while (pos > 0 && best_score[pos - 1] < s) {
+                    best[pos] = best[pos - 1];
+                    best_score[pos] = best_score[pos - 1];
+                    pos--;
+                }
+                best[pos] = i;
+                best_score[pos] = s;
+            }
+            cand_count[w] = found;
+        });
+
+        // Slices are in title order, so sorting the candidates by index keeps ties in title order
+        my_array<long long> merged;
+        for (int w = 0; w < workers; w++) {
+            for (int j = 0; j < cand_count[w]; j++) merged.push((long long)cand[w * k + j] << 32 | (w * k + j));
+        }
+        merged.sort_unique();
+        float* score = new float[merged.size() > 0 ? merged.size() : 1];
+        for (int j = 0; j < merged.size(); j++) score[j] = cand_score[merged[j] & 0xffffffff];
+        int* pick = new int[k];
+        int found = top_k_scores(score, merged.size(), k, pick);
+        for (int j = 0; j < found; j++) {
+            out[j] = (int)(merged[pick[j]] >> 32);
+            score_out[j] = score[pick[j]];
+        }
+        delete[] pick;
+        delete[] score;
+        delete[] cand;
+        delete[] cand_score;
+        delete[] cand_count;
+        return found;
+    }
+};
+
+// Title Order
+// Positions of one version's movies in title order: uid_at[pos], and pos_of[uid] (-1 for uids without a movie).
+// Analytics, similarity search and compound queries work on dense arrays in this order, which also puts their
+// ties and results in title order. Built by the first reader that needs it; a version whose write changed no
+// titles or links (a rating edit) takes it over from the previous version.
+struct TitleOrder {
+    int refs;
+    int n;
+    int bound;
+    int* uid_at;
+    int* pos_of;
+
+    TitleOrder(const TitleTree& titles, int count, int uid_bound) : refs(1), n(count), bound(uid_bound) {
+        uid_at = new int[n > 0 ? n : 1];
+        pos_of = new int[bound > 0 ? bound : 1];
+        for (int u = 0; u < bound; u++) pos_of[u] = -1;
+        TitleTree::Cursor c(titles);
+        for (int pos = 0; const TitleNode* t = c.next(); pos++) {
+            uid_at[pos] = t->uid;
+            pos_of[t->uid] = pos;
+        }
+    }
+    ~TitleOrder() {
+        delete[] uid_at;
+        delete[] pos_of;
+    }
+    TitleOrder(const TitleOrder&) = delete;
+    TitleOrder& operator=(const TitleOrder&) = delete;
+
+    static void release(TitleOrder* o) {
+        if (o && --o->refs == 0) delete o;
+    }
+
+    void account(MemoryReport& r) const {
+        r.add(r.part("Title order"), (long long)((n > 0 ? n : 1) + (bound > 0 ? bound : 1)) * sizeof(int), 2);
+    }
+};
+
+// Graph Analytics
+// Components, degree distribution and PageRank of one version's graph, with the movies in title order.
+// The links are first copied into compact arrays (CSR layout: the neighbors of position v are
+// adj[offsets[v]] .. adj[offsets[v + 1] - 1]), which the worker threads can scan at once; the copy is dropped
+// once the results are in. Shared like TitleOrder by versions whose write left the links alone.
+class GraphAnalytics {
+public:
+    static const int hist_bins = 12; // bin 0: degree 0, bin b: degree in [2^(b-1), 2^b), last bin open-ended
+
+    int refs;
+    int n;
+    long long edge_count; // Directed entries (every link is stored in both directions)
+    int* comp;            // Component label per position
+    int* comp_size;       // Number of movies per component label
+    int comp_count;
+    int largest_comp;
+    float* rank;          // PageRank score per position
+    int max_degree;
+    int degree_hist[hist_bins];
+
+private:
+    int* offsets;
+    int* adj;
+
+    int degree(int v) const { return offsets[v + 1] - offsets[v]; }
+    IdCursor edges(int v) const { return IdCursor(adj + offsets[v], adj + offsets[v + 1]); }
+
+    static int uf_find(int* uf, int v) {
+        while (uf[v] != v) {
+            uf[v] = uf[uf[v]]; // Path halving
+            v = uf[v];
+        }
+        return v;
+    }
+
+    // Union-find over all links, then relabels roots to 0..comp_count-1
+    void find_components() {
+        int* uf = new int[n > 0 ? n : 1];
+        for (int v = 0; v < n; v++) uf[v] = v;
+        for (int v = 0; v < n; v++) {
+            IdCursor e = edges(v);
+            int w;
+            while (e.next(w)) {
+                int a = uf_find(uf, v);
+                int b = uf_find(uf, w);
+                if (a != b) uf[(a < b) ? b : a] = (a < b) ? a : b;
+            }
+        }
+        comp = new int[n > 0 ? n : 1];
+        comp_size = new int[n > 0 ? n : 1];
+        comp_count = 0;
+        int* label = new int[n > 0 ? n : 1];
+        for (int v = 0; v < n; v++) label[v] = -1;
+        for (int v = 0; v < n; v++) {
+            int r = uf_find(uf, v);
+            if (label[r] == -1) {
+                label[r] = comp_count;
+                comp_size[comp_count++] = 0;
+            }
+            comp[v] = label[r];
+            comp_size[comp[v]]++;
+        }
+        largest_comp = -1;
+        for (int c = 0; c < comp_count; c++) {
+            if (largest_comp == -1 || comp_size[c] > comp_size[largest_comp]) largest_comp = c;
+        }
+        delete[] label;
+        delete[] uf;
+    }
+
+    // Each worker fills its own histogram row, rows are summed afterwards
+    void degree_stats() {
+        int workers = worker_count();
+        int* local_hist = new int[workers * hist_bins];
+        int* local_max = new int[workers];
+        for (int i = 0; i < workers * hist_bins; i++) local_hist[i] = 0;
+        for (int w = 0; w < workers; w++) local_max[w] = 0;
+
+        parallel_for(n, [this, local_hist, local_max](int begin, int end, int w) {
+            int* hist = local_hist + w * hist_bins;
+            for (int v = begin; v < end; v++) {
+                int d = degree(v);
+                hist[degree_bin(d)]++;
+                if (d > local_max[w]) local_max[w] = d;
+            }
+        });
+
+        max_degree = 0;
+        for (int b = 0; b < hist_bins; b++) degree_hist[b] = 0;
+        for (int w = 0; w < workers; w++) {
+            for (int b = 0; b < hist_bins; b++) degree_hist[b] += local_hist[w * hist_bins + b];
+            max_degree = get_max(max_degree, local_max[w]);
+        }
+        delete[] local_hist;
+        delete[] local_max;
+    }
+
+    // Pull-based power iteration: every vertex only writes its own score, so chunks need no locking.
+    // Mass of movies without links is spread evenly over the whole graph.
+    void page_rank(int iterations, float damping) {
+        rank = new float[n > 0 ? n : 1];
+        float* next = new float[n > 0 ? n : 1];
+        for (int v = 0; v < n; v++) rank[v] = 1.0f / n;
+
+        for (int it = 0; it < iterations; it++) {
+            float dangling = 0.0f;
+            for (int v = 0; v < n; v++) {
+                if (degree(v) == 0) dangling += rank[v];
+            }
+            float base = (1.0f - damping) / n + damping * dangling / n;
+            float* cur = rank;
+            parallel_for(n, [this, cur, next, base, damping](int begin, int end, int) {
+                for (int v = begin; v < end; v++) {
+                    float sum = 0.0f;
+                    IdCursor e = edges(v);
+                    int u;
+                    while (e.next(u)) sum += cur[u] / degree(u);
+                    next[v] = base + damping * sum;
+                }
+            });
+            rank = next;
+            next = cur;
+        }
+        delete[] next;
+    }
+
+public:
+    GraphAnalytics(const MovieTable& g, const TitleOrder& order)
+        : refs(1), n(order.n), edge_count(g.edge_count), comp(nullptr), comp_size(nullptr), comp_count(0),
+          largest_comp(-1), rank(nullptr), max_degree(0) {
+        offsets = new int[n + 1];
+        offsets[0] = 0;
+        for (int v = 0; v < n; v++) offsets[v + 1] = offsets[v] + g.degree(order.uid_at[v]);
+        adj = new int[offsets[n] > 0 ? offsets[n] : 1];
+        parallel_for(n, [this, &g, &order](int begin, int end, int) {
+            for (int v = begin; v < end; v++) {
+                ListCursor e = g.edges(order.uid_at[v]);
+                int pos = offsets[v], uid;
+                while (e.next(uid)) adj[pos++] = order.pos_of[uid];
+            }
+        });
+        find_components();
+        degree_stats();
+        page_rank(20, 0.85f);
+        delete[] offsets;
+        delete[] adj;
+        offsets = adj = nullptr;
+    }
+    ~GraphAnalytics() {
+        delete[] comp;
+        delete[] comp_size;
+        delete[] rank;
+    }
+    GraphAnalytics(const GraphAnalytics&) = delete;
+    GraphAnalytics& operator=(const GraphAnalytics&) = delete;
+
+    static void release(GraphAnalytics* g) {
+        if (g && --g->refs == 0) delete g;
+    }
+
+    static int degree_bin(int d) {
+        int bin = 0;
+        while (d >> bin && bin < hist_bins - 1) bin++;
+        return bin;
+    }
+
+    // O(1) reachability check between two positions
+    bool connected(int a, int b) const { return comp[a] == comp[b]; }
+
+    void account(MemoryReport& r) const {
+        r.add(r.part("Graph analytics"), (long long)(n > 0 ? n : 1) * (2 * sizeof(int) + sizeof(float)), 3);
+    }
+};
+
+// Frontier BFS
+// Level-synchronous BFS over the links of a MovieTable (vertex ids are uids). Every level is expanded by the
+// worker threads in one of two ways:
+// - top-down:  frontier movies claim their unvisited neighbors with an atomic compare-and-swap on parent[]
+// - bottom-up: every unvisited movie looks for any neighbor in the frontier bitmap and stops at the first hit
+// Bottom-up is chosen while the frontier's links outnumber a fraction of the unexplored links (big middle
+// levels of a dense graph), top-down again once the frontier becomes small.
+// After every level each new movie takes the frontier movie that comes first in BFS order as its parent, and the
+// level is laid out in the order a sequential queue would reach it, so results do not depend on thread timing.
+// Visited movies are kept level by level, so callers can read results in BFS order.
+// Levels with only a few thousand links to walk run on the calling thread: handing them to the pool costs
+// more than walking them.
+class FrontierBFS {
+private:
+    static const int alpha = 14;          // Switch to bottom-up when frontier links > unexplored links / alpha
+    static const int beta = 24;           // Switch back to top-down when frontier size < n / beta
+    static const int serial_links = 4096; // Walks over fewer links stay on the calling thread
+
+    const MovieTable& g;
+    atomic<int>* parent_of;      // -1 = not visited, sources point to themselves
+    int* depth_of;
+    int* slot_of;                // Position in order (-1 = not placed yet)
+    unsigned long long* frontier_bits;
+    my_array<int> frontier;
+    my_array<int> next;
+    my_array<int>* local;        // One output buffer per worker
+    int workers;
+    my_array<int> order;         // Visited movies, level after level
+    my_array<int> level_start;   // order[level_start[d] .. level_start[d + 1]) is level d
+
+    long long frontier_links(const my_array<int>& list) const {
+        long long sum = 0;
+        for (int i = 0; i < list.size(); i++) sum += g.degree(list[i]);
+        return sum;
+    }
+
+    // Runs fn over [0, n) on the calling thread when the walk covers few links, else one chunk per worker
+    template <typename Fn>
+    void for_level(int n, long long links, Fn fn) {
+        if (links < serial_links) fn(0, n, 0);
+        else parallel_for(n, fn, 1);
+    }
+
+    void gather_next() {
+        next.clear();
+        for (int w = 0; w < workers; w++) {
+            for (int i = 0; i < local[w].size(); i++) next.push(local[w][i]);
+            local[w].clear();
+        }
+    }
+
+    void step_top_down(int d, long long links) {
+        for_level(frontier.size(), links, [this, d](int begin, int end, int w) {
+            my_array<int>& out = local[w];
+            for (int i = begin; i < end; i++) {
+                int u = frontier[i];
+                ListCursor e = g.edges(u);
+                int v;
+                while (e.next(v)) {
+                    int expected = -1;
+                    if (parent_of[v].load(memory_order_relaxed) == -1 &&
+                        parent_of[v].compare_exchange_strong(expected, u)) {
+                        depth_of[v] = d + 1;
+                        out.push(v);
+                    }
+                }
+            }
+        });
+        gather_next();
+    }
+
+    void step_bottom_up(int d) {
+        int words = (g.bound + 63) / 64;
+        for (int i = 0; i < words; i++) frontier_bits[i] = 0;
+        for (int i = 0; i < frontier.size(); i++) {
+            int u = frontier[i];
+            frontier_bits[u >> 6] |= 1ULL << (u & 63);
+        }
+        for_level(g.bound, g.bound + g.edge_count, [this, d](int begin, int end, int w) {
+            my_array<int>& out = local[w];
+            for (int v = begin; v < end; v++) {
+                if (parent_of[v].load(memory_order_relaxed) != -1) continue;
+                ListCursor e = g.edges(v);
+                int u;
+                while (e.next(u)) {
+                    if (frontier_bits[u >> 6] & (1ULL << (u & 63))) {
+                        parent_of[v].store(u, memory_order_relaxed);
+                        depth_of[v] = d + 1;
+                        out.push(v);
+                        break;
+                    }
+                }
+            }
+        });
+        gather_next();
+    }
+
+    // Makes level d + 1 (in next) independent of which worker claimed what:
+    // every movie's parent becomes its frontier neighbor placed first, then the frontier is walked in order and
+    // each movie is emitted at its first appearance in its parent's links (the order a queue would produce).
+    // Workers own contiguous frontier ranges and gather_next() keeps worker order, so the result is sequential.
+    // links / next_links: links of the frontier and of the new level.
+    void order_next(int d, long long links, long long next_links) {
+        for_level(next.size(), next_links, [this, d](int begin, int end, int) {
+            for (int i = begin; i < end; i++) {
+                int v = next[i], best = -1;
+                ListCursor e = g.edges(v);
+                int u;
+                while (e.next(u)) {
+                    if (depth_of[u] == d && (best == -1 || slot_of[u] < slot_of[best])) best = u;
+                }
+                parent_of[v].store(best, memory_order_relaxed);
+            }
+        });
+        for_level(frontier.size(), links, [this, d](int begin, int end, int w) {
+            my_array<int>& out = local[w];
+            for (int i = begin; i < end; i++) {
+                int u = frontier[i];
+                ListCursor e = g.edges(u);
+                int v;
+                while (e.next(v)) {
+                    // Only the worker owning v's parent touches v here
+                    if (depth_of[v] == d + 1 && parent_of[v].load(memory_order_relaxed) == u && slot_of[v] == -1) {
+                        slot_of[v] = 0;
+                        out.push(v);
+                    }
+                }
+            }
+        });
+        gather_next();
+    }
+
+public:
+    int target_hit; // Lowest-id target reached on the first level that contained one (-1 if none)
+
+    FrontierBFS(const MovieTable& table) : g(table), target_hit(-1) {
+        int n = (g.bound > 0) ? g.bound : 1;
+        parent_of = new atomic<int>[n];
+        depth_of = new int[n];
+        slot_of = new int[n];
+        frontier_bits = new unsigned long long[(n + 63) / 64];
+        workers = worker_count();
+        local = new my_array<int>[workers];
+    }
+
+    ~FrontierBFS() {
+        delete[] parent_of;
+        delete[] depth_of;
+        delete[] slot_of;
+        delete[] frontier_bits;
+        delete[] local;
+    }
+
+    // Runs the search from all sources at once.
+    // is_target (optional): stop after the first level that reaches a target.
+    // stop_count (optional): stop after the first level that brings the visited count to stop_count.
+    void run(const int* sources, int source_count, const bool* is_target = nullptr, int stop_count = -1) {
+        parallel_for(g.bound, [this](int begin, int end, int) {
+            for (int v = begin; v < end; v++) {
+                parent_of[v].store(-1, memory_order_relaxed);
+                depth_of[v] = -1;
+                slot_of[v] = -1;
+            }
+        }, serial_links * 16); // Three stores per movie: only large graphs are worth splitting
+        frontier.clear();
+        order.clear();
+        level_start.clear();
+        target_hit = -1;
+
+        for (int i = 0; i < source_count; i++) {
+            int s = sources[i];
+            if (s < 0 || s >= g.bound || parent_of[s].load() != -1) continue;
+            parent_of[s].store(s);
+            depth_of[s] = 0;
+            frontier.push(s);
+        }
+
+        long long unexplored = g.edge_count - frontier_links(frontier);
+        bool bottom_up = false;
+        int d = 0;
+        level_start.push(0);
+        while (frontier.size() > 0) {
+            for (int i = 0; i < frontier.size(); i++) {
+                slot_of[frontier[i]] = order.size();
+                order.push(frontier[i]);
+                if (is_target && is_target[frontier[i]] && (target_hit == -1 || frontier[i] < target_hit)) {
+                    target_hit = frontier[i];
+                }
+            }
+            level_start.push(order.size());
+            if (target_hit != -1) break;
+            if (stop_count >= 0 && order.size() >= stop_count) break;
+
+            long long links = frontier_links(frontier);
+            if (!bottom_up && links > unexplored / alpha) bottom_up = true;
+            else if (bottom_up && frontier.size() < g.bound / beta) bottom_up = false;
+
+            if (bottom_up) step_bottom_up(d);
+            else step_top_down(d, links);
+            long long next_links = frontier_links(next);
+            order_next(d, links, next_links);
+
+            unexplored -= next_links;
+            frontier.swap(next);
+            d++;
+        }
+    }
+
+    int parent(int v) const { return parent_of[v].load(memory_order_relaxed); }
+    int depth(int v) const { return depth_of[v]; }
+    int level_count() const { return level_start.size() - 1; }
+    int level_begin(int d) const { return level_start[d]; }
+    int level_end(int d) const { return level_start[d + 1]; }
+    int visited_at(int i) const { return order[i]; }
+    int visited_count() const { return order.size(); }
+};
+
+// Range Index
+// Movie ids ordered by one numeric field (year or rating), so that the movies in a range are counted and
+// listed with two binary searches. Built on first use and kept until clear(), like SimilarityIndex.
+class RangeIndex {
+private:
+    struct Entry {
+        float value;
+        int id;
+        bool operator<(const Entry& o) const { return value < o.value || (value == o.value && id < o.id); }
+    };
+    Entry* entries;
+    int n;
+    atomic<bool> ready;
+    mutex build_lock;
+
+    // First position with a value above v, or at least v if inclusive
+    int bound(float v, bool inclusive) const {
+        int lo = 0, hi = n;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (entries[mid].value < v || (!inclusive && entries[mid].value == v)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+public:
+    RangeIndex() : entries(nullptr), n(0), ready(false) {}
+    ~RangeIndex() { delete[] entries; }
+
+    // fill(i, value, id) gives entry i of count; the first caller builds, later callers reuse
+    template <typename Fn>
+    void build(int count, Fn fill) {
+        if (ready) return;
+        lock_guard<mutex> guard(build_lock);
+        if (ready) return;
+        entries = new Entry[count > 0 ? count : 1];
+        n = count;
+        for (int i = 0; i < n; i++) fill(i, entries[i].value, entries[i].id);
+        heap_sort(entries, n);
+        ready = true;
+    }
+
+    bool built() const { return ready; }
+
+    void account(MemoryReport& r) const {
+        if (!ready) return;
+        int p = r.part("Range indexes", "entries");
+        r.add(p, (long long)(n > 0 ? n : 1) * sizeof(Entry));
+        r.count(p, n);
+    }
+
+    // Forgets the entries (the caller makes sure no query is running)
+    void clear() {
+        delete[] entries;
+        entries = nullptr;
+        n = 0;
+        ready = false;
+    }
+
+    // Range positions [begin, end) of the values between low and high (open ends exclude the bound itself)
+    void span(float low, bool low_open, float high, bool high_open, int& begin, int& end) const {
+        begin = bound(low, !low_open);
+        end = bound(high, high_open);
+        if (end < begin) end = begin;
+    }
+
+    // Ids of the movies in the range, in ascending order
+    void collect(int begin, int end, my_array<int>& out) const {
+        out.clear();
+        for (int i = begin; i < end; i++) out.push(entries[i].id);
+        out.sort_unique();
+    }
+};
+
+// Compound Queries
+// The text of a QUERY is an OR of AND groups, e.g. "Tom Hanks AND Drama AND year=1990-2000 AND rating>=7.5".
+// A term is a year or rating condition (=, >=, <=, >, <, or = with a lo-hi range), or else the name of an actor,
+// director or genre, matched like the entity search ("genre:Drama" limits it to one type). AND and OR are
+// written in capitals; AND binds tighter.
+const int max_query_terms = 16;
+
+enum TermKind { TERM_ENTITY, TERM_YEAR, TERM_RATING };
+
+struct QueryTerm {
+    TermKind kind;
+    string text;     // As written
+    string key;      // Search key of an entity term
+    int types;       // Entity types the key is searched in (see entity_types_of)
+    float low, high; // Range of a year or rating term
+    bool low_open, high_open;
+    int group;
+    int estimate;    // Movies matching this term alone (set by the planner)
+
+    QueryTerm() : kind(TERM_ENTITY), types(any_entity), low(-FLT_MAX), high(FLT_MAX), low_open(false), high_open(false), group(0),
+                  estimate(0) {}
+
+    bool accepts(float v) const {
+        return (low_open ? v > low : v >= low) && (high_open ? v < high : v <= high);
+    }
+};
+
+struct CompoundQuery {
+    QueryTerm terms[max_query_terms];
+    int count;
+    int groups;
+
+    CompoundQuery() : count(0), groups(0) {}
+};
+
+// Whole-string number (no sign or spaces around it)
+bool query_number(const string& s, float& v) {
+    if (s == "" || !((s[0] >= '0' && s[0] <= '9') || s[0] == '.')) return false;
+    from_chars_result r = from_chars(s.data(), s.data() + s.size(), v, chars_format::fixed);
+    return r.ec == errc() && r.ptr == s.data() + s.size();
+}
+
+// Fills one term from its text; false with error set if a year / rating condition is malformed
+bool parse_query_term(const string& text, QueryTerm& t, string& error) {
+    t.text = text;
+    string lower = text;
+    for (size_t i = 0; i < lower.size(); i++) {
+        if (lower[i] >= 'A' && lower[i] <= 'Z') lower[i] = lower[i] - 'A' + 'a';
+    }
+    size_t field = (lower.compare(0, 4, "year") == 0) ? 4 : (lower.compare(0, 6, "rating") == 0) ? 6 : 0;
+    size_t op = field;
+    while (op < lower.size() && lower[op] == ' ') op++;
+    if (field == 0 || op == lower.size() || (lower[op] != '=' && lower[op] != '<' && lower[op] != '>')) {
+        string name;
+        t.kind = TERM_ENTITY;
+        t.types = entity_types_of(text, any_entity, name);
+        t.key = format_key(name);
+        if (t.key == "") {
+            error = "empty name in '" + text + "'";
+            return false;
+        }
+        return true;
+    }
+
+    t.kind = (field == 4) ? TERM_YEAR : TERM_RATING;
+    char sign = lower[op];
+    bool or_equal = (sign == '=') || (op + 1 < lower.size() && lower[op + 1] == '=');
+    size_t at = op + ((sign != '=' && or_equal) ? 2 : 1);
+    string value = lower.substr(at);
+    while (value != "" && value[0] == ' ') value.erase(0, 1);
+    while (value != "" && value[value.size() - 1] == ' ') value.erase(value.size() - 1);
+
+    bool ok = true;
+    size_t dash = value.find('-');
+    if (sign == '=' && dash != string::npos) {
+        string lo = value.substr(0, dash), hi = value.substr(dash + 1);
+        while (lo != "" && lo[lo.size() - 1] == ' ') lo.erase(lo.size() - 1);
+        while (hi != "" && hi[0] == ' ') hi.erase(0, 1);
+        ok = query_number(lo, t.low) && query_number(hi, t.high);
+    } else {
+        float v = 0.0f;
+        ok = query_number(value, v);
+        if (sign != '<') {
+            t.low = v;
+            t.low_open = !or_equal;
+        }
+        if (sign != '>') {
+            t.high = v;
+            t.high_open = !or_equal;
+        }
+    }
+    if (!ok) error = "bad number in '" + text + "'";
+    return ok;
+}
+
+// Splits the query text into terms at the AND / OR words; false with error set if it is malformed
+bool parse_compound(const string& text, CompoundQuery& q, string& error) {
+    q.count = 0;
+    q.groups = 1;
+    string term = "";
+    bool ended = false;
+    stringstream ss(text);
+    string word;
+    while (true) {
+        ended = !(ss >> word);
+        bool joiner = !ended && (word == "AND" || word == "OR");
+        if (!ended && !joiner) {
+            term += (term == "") ? word : " " + word;
+            continue;
+        }
+        if (term == "") {
+            error = ended ? "empty query" : "missing term before " + word;
+            return false;
+        }
+        if (q.count == max_query_terms) {
+            error = "too many terms";
+            return false;
+        }
+        QueryTerm& t = q.terms[q.count++];
+        if (!parse_query_term(term, t, error)) return false;
+        t.group = q.groups - 1;
+        term = "";
+        if (ended) return true;
+        if (word == "OR") q.groups++;
+    }
+}
+
+// Query Source
+// What the planner needs from an engine. Ids are the engine's own; results come out in ascending id order.
+class QuerySource {
+public:
+    virtual ~QuerySource() {}
+    // Number of movies under an entity search key in the given types (an upper bound if several)
+    virtual int posting_count(int types, const string& key) = 0;
+    // Movies under an entity search key in the given types, in ascending id order
+    virtual void posting_ids(int types, const string& key, my_array<int>& out) = 0;
+    virtual const RangeIndex& range(TermKind kind) = 0;
+    // True if the movie's record satisfies every given term
+    virtual bool passes(int id, QueryTerm* const* terms, int count) = 0;
+    // Cost of checking one record, in posting entries: a posting longer than candidates * check_cost()
+    // is cheaper to apply as a record filter than to read and intersect
+    virtual int check_cost() const = 0;
+};
+
+// Query Cursor
+// Movies matched by a compound query, in ascending id order, read one at a time
+class QueryCursor {
+private:
+    my_array<int> ids;
+    int pos;
+
+public:
+    QueryCursor() : pos(0) {}
+
+    my_array<int>& items() { return ids; }
+    int size() const { return ids.size(); }
+    void rewind() { pos = 0; }
+
+    bool next(int& id) {
+        if (pos == ids.size()) return false;
+        id = ids[pos++];
+        return true;
+    }
+};
+
+// Keeps the ids of cand that are also in other (both ascending)
+void intersect_sorted(my_array<int>& cand, const my_array<int>& other) {
+    int kept = 0, j = 0;
+    for (int i = 0; i < cand.size(); i++) {
+        while (j < other.size() && other[j] < cand[i]) j++;
+        if (j < other.size() && other[j] == cand[i]) cand[kept++] = cand[i];
+    }
+    while (cand.size() > kept) cand.pop();
+}
+
+void describe_term(const QueryTerm& t, ostream& out) {
+    if (t.kind == TERM_ENTITY) out << "'" << t.text << "'";
+    else out << t.text;
+    out << " (" << t.estimate << " movies)";
+}
+
+// Plans and runs one AND group into cand. The term with the fewest movies drives: its posting or range is read
+// in id order. Postings short enough to be worth it are intersected with the candidates, the remaining terms
+// are checked on the candidates' records. explain (if set) gets one line per step.
+void run_group(QueryTerm** terms, int count, QuerySource& src, my_array<int>& cand, ostream* explain) {
+    for (int i = 0; i < count; i++) {
+        QueryTerm& t = *terms[i];
+        if (t.kind == TERM_ENTITY) t.estimate = src.posting_count(t.types, t.key);
+        else {
+            int begin = 0, end = 0;
+            src.range(t.kind).span(t.low, t.low_open, t.high, t.high_open, begin, end);
+            t.estimate = end - begin;
+        }
+    }
+    for (int i = 1; i < count; i++) { // Fewest movies first, ties in written order
+        QueryTerm* t = terms[i];
+        int j = i;
+        while (j > 0 && terms[j - 1]->estimate > t->estimate) {
+            terms[j] = terms[j - 1];
+            j--;
+        }
+        terms[j] = t;
+    }
+
+    QueryTerm& drive = *terms[0];
+    if (drive.kind == TERM_ENTITY) src.posting_ids(drive.types, drive.key, cand);
+    else {
+        int begin = 0, end = 0;
+        src.range(drive.kind).span(drive.low, drive.low_open, drive.high, drive.high_open, begin, end);
+        src.range(drive.kind).collect(begin, end, cand);
+    }
+    if (explain) {
+        *explain << "  drive by ";
+        describe_term(drive, *explain);
+        *explain << " -> " << cand.size() << endl;
+    }
+
+    QueryTerm* filters[max_query_terms];
+    int filter_count = 0;
+    for (int i = 1; i < count; i++) {
+        QueryTerm& t = *terms[i];
+        if (t.kind == TERM_ENTITY && t.estimate <= (long long)cand.size() * src.check_cost()) {
+            my_array<int> other;
+            src.posting_ids(t.types, t.key, other);
+            intersect_sorted(cand, other);
+            if (explain) {
+                *explain << "  intersect ";
+                describe_term(t, *explain);
+                *explain << " -> " << cand.size() << endl;
+            }
+        } else filters[filter_count++] = &t;
+    }
+    if (filter_count == 0) return;
+
+    int kept = 0;
+    for (int i = 0; i < cand.size(); i++) {
+        if (src.passes(cand[i], filters, filter_count)) cand[kept++] = cand[i];
+    }
+    while (cand.size() > kept) cand.pop();
+    if (explain) {
+        *explain << "  filter records by ";
+        for (int i = 0; i < filter_count; i++) {
+            if (i > 0) *explain << ", ";
+            describe_term(*filters[i], *explain);
+        }
+        *explain << " -> " << cand.size() << endl;
+    }
+}
+
+// Runs every group of the query and merges their results into the cursor
+void run_compound(CompoundQuery& q, QuerySource& src, QueryCursor& result, ostream* explain) {
+    my_array<int>& all = result.items();
+    all.clear();
+    for (int g = 0; g < q.groups; g++) {
+        QueryTerm* terms[max_query_terms];
+        int count = 0;
+        for (int i = 0; i < q.count; i++) {
+            if (q.terms[i].group == g) terms[count++] = &q.terms[i];
+        }
+        if (explain) *explain << "Group " << g + 1 << ":\n";
+        my_array<int> cand;
+        run_group(terms, count, src, cand, explain);
+        for (int i = 0; i < cand.size(); i++) all.push(cand[i]);
+    }
+    if (q.groups > 1) all.sort_unique();
+    if (explain) *explain << "Matches: " << all.size() << endl;
+    result.rewind();
+}
+
+// Catalog Version
+// Immutable view of the whole catalog: the title tree, the movie table with the graph links, and the entity
+// postings. Readers only ever see complete versions; the writer builds the next one from the current one and
+// publishes it (see CatalogWriter, VersionStore). Versions share every node a write did not touch.
+// Movies are addressed by uid. The parts built on first use are the title order and graph analytics, guarded
+// by derive_lock, the similarity signatures and the year / rating indexes.
+class CatalogVersion {
+public:
+    long long number;
+    bool compact; // Id lists packed, search keys left out of the records
+    TitleTree titles;
+    MovieTable movies;
+    EntityPostings postings[entity_type_count];
+    mutex derive_lock;
+    atomic<TitleOrder*> order;
+    atomic<GraphAnalytics*> analytics;
+    SimilarityIndex similar;
+    RangeIndex years, ratings;
+
+    // The first version (empty)
+    CatalogVersion(long long num, bool compact_mode) : number(num), compact(compact_mode), order(nullptr),
+                                                       analytics(nullptr) {
+        for (int t = 0; t < entity_type_count; t++) postings[t].init(t);
+    }
+
+    // The next version, starting out the same as prev
+    CatalogVersion(const CatalogVersion& prev, long long num) : number(num), compact(prev.compact), order(nullptr),
+                                                                 analytics(nullptr) {
+        titles.share(prev.titles);
+        movies.share(prev.movies);
+        for (int t = 0; t < entity_type_count; t++) postings[t].share(prev.postings[t]);
+    }
+
+    ~CatalogVersion() {
+        TitleOrder::release(order.load());
+        GraphAnalytics::release(analytics.load());
+    }
+
+    // Takes over the title order and analytics of prev (the write changed no titles or links)
+    void share_derived(CatalogVersion& prev) {
+        lock_guard<mutex> guard(prev.derive_lock);
+        order.store(retain(prev.order.load()));
+        analytics.store(retain(prev.analytics.load()));
+    }
+
+    int size() const { return movies.count; }
+    const MovieRecord* movie(int uid) const { return movies.record(uid); }
+    const string& title(int uid) const { return movie(uid)->title; }
+    void show_details(int uid, ostream& out) const { movie(uid)->show_details(title(uid), out); }
+
+    // Uid of the movie with the title, -1 if missing
+    int find_title(const string& title) const {
+        const TitleNode* n = titles.find(format_key(title));
+        return n ? n->uid : -1;
+    }
+
+    // Movies of an entity search text over the default types (see entity_search)
+    bool search(const string& text, int default_types, my_array<int>& out) const {
+        return entity_search(text, default_types, [this](int type, const string& k, my_array<int>& ids) {
+            ids.clear();
+            const PostingNode* p = postings[type].find(k);
+            if (!p) return false;
+            ListCursor c(p->movies);
+            int id;
+            while (c.next(id)) ids.push(id);
+            return true;
+        }, out);
+    }
+
+    // Movies in title order (first caller builds it)
+    const TitleOrder& title_order() {
+        TitleOrder* o = order.load();
+        if (o) return *o;
+        lock_guard<mutex> guard(derive_lock);
+        if (!order.load()) order.store(new TitleOrder(titles, movies.count, movies.bound));
+        return *order.load();
+    }
+
+    // Components, degrees and PageRank (first caller computes them)
+    const GraphAnalytics& analysed() {
+        const TitleOrder& o = title_order();
+        lock_guard<mutex> guard(derive_lock);
+        if (!analytics.load()) analytics.store(new GraphAnalytics(movies, o));
+        return *analytics.load();
+    }
+
+    // True if cached components show that the two movies are not connected
+    bool known_apart(int a, int b) const {
+        const GraphAnalytics* g = analytics.load();
+        if (!g) return false;
+        const TitleOrder* o = order.load();
+        return !g->connected(o->pos_of[a], o->pos_of[b]);
+    }
+
+    // Signatures of all movies by title position (first caller builds them)
+    const SimilarityIndex& similarity() {
+        const TitleOrder& o = title_order();
+        similar.build(o.n, [this, &o](int i, MovieSignature& sig) {
+            const MovieRecord* m = movie(o.uid_at[i]);
+            sig.w[0] = m->genre_mask;
+            for (int a = 0; a < m->actor_count; a++) sig.add_person(names.key(m->actors[a]));
+            if (m->director_name().length() > 1) sig.add_person(names.key(m->director));
+        });
+        return similar;
+    }
+
+    // Title positions ordered by year or rating (first caller builds them)
+    const RangeIndex& range(TermKind kind) {
+        const TitleOrder& o = title_order();
+        RangeIndex& r = (kind == TERM_YEAR) ? years : ratings;
+        r.build(o.n, [this, &o, kind](int i, float& value, int& id) {
+            const MovieRecord* m = movie(o.uid_at[i]);
+            value = (kind == TERM_YEAR) ? (float)m->year : m->rating;
+            id = i;
+        });
+        return r;
+    }
+
+    void show_stats(ostream& out) const {
+        out << "\n--- Entity Indexes ---\n";
+        for (int t = 0; t < entity_type_count; t++) postings[t].show_stats(out);
+    }
+
+    // Everything this version can reach, and whatever readers have built on it so far. Nodes shared with older
+    // versions still held by readers are counted here; nodes only older versions hold are not.
+    void account(MemoryReport& r) {
+        int recs = r.part("Movie records", "records");
+        int tree = r.part("Title tree", "movies");
+        int table = r.part("Movie table");
+        int links = r.part("Graph links", "links");
+        MemoryReport::Top most(5);
+        TitleTree::Cursor c(titles);
+        while (const TitleNode* t = c.next()) {
+            const MovieRecord* m = t->rec;
+            long long ids = (m->actor_count > 0 ? m->actor_count : 1) + (m->genre_count > 0 ? m->genre_count : 1);
+            r.add(recs, sizeof(MovieRecord) + ids * sizeof(int), 3);
+            r.add_string(recs, m->title);
+            r.add_string(recs, m->search_key);
+            r.add(tree, sizeof(TitleNode));
+            const IdList* l = movies.links(t->uid);
+            IdList::account(l, r, links);
+            r.count(links, IdList::size(l));
+            most.offer(IdList::size(l), m->title);
+        }
+        r.count(recs, movies.count);
+        r.count(tree, movies.count);
+        movies.slots.account(r, table);
+        for (int t = 0; t < entity_type_count; t++) {
+            MemoryReport::Top largest(5);
+            postings[t].account(r, largest);
+            r.note(string("Largest ") + entity_policy[t].name + " buckets: " + largest.join());
+        }
+        {
+            lock_guard<mutex> guard(derive_lock);
+            if (order.load()) order.load()->account(r);
+            if (analytics.load()) analytics.load()->account(r);
+        }
+        similar.account(r);
+        years.account(r);
+        ratings.account(r);
+        r.note("Most linked movies: " + most.join());
+    }
+};
+
+// Version Store
+// Hands the current CatalogVersion to readers without locks, using epoch-based reclamation:
+// - a reader takes a slot, writes the global epoch into it, then loads the current version
+// - the writer swaps in the next version and retires the old one, tagged with the epoch of the swap
+// - a retired version is deleted once every busy slot shows a later epoch than its tag
+// Only one writer may publish at a time (MovieEngine serializes writers).
+class VersionStore {
+private:
+    static const int max_readers = 256;
+    struct Retired {
+        CatalogVersion* version;
+        unsigned long long epoch;
+    };
+
+    atomic<CatalogVersion*> current;
+    atomic<unsigned long long> epoch;
+    atomic<bool> slot_taken[max_readers];
+    atomic<unsigned long long> slot_epoch[max_readers];
+    my_array<Retired> retired;
+
+    void reclaim() {
+        unsigned long long oldest = 0; // 0 = no reader
+        for (int i = 0; i < max_readers; i++) {
+            unsigned long long e = slot_epoch[i].load();
+            if (e != 0 && (oldest == 0 || e < oldest)) oldest = e;
+        }
+        my_array<Retired> keep;
+        for (int i = 0; i < retired.size(); i++) {
+            if (oldest == 0 || retired[i].epoch < oldest) delete retired[i].version;
+            else keep.push(retired[i]);
+        }
+        retired.swap(keep);
+    }
+
+public:
+    VersionStore() : current(nullptr), epoch(1) {
+        for (int i = 0; i < max_readers; i++) {
+            slot_taken[i].store(false);
+            slot_epoch[i].store(0);
+        }
+    }
+
+    ~VersionStore() {
+        delete current.load();
+        for (int i = 0; i < retired.size(); i++) delete retired[i].version;
+    }
+
+    // Reader side: returns the slot to pass to unpin()
+    int pin() {
+        while (true) {
+            for (int i = 0; i < max_readers; i++) {
+                bool expected = false;
+                if (!slot_taken[i].load(memory_order_relaxed) && slot_taken[i].compare_exchange_strong(expected, true)) {
+                    slot_epoch[i].store(epoch.load());
+                    return i;
+                }
+            }
+            this_thread::yield(); // All slots busy
+        }
+    }
+
+    CatalogVersion* get() const { return current.load(); }
+
+    void unpin(int slot) {
+        slot_epoch[slot].store(0);
+        slot_taken[slot].store(false);
+    }
+
+    // Writer side
+    void publish(CatalogVersion* next) {
+        CatalogVersion* old = current.exchange(next);
+        if (old) {
+            Retired r;
+            r.version = old;
+            r.epoch = epoch.fetch_add(1);
+            retired.push(r);
+        }
+        reclaim();
+    }
+};
+
+// Keeps one catalog version alive for the lifetime of a read
+class ReadGuard {
+private:
+    VersionStore& store;
+    int slot;
+    CatalogVersion* version;
+
+public:
+    ReadGuard(VersionStore& s) : store(s) {
+        slot = store.pin();
+        version = store.get();
+    }
+    ~ReadGuard() { store.unpin(slot); }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    CatalogVersion& operator*() const { return *version; }
+    CatalogVersion* operator->() const { return version; }
+};
+
+// Requests
+// One operation of the movie manager. Built by the menu or parsed from a server request line.
+enum RequestType {
+    REQ_LIST_ALL, REQ_TITLE, REQ_ENTITY, REQ_YEAR, REQ_RATING, REQ_BFS, REQ_DFS, REQ_PATH,
+    REQ_CONNECT, REQ_SET_RATING, REQ_DELETE, REQ_COACTORS, REQ_ANALYTICS, REQ_ADD, REQ_CACHE_STATS,
+    REQ_INGEST, REQ_SIMILAR, REQ_PROFILE, REQ_QUERY, REQ_EXPLAIN, REQ_MEMORY, REQ_BATCH
+};
+
+const int request_type_count = REQ_BATCH + 1;
+
+// Server verb of each request type, for reports
+const char* const request_names[request_type_count] = {
+    "LIST", "TITLE", "SEARCH", "YEAR", "RATING", "BFS", "DFS", "PATH",
+    "CONNECT", "SETRATING", "DELETE", "COACTORS", "ANALYTICS", "ADD", "CACHESTATS",
+    "INGEST", "SIMILAR", "PROFILE", "QUERY", "EXPLAIN", "MEMORY", "BATCH"
+};
+
+struct Request {
+    RequestType type;
+    string text;   // Title / person / key (first operand), the genre list of REQ_PROFILE or a compound query
+    string text2;  // Second title or person for path queries
+    int number;    // Year or number of recommendations / results
+    float low;     // Minimum rating, or the new rating for REQ_SET_RATING
+    float high;    // Maximum rating
+    int offset;    // First row of a listing to show (see ResultPage)
+    int limit;     // Rows of a listing to show, -1 for all
+    Request(RequestType t = REQ_LIST_ALL) : type(t), number(0), low(0.0f), high(0.0f), offset(0), limit(-1) {}
+};
+
+// Result Page
+// The rows [offset, offset + limit) of a listing: titles, years, ratings, search and query results, co-actors
+// and the movies of a path. Printers call take() before each row and stop as soon as full(), so a page near the
+// start of a long listing does not walk the rest of it. footer() then tells which rows were shown.
+class ResultPage {
+private:
+    int offset, limit;
+    int seen; // Rows offered so far
+
+public:
+    ResultPage(const Request& req) : offset(req.offset), limit(req.limit), seen(0) {}
+
+    bool paged() const { return offset > 0 || limit >= 0; }
+
+    // Whether the next row belongs to the page
+    bool take() {
+        int row = seen++;
+        return row >= offset && (limit < 0 || row < offset + limit);
+    }
+
+    // True once a row after the page was offered: the remaining rows can be skipped
+    bool full() const { return limit >= 0 && seen > offset + limit; }
+
+    // Rows a producer has to offer before full() can hold (-1 for all of them)
+    int needed() const { return (limit < 0) ? -1 : offset + limit + 1; }
+
+    // Rows offered; the listing's total unless full()
+    int rows() const { return seen; }
+
+    void footer(ostream& out) const {
+        if (!paged() || seen == 0) return;
+        if (offset >= seen) out << "(no rows after row " << seen << ")\n";
+        else if (full()) out << "(rows " << offset + 1 << "-" << offset + limit << ", more follow)\n";
+        else out << "(rows " << offset + 1 << "-" << seen << " of " << seen << ")\n";
+    }
+};
+
+// Prints the movies of a path that are on the page as "[A] -> [B] -> ..."; path[] runs from the target back
+template <typename TitleFn>
+void print_steps(const my_array<int>& path, TitleFn title_of, ResultPage& page, ostream& out) {
+    bool first = true;
+    for (int i = path.size() - 1; i >= 0 && !page.full(); i--) {
+        if (!page.take()) continue;
+        if (!first) out << " -> ";
+        out << "[" << title_of(path[i]) << "]";
+        first = false;
+    }
+}
+
+// Output Sink
+// Stream buffer that collects an answer in 64 KB blocks and passes each block to the target buffer in one call,
+// so a listing of many rows is a few large writes instead of one per row. The menu prints every answer through
+// one sink and flushes it once the answer is complete.
+class OutputSink : public streambuf {
+private:
+    static const int block = 1 << 16;
+    char buf[block];
+    streambuf* target;
+
+    bool drain() {
+        streamsize n = pptr() - pbase();
+        setp(buf, buf + block);
+        return n == 0 || target->sputn(buf, n) == n;
+    }
+
+protected:
+    int_type overflow(int_type c) {
+        if (!drain()) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) sputc(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+
+    // Writes of a block or more go straight to the target
+    streamsize xsputn(const char* s, streamsize n) {
+        if (n < block) return streambuf::xsputn(s, n);
+        return drain() ? target->sputn(s, n) : 0;
+    }
+
+    int sync() { return (drain() && target->pubsync() == 0) ? 0 : -1; }
+
+public:
+    OutputSink(streambuf* to) : target(to) { setp(buf, buf + block); }
+    ~OutputSink() { sync(); }
+};
+
+// Query Dependencies
+// What a cacheable answer was computed from, filled in while the answer is produced:
+// the movies a search visited (search key hashes) and whether it used whole-graph data
+// (PageRank order or the component table), which any change of links can alter.
+struct QueryDeps {
+    my_array<unsigned long> movies;
+    bool global;
+
+    QueryDeps() : global(false) {}
+    void add(const MovieRecord* m) { movies.push(m->key_hash); }
+};
+
+// Version Diff
+// Differences between two consecutive catalog versions, collected by the writer while it makes the changes
+// (see CatalogWriter).
+// Used to drop exactly the cached answers whose inputs changed.
+struct RecordChange {
+    const MovieRecord* before; // nullptr if the movie was added
+    const MovieRecord* after;  // nullptr if the movie was removed
+    bool retitled;             // Same search key, different display title
+};
+
+struct VersionDiff {
+    my_array<unsigned long> relinked;    // Movies added, removed or with a different neighbor list
+    my_array<unsigned long> replaced;    // Movies added, removed or with a new record
+    my_array<unsigned long> reshaped;    // Same as replaced, minus rating-only edits
+    my_array<unsigned long> entity_keys; // Actor/director/genre keys of every replaced record
+    my_array<RecordChange> records;
+    bool any_relinked;
+
+    VersionDiff() : any_relinked(false) {}
+
+    static bool rating_only(const MovieRecord* a, const MovieRecord* b) {
+        if (a->director != b->director || a->year != b->year || a->duration != b->duration ||
+            a->actor_count != b->actor_count || a->genre_count != b->genre_count) {
+            return false;
+        }
+        for (int i = 0; i < a->actor_count; i++) if (a->actors[i] != b->actors[i]) return false;
+        for (int i = 0; i < a->genre_count; i++) if (a->genres[i] != b->genres[i]) return false;
+        return true;
+    }
+
+    void add_keys(const MovieRecord* m) {
+        for (int i = 0; i < m->actor_count; i++) entity_keys.push(str_hash(names.key(m->actors[i])));
+        for (int i = 0; i < m->genre_count; i++) entity_keys.push(str_hash(names.key(m->genres[i])));
+        entity_keys.push(str_hash(names.key(m->director)));
+    }
+
+    void changed(const MovieRecord* before, const MovieRecord* after, bool retitled) {
+        unsigned long h = before ? before->key_hash : after->key_hash;
+        replaced.push(h);
+        if (!before || !after || retitled || !rating_only(before, after)) reshaped.push(h);
+        if (before) add_keys(before);
+        if (after) add_keys(after);
+        RecordChange c;
+        c.before = before;
+        c.after = after;
+        c.retitled = retitled;
+        records.push(c);
+    }
+
+    void relink(const MovieRecord* m) { relinked.push(m->key_hash); }
+
+    // Sorts the lists for lookups; called once the write is done
+    void finish() {
+        any_relinked = relinked.size() > 0;
+        relinked.sort_unique();
+        replaced.sort_unique();
+        reshaped.sort_unique();
+        entity_keys.sort_unique();
+    }
+
+    bool empty() const { return records.size() == 0 && relinked.size() == 0; }
+};
+
+// Query Cache
+// Bounded LRU cache of rendered answers, keyed by the normalized request.
+// Every entry keeps what its answer depends on, and each published version is diffed against the previous one
+// to drop only the entries whose inputs changed:
+// - YEAR / RATING filters: a movie entering or leaving the filter, or a listed movie being replaced
+// - SEARCH / COACTORS / CONNECT: any movie with the searched key being added, removed or edited
+// - BFS / DFS / PATH / CONNECT: a visited movie gaining or losing links, or being edited
+//   (ratings only matter to BFS, which prints them)
+// - BFS (ordered by PageRank) and PATH answers that used the component table: any link change
+// Answers computed on a superseded version are not stored, so a slow read cannot put back a stale entry.
+class QueryCache {
+private:
+    struct Entry {
+        string key;
+        string answer;
+        RequestType type;
+        int year;
+        float low, high;
+        unsigned long entity1, entity2; // Searched key hashes (0 = none)
+        unsigned long* deps;            // Sorted visited-movie hashes
+        int dep_count;
+        bool global;
+        size_t bytes;
+        Entry* prev;  // LRU order, most recent first
+        Entry* next;
+        Entry* chain; // Hash bucket chain
+        ~Entry() { delete[] deps; }
+    };
+
+    Entry** buckets;
+    int bucket_cap;
+    int count;
+    Entry* head;
+    Entry* tail;
+    size_t used;
+    size_t budget;
+    long long valid_from; // Oldest version whose answers may still be stored
+    long long hits, misses, evictions, invalidations, rejected;
+    mutable mutex lock;
+
+    Entry** slot_of(const string& key) {
+        Entry** p = &buckets[str_hash(key) & (bucket_cap - 1)];
+        while (*p && (*p)->key != key) p = &(*p)->chain;
+        return p;
+    }
+
+    void unlink(Entry* e) {
+        if (e->prev) e->prev->next = e->next; else head = e->next;
+        if (e->next) e->next->prev = e->prev; else tail = e->prev;
+        e->prev = e->next = nullptr;
+    }
+
+    void push_front(Entry* e) {
+        e->prev = nullptr;
+        e->next = head;
+        if (head) head->prev = e;
+        head = e;
+        if (!tail) tail = e;
+    }
+
+    void erase(Entry* e) {
+        Entry** p = slot_of(e->key);
+        *p = e->chain;
+        unlink(e);
+        used -= e->bytes;
+        count--;
+        delete e;
+    }
+
+    void grow() {
+        int cap = bucket_cap * 2;
+        Entry** table = new Entry*[cap];
+        for (int i = 0; i < cap; i++) table[i] = nullptr;
+        for (int i = 0; i < bucket_cap; i++) {
+            Entry* e = buckets[i];
+            while (e) {
+                Entry* nxt = e->chain;
+                int b = str_hash(e->key) & (cap - 1);
+                e->chain = table[b];
+                table[b] = e;
+                e = nxt;
+            }
+        }
+        delete[] buckets;
+        buckets = table;
+        bucket_cap = cap;
+    }
+
+    static bool in_range(const MovieRecord* m, float low, float high) {
+        return m && m->rating >= low && m->rating <= high;
+    }
+
+    static bool deps_hit(const Entry* e, const my_array<unsigned long>& changed) {
+        // Probe the smaller side into the larger one
+        if (e->dep_count < changed.size()) {
+            for (int i = 0; i < e->dep_count; i++) {
+                if (sorted_contains(changed.data(), changed.size(), e->deps[i])) return true;
+            }
+        } else {
+            for (int i = 0; i < changed.size(); i++) {
+                if (sorted_contains(e->deps, e->dep_count, changed[i])) return true;
+            }
+        }
+        return false;
+    }
+
+    // Hash of the searched name as it appears in VersionDiff::entity_keys (type prefix dropped)
+    static unsigned long entity_hash(const string& text) {
+        string name;
+        entity_types_of(text, any_entity, name);
+        return str_hash(format_key(name));
+    }
+
+    static bool key_hit(unsigned long key, const VersionDiff& d) {
+        return key != 0 && sorted_contains(d.entity_keys.data(), d.entity_keys.size(), key);
+    }
+
+    static bool affected(const Entry* e, const VersionDiff& d) {
+        switch (e->type) {
+            case REQ_YEAR:
+            case REQ_RATING:
+                for (int i = 0; i < d.records.size(); i++) {
+                    const MovieRecord* a = d.records[i].before;
+                    const MovieRecord* b = d.records[i].after;
+                    bool relevant = !a || !b || d.records[i].retitled ||
+                                    (e->type == REQ_YEAR ? a->year != b->year : a->rating != b->rating);
+                    if (!relevant) continue;
+                    if (e->type == REQ_YEAR && ((a && a->year == e->year) || (b && b->year == e->year))) return true;
+                    if (e->type == REQ_RATING && (in_range(a, e->low, e->high) || in_range(b, e->low, e->high))) {
+                        return true;
+                    }
+                }
+                return false;
+            case REQ_ENTITY:
+            case REQ_COACTORS:
+                return key_hit(e->entity1, d);
+            case REQ_BFS:
+                return (e->global && d.any_relinked) || deps_hit(e, d.relinked) || deps_hit(e, d.replaced);
+            case REQ_DFS:
+            case REQ_PATH:
+            case REQ_CONNECT:
+                return (e->global && d.any_relinked) || deps_hit(e, d.relinked) || deps_hit(e, d.reshaped) ||
+                       key_hit(e->entity1, d) || key_hit(e->entity2, d);
+            default:
+                return true;
+        }
+    }
+
+public:
+    QueryCache(size_t budget_bytes) : bucket_cap(256), count(0), head(nullptr), tail(nullptr), used(0),
+                                      budget(budget_bytes), valid_from(0), hits(0), misses(0), evictions(0),
+                                      invalidations(0), rejected(0) {
+        buckets = new Entry*[bucket_cap];
+        for (int i = 0; i < bucket_cap; i++) buckets[i] = nullptr;
+    }
+
+    ~QueryCache() {
+        while (head) {
+            Entry* e = head;
+            head = head->next;
+            delete e;
+        }
+        delete[] buckets;
+    }
+
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    static bool cacheable(RequestType type) {
+        return type == REQ_ENTITY || type == REQ_YEAR || type == REQ_RATING || type == REQ_BFS ||
+               type == REQ_DFS || type == REQ_PATH || type == REQ_CONNECT || type == REQ_COACTORS;
+    }
+
+    // Cache key of a request. Titles and keys are normalized, except where the answer echoes the input.
+    static string make_key(const Request& req) {
+        stringstream ss;
+        string name;
+        ss.precision(9);
+        ss << (int)req.type << '|';
+        if (req.type == REQ_CONNECT || req.type == REQ_COACTORS) ss << req.text << '|' << req.text2;
+        else if (req.type == REQ_ENTITY) ss << entity_types_of(req.text, any_entity, name) << '|' << format_key(name);
+        else ss << format_key(req.text) << '|' << format_key(req.text2);
+        ss << '|' << req.number << '|' << req.low << '|' << req.high;
+        if (req.offset > 0 || req.limit >= 0) ss << "|@" << req.offset << ',' << req.limit;
+        return ss.str();
+    }
+
+    bool lookup(const string& key, string& answer) {
+        lock_guard<mutex> guard(lock);
+        Entry* e = *slot_of(key);
+        if (!e) {
+            misses++;
+            return false;
+        }
+        hits++;
+        unlink(e);
+        push_front(e);
+        answer = e->answer;
+        return true;
+    }
+
+    // Stores an answer computed on the given version (ignored if a newer version was published since)
+    void insert(const string& key, const string& answer, const Request& req, QueryDeps& deps, long long version) {
+        lock_guard<mutex> guard(lock);
+        if (version < valid_from) {
+            rejected++;
+            return;
+        }
+        // Title lookups depend on the titles themselves, found or not (an ADD can make them appear)
+        if (req.type == REQ_BFS || req.type == REQ_DFS || req.type == REQ_PATH) {
+            deps.movies.push(str_hash(format_key(req.text)));
+            if (req.type == REQ_PATH) deps.movies.push(str_hash(format_key(req.text2)));
+        }
+        deps.movies.sort_unique();
+        size_t bytes = sizeof(Entry) + key.size() + answer.size() + deps.movies.size() * sizeof(unsigned long);
+        if (bytes > budget) return;
+
+        Entry* old = *slot_of(key);
+        if (old) erase(old);
+
+        Entry* e = new Entry();
+        e->key = key;
+        e->answer = answer;
+        e->type = req.type;
+        e->year = req.number;
+        e->low = req.low;
+        e->high = req.high;
+        e->entity1 = (req.type == REQ_ENTITY || req.type == REQ_COACTORS || req.type == REQ_CONNECT)
+                         ? entity_hash(req.text) : 0;
+        e->entity2 = (req.type == REQ_CONNECT) ? entity_hash(req.text2) : 0;
+        e->dep_count = deps.movies.size();
+        e->deps = new unsigned long[e->dep_count > 0 ? e->dep_count : 1];
+        for (int i = 0; i < e->dep_count; i++) e->deps[i] = deps.movies[i];
+        e->global = deps.global;
+        e->bytes = bytes;
+        e->prev = e->next = nullptr;
+
+        if (count + 1 > bucket_cap) grow();
+        Entry** p = slot_of(key);
+        e->chain = nullptr;
+        *p = e;
+        push_front(e);
+        count++;
+        used += bytes;
+
+        while (used > budget && tail) {
+            erase(tail);
+            evictions++;
+        }
+    }
+
+    // Writer side, before the new version is published: drops every entry the diff touches
+    void invalidate(const VersionDiff& d, long long next_version) {
+        lock_guard<mutex> guard(lock);
+        valid_from = next_version;
+        Entry* e = head;
+        while (e) {
+            Entry* nxt = e->next;
+            if (affected(e, d)) {
+                erase(e);
+                invalidations++;
+            }
+            e = nxt;
+        }
+    }
+
+    // Entries with their keys, answers and dependency lists, and the bucket array
+    void account(MemoryReport& r) const {
+        lock_guard<mutex> guard(lock);
+        int p = r.part("Query cache", "answers");
+        r.add(p, (long long)bucket_cap * sizeof(Entry*));
+        for (const Entry* e = head; e; e = e->next) {
+            r.add(p, sizeof(Entry) + (long long)(e->dep_count > 0 ? e->dep_count : 1) * sizeof(unsigned long), 2);
+            r.add_string(p, e->key);
+            r.add_string(p, e->answer);
+        }
+        r.count(p, count);
+    }
+
+    void show_stats(ostream& out) const {
+        lock_guard<mutex> guard(lock);
+        long long lookups = hits + misses;
+        out << "\n--- Query Cache ---\n";
+        out << "Entries: " << count << " | Memory: " << used / 1024 << " KB of " << budget / 1024 << " KB\n";
+        out << "Hits: " << hits << " | Misses: " << misses << " | Hit rate: "
+            << (lookups ? hits * 100.0 / lookups : 0.0) << "%\n";
+        out << "Evictions: " << evictions << " | Invalidated: " << invalidations
+            << " | Stale answers dropped: " << rejected << "\n";
+    }
+};
+
+// Analytics Report
+// Summary printed for the ANALYTICS request; filled from GraphAnalytics or from a streaming pass in disk mode.
+struct AnalyticsReport {
+    static const int top_count = 10;
+
+    int movies;
+    long long edge_count; // Directed link entries (every link counted from both ends)
+    int comp_count;
+    int largest;          // Size of the largest component (-1 if there are no movies)
+    int max_degree;
+    int hist[GraphAnalytics::hist_bins];
+    int hubs;
+    string hub_title[top_count];
+    int hub_links[top_count];
+    int centrals;
+    string central_title[top_count];
+    float central_rank[top_count];
+
+    AnalyticsReport() : movies(0), edge_count(0), comp_count(0), largest(-1), max_degree(0), hubs(0), centrals(0) {
+        for (int b = 0; b < GraphAnalytics::hist_bins; b++) hist[b] = 0;
+    }
+
+    void print(ostream& out) const {
+        out << "\n--- Graph Analytics ---\n";
+        out << "Movies: " << movies << " | Links: " << edge_count / 2 << "\n";
+        out << "Components: " << comp_count;
+        if (largest != -1) out << " | Largest: " << largest << " movies";
+        out << " | Isolated: " << hist[0] << "\n";
+        out << "Average degree: " << (movies ? (float)edge_count / movies : 0.0f)
+             << " | Max degree: " << max_degree << "\n";
+
+        out << "Degree distribution:\n";
+        for (int b = 0; b < GraphAnalytics::hist_bins; b++) {
+            if (hist[b] == 0) continue;
+            int lo = (b == 0) ? 0 : (1 << (b - 1));
+            int hi = (1 << b) - 1;
+            out << "  " << lo;
+            if (b == GraphAnalytics::hist_bins - 1) out << "+";
+            else if (hi > lo) out << "-" << hi;
+            out << ": " << hist[b] << "\n";
+        }
+
+        out << "Top hubs (most links):\n";
+        for (int i = 0; i < hubs; i++) out << "  - " << hub_title[i] << " [" << hub_links[i] << " links]\n";
+        out << "Most central (PageRank x 1000):\n";
+        for (int i = 0; i < centrals; i++) out << "  - " << central_title[i] << " (" << central_rank[i] * 1000 << ")\n";
+    }
+};
+
+// Graph Class
+// Handles Recommendations (BFS/DFS) and Shortest Path logic on one catalog version.
+// Movies are addressed by their uid; no search state is kept in the movies themselves.
+// If deps is given, the searches record the movies they visited (for the query cache).
+class Graph {
+public:
+    void record_visited(const CatalogVersion& v, const FrontierBFS& bfs, QueryDeps* deps) const {
+        if (!deps) return;
+        for (int i = 0; i < bfs.visited_count(); i++) deps->add(v.movie(bfs.visited_at(i)));
+    }
+
+    // The target on the search's last level that comes first in title order (the search stops on the first
+    // level that reaches a target)
+    int first_target(const CatalogVersion& v, const FrontierBFS& bfs, const bool* is_target) const {
+        if (bfs.target_hit == -1) return -1;
+        int last = bfs.level_count() - 1, best = -1;
+        string best_key, scratch;
+        for (int i = bfs.level_begin(last); i < bfs.level_end(last); i++) {
+            int m = bfs.visited_at(i);
+            if (!is_target[m]) continue;
+            const string& k = v.movie(m)->key(scratch);
+            if (best == -1 || k < best_key) {
+                best = m;
+                best_key = k;
+            }
+        }
+        return best;
+    }
+
+    // Recommendation using Breadth-First Search (BFS)
+    // Finds immediate and close neighbors first; within one BFS level, more central movies (PageRank) are
+    // suggested first. The version's analytics are computed first if no request has done so yet.
+    void recommend_bfs(CatalogVersion& v, int start, int limit, ostream& out, QueryDeps* deps) const {
+        const GraphAnalytics& g = v.analysed();
+        const TitleOrder& o = v.title_order();
+        if (deps) deps->global = true; // PageRank changes with any link
+
+        FrontierBFS bfs(v.movies);
+        bfs.run(&start, 1, nullptr, limit + 1);
+        record_visited(v, bfs, deps);
+
+        out << "\n--- Top " << limit << " Recommendations for '" << v.title(start) << "' ---\n";
+        int count = 0;
+        for (int d = 1; d < bfs.level_count() && count < limit; d++) {
+            // Title positions of the level; partial selection sort, so only printed entries get ordered
+            int size = bfs.level_end(d) - bfs.level_begin(d);
+            int* level = new int[size];
+            for (int i = 0; i < size; i++) level[i] = o.pos_of[bfs.visited_at(bfs.level_begin(d) + i)];
+            for (int i = 0; i < size && count < limit; i++) {
+                int best = i;
+                for (int j = i + 1; j < size; j++) {
+                    float a = g.rank[level[j]], b = g.rank[level[best]];
+                    if (a > b || (a == b && level[j] < level[best])) best = j;
+                }
+                int pick = level[best];
+                level[best] = level[i];
+                level[i] = pick;
+                int m = o.uid_at[pick];
+                out << "-> " << v.title(m) << " (" << v.movie(m)->rating << "/10)\n";
+                count++;
+            }
+            delete[] level;
+        }
+        if (count == 0) out << "No related movies found.\n";
+    }
+
+    // Computes (or reuses) connected components, degree distribution and PageRank and prints a summary
+    void show_analytics(CatalogVersion& v, ostream& out) const {
+        const GraphAnalytics& g = v.analysed();
+        const TitleOrder& o = v.title_order();
+
+        AnalyticsReport report;
+        report.movies = g.n;
+        report.edge_count = g.edge_count;
+        report.comp_count = g.comp_count;
+        report.largest = (g.largest_comp != -1) ? g.comp_size[g.largest_comp] : -1;
+        report.max_degree = g.max_degree;
+        for (int b = 0; b < GraphAnalytics::hist_bins; b++) report.hist[b] = g.degree_hist[b];
+
+        int top[AnalyticsReport::top_count];
+        float* deg = new float[g.n > 0 ? g.n : 1];
+        for (int pos = 0; pos < g.n; pos++) deg[pos] = (float)v.movies.degree(o.uid_at[pos]);
+        report.hubs = top_k_scores(deg, g.n, AnalyticsReport::top_count, top);
+        for (int i = 0; i < report.hubs; i++) {
+            report.hub_title[i] = v.title(o.uid_at[top[i]]);
+            report.hub_links[i] = (int)deg[top[i]];
+        }
+        delete[] deg;
+
+        report.centrals = top_k_scores(g.rank, g.n, AnalyticsReport::top_count, top);
+        for (int i = 0; i < report.centrals; i++) {
+            report.central_title[i] = v.title(o.uid_at[top[i]]);
+            report.central_rank[i] = g.rank[top[i]];
+        }
+        report.print(out);
+    }
+
+    // Recommendation using Depth-First Search (DFS)
+    // Explores deep into a specific genre/actor chain.
+    // Visited marks live in a per-call array (indexed by uid), so searches can run side by side.
+    void recommend_dfs(CatalogVersion& v, int start, int limit, ostream& out, QueryDeps* deps) const {
+        int n = v.movies.bound;
+        bool* visited = new bool[n];
+        for (int i = 0; i < n; i++) visited[i] = false;
+
+        my_stack<int> s;
+        s.push(start);
+        visited[start] = true;
+
+        out << "\n--- DFS Recommendation for '" << v.title(start) << "' ---\n";
+        int count = 0;
+
+        while (!s.empty()) {
+            int curr = s.pop();
+
+            if (curr != start) {
+                out << "-> " << v.title(curr) << "\n";
+                count++;
+            }
+            if (count >= limit) break;
+
+            ListCursor e = v.movies.edges(curr);
+            int neighbor;
+            while (e.next(neighbor)) {
+                if (!visited[neighbor]) {
+                    visited[neighbor] = true;
+                    s.push(neighbor);
+                }
+            }
+        }
+        if (deps) {
+            for (int i = 0; i < n; i++) if (visited[i]) deps->add(v.movie(i));
+        }
+        delete[] visited;
+    }
+
+    // Finds the shortest path between two movies using BFS and parent pointers
+    void shortest_path(CatalogVersion& v, int start, int end, ResultPage& page, ostream& out, QueryDeps* deps) const {
+        // Cached components answer unreachable pairs without a search
+        if (v.known_apart(start, end)) {
+            if (deps) deps->global = true;
+            out << "\nNo connection found.\n";
+            return;
+        }
+
+        int n = v.movies.bound;
+        bool* is_target = new bool[n];
+        for (int id = 0; id < n; id++) is_target[id] = false;
+        is_target[end] = true;
+
+        FrontierBFS bfs(v.movies);
+        bfs.run(&start, 1, is_target);
+        delete[] is_target;
+        record_visited(v, bfs, deps);
+
+        if (bfs.target_hit != -1) {
+            out << "\n--- Shortest Connection Path ---\n";
+            print_path(v, bfs, bfs.target_hit, page, out);
+            out << '\n';
+        } else {
+            out << "\nNo connection found.\n";
+        }
+    }
+
+    // Connects two people (Actors/Director) via movies they participated in.
+    // Multi-source BFS: starts from every movie of person 1 and stops at the first level
+    // that contains a movie where person 2 is in the cast or directing.
+    void connect_actors(CatalogVersion& v, string a1, string a2, ResultPage& page, ostream& out,
+                        QueryDeps* deps) const {
+        my_array<int> sources, found;
+        if (!v.search(a1, person_entity, sources)) {
+            out << "Actor/Director 1 (" << a1 << ") not found.\n";
+            return;
+        }
+
+        int n = v.movies.bound;
+        bool* is_target = new bool[n];
+        for (int i = 0; i < n; i++) is_target[i] = false;
+        v.search(a2, person_entity, found);
+        for (int i = 0; i < found.size(); i++) is_target[found[i]] = true;
+
+        FrontierBFS bfs(v.movies);
+        bfs.run(sources.data(), sources.size(), is_target);
+        int target = first_target(v, bfs, is_target);
+        delete[] is_target;
+        record_visited(v, bfs, deps);
+
+        if (target != -1) {
+            out << "\n--- Connection Found! ---\n";
+            out << a1 << " is connected to " << a2 << " via:\n";
+            print_path(v, bfs, target, page, out);
+            out << " -> (Involved: " << a2 << ")\n";
+        } else {
+            out << "No connection found between these actors/directors.\n";
+        }
+    }
+
+
+    // Prints path from the BFS source to node v by walking parent links
+    void print_path(const CatalogVersion& v, const FrontierBFS& bfs, int id, ResultPage& page, ostream& out) const {
+        my_array<int> path;
+        while (true) {
+            path.push(id);
+            int p = bfs.parent(id);
+            if (p == id) break;
+            id = p;
+        }
+        print_steps(path, [&v](int step) { return v.title(step); }, page, out);
+    }
+};
+
+// CSV Parsing Logic
+// Splits a line into fields: commas separate fields outside quotes, a quote toggles quoting anywhere,
+// and "" inside quotes is a literal quote. The unquoted text of all fields goes into one buffer that is
+// reused from line to line, so splitting does not allocate once the buffer has grown.
+class CsvLine {
+private:
+    string text;
+    my_array<int> ends; // Field i is text[ends[i - 1] (or 0), ends[i])
+
+public:
+    void split(const string& line) {
+        text.clear();
+        ends.clear();
+        bool in_quotes = false;
+        size_t n = line.length();
+        for (size_t i = 0; i < n; i++) {
+            char c = line[i];
+            if (c == '\"') {
+                if (in_quotes && i + 1 < n && line[i + 1] == '\"') {
+                    text += '\"'; // handle escaped double quotes
+                    i++;
+                } else {
+                    in_quotes = !in_quotes;
+                }
+            }
+            else if (c == ',' && !in_quotes) ends.push((int)text.size());
+            else text += c;
+        }
+        ends.push((int)text.size());
+    }
+
+    int size() const { return ends.size(); }
+    const char* begin(int i) const { return text.data() + (i > 0 ? ends[i - 1] : 0); }
+    const char* end(int i) const { return text.data() + ends[i]; }
+    string field(int i) const { return string(begin(i), end(i)); }
+};
+
+// Splits a string on sep into the list (empty pieces included)
+void split_into(const string& str, char sep, LinkedList<string>& parts) {
+    string piece = "";
+    for (char c : str) {
+        if (c == sep) {
+            parts.insert(piece);
+            piece = "";
+        } else piece += c;
+    }
+    parts.insert(piece);
+}
+
+// One movie's fields from a CSV line or an ADD request (names cleaned, short names not yet filtered out)
+struct MovieRow {
+    string title;
+    string director;
+    int year;
+    float rating;
+    int duration;
+    LinkedList<string> cast;
+    LinkedList<string> genres;
+
+    MovieRow() : year(0), rating(0.0f), duration(0) {}
+};
+
+// Field Kinds
+// How the text of a column becomes a MovieRow field. Each column's store function is a separate
+// instantiation of store_field, so the conversion is fixed at compile time.
+struct TextKind {
+    static void store(const char* b, const char* e, string& out) { out = clean_str(string(b, e)); }
+};
+struct IntKind {
+    static void store(const char* b, const char* e, int& out) { out = parse_int(b, e); }
+};
+struct FloatKind {
+    static void store(const char* b, const char* e, float& out) { out = parse_float(b, e); }
+};
+struct NameKind { // Appends one cleaned name
+    static void store(const char* b, const char* e, LinkedList<string>& out) { out.insert(clean_str(string(b, e))); }
+};
+struct NameListKind { // Appends the '|' separated names as they are
+    static void store(const char* b, const char* e, LinkedList<string>& out) { split_into(string(b, e), '|', out); }
+};
+
+template <typename Kind, typename T, T MovieRow::*Member>
+void store_field(MovieRow& row, const char* b, const char* e) { Kind::store(b, e, row.*Member); }
+
+struct CsvColumn {
+    const char* header;
+    int position; // In the original movie_metadata.csv export
+    void (*store)(MovieRow& row, const char* b, const char* e);
+};
+
+// The columns a MovieRow is read from, in the order they are stored (this is also the order of the cast)
+const CsvColumn movie_columns[] = {
+    { "movie_title", 11, &store_field<TextKind, string, &MovieRow::title> },
+    { "director_name", 1, &store_field<TextKind, string, &MovieRow::director> },
+    { "duration", 3, &store_field<IntKind, int, &MovieRow::duration> },
+    { "actor_1_name", 10, &store_field<NameKind, LinkedList<string>, &MovieRow::cast> },
+    { "actor_2_name", 6, &store_field<NameKind, LinkedList<string>, &MovieRow::cast> },
+    { "actor_3_name", 14, &store_field<NameKind, LinkedList<string>, &MovieRow::cast> },
+    { "genres", 9, &store_field<NameListKind, LinkedList<string>, &MovieRow::genres> },
+    { "title_year", 23, &store_field<IntKind, int, &MovieRow::year> },
+    { "imdb_score", 25, &store_field<FloatKind, float, &MovieRow::rating> },
+};
+const int movie_column_count = sizeof(movie_columns) / sizeof(movie_columns[0]);
+
+// CSV Schema
+// Where each of movie_columns is in one particular file, looked up by header name, so exports with reordered
+// or additional columns load the same way. Columns missing from the header leave their field at its default;
+// a header without movie_title is taken to be the original layout.
+class CsvSchema {
+private:
+    int position[movie_column_count]; // -1 = not in this file
+    int needed; // Fields a row must have (one past the last column read)
+    bool bound;
+    CsvLine cells;
+
+    void use_defaults() {
+        needed = 0;
+        for (int c = 0; c < movie_column_count; c++) {
+            position[c] = movie_columns[c].position;
+            needed = get_max(needed, position[c] + 1);
+        }
+    }
+
+public:
+    CsvSchema() : bound(false) { use_defaults(); }
+
+    bool is_bound() const { return bound; }
+
+    void bind(const string& header) {
+        cells.split(header);
+        for (int c = 0; c < movie_column_count; c++) position[c] = -1;
+        for (int i = 0; i < cells.size(); i++) {
+            string name = format_key(cells.field(i)); // Also drops a byte order mark and the '\r' of CRLF files
+            for (int c = 0; c < movie_column_count; c++) {
+                if (position[c] == -1 && name == movie_columns[c].header) position[c] = i;
+            }
+        }
+        if (position[0] == -1) use_defaults();
+        else {
+            needed = 0;
+            for (int c = 0; c < movie_column_count; c++) needed = get_max(needed, position[c] + 1);
+        }
+        bound = true;
+    }
+
+    // Reads the mapped columns of one line. False if the line has too few columns.
+    bool parse(const string& line, MovieRow& row) {
+        cells.split(line);
+        if (cells.size() < needed) return false;
+        for (int c = 0; c < movie_column_count; c++) {
+            int p = position[c];
+            if (p >= 0) movie_columns[c].store(row, cells.begin(p), cells.end(p));
+        }
+        return true;
+    }
+};
+
+// Spec format: title;year;rating;duration;director;actor1|actor2|...;genre1|genre2|...
+// Prints the reason and returns false if the spec is not usable.
+bool parse_movie_spec(const string& spec, MovieRow& row, ostream& out) {
+    LinkedList<string> fields;
+    split_into(spec, ';', fields);
+    if (fields.size != 7) {
+        out << "Invalid movie. Expected: title;year;rating;duration;director;actors;genres\n";
+        return false;
+    }
+    row.title = clean_str(fields.get_at(0));
+    if (format_key(row.title) == "") {
+        out << "Invalid movie title.\n";
+        return false;
+    }
+    row.year = to_int(fields.get_at(1));
+    row.rating = to_float(fields.get_at(2));
+    row.duration = to_int(fields.get_at(3));
+    row.director = clean_str(fields.get_at(4));
+    split_into(fields.get_at(5), '|', row.cast);
+    split_into(fields.get_at(6), '|', row.genres);
+    list_node<string>* c = row.cast.head;
+    while (c) { c->data = clean_str(c->data); c = c->next; }
+    return true;
+}
+
+// Batches
+// A batch file holds one change per line, all applied as one write:
+//   ADD <title;year;rating;duration;director;actor1|actor2;genre1|genre2>
+//   UPDATE <title>;<field>=<value>;...   fields: rating, year, director, cast, genres (names separated by '|')
+//   DELETE <title>
+// Blank lines and lines starting with '#' are skipped. Changes to one title take effect in file order.
+// The plan is applied in three steps: every movie that goes away is removed, ratings and years are changed in
+// place, then the new movies are added in file order. A movie whose director, cast or genres change is
+// removed and added again, so its links are made like those of a new movie. If the engine cannot store the
+// movie a title ends up as, none of that title's changes are applied and the stored movie stays as it is.
+class BatchPlan {
+public:
+    struct FieldEdit {
+        string title;
+        int year;
+        float rating;
+    };
+
+private:
+    struct Op {
+        int line;
+        char kind;      // 'A'dd, 'U'pdate or 'D'elete
+        string title;
+        string key;
+        MovieRow* row;  // ADD only
+        string fields;  // UPDATE only: "field=value;..."
+        bool operator<(const Op& o) const { return key < o.key || (key == o.key && line < o.line); }
+    };
+    struct Insert {
+        int line;
+        MovieRow* row;
+        bool operator<(const Insert& o) const { return line < o.line; }
+    };
+
+    my_array<Op> ops;
+    my_array<Insert> pending;
+
+    // Applies "field=value;..." to the row; false with the reason printed if a field is unknown.
+    // names is set if the director, cast or genres changed.
+    static bool apply_fields(const string& fields, MovieRow& row, bool& names, ostream& out) {
+        LinkedList<string> parts;
+        split_into(fields, ';', parts);
+        for (list_node<string>* p = parts.head; p; p = p->next) {
+            if (p->data == "") continue;
+            size_t eq = p->data.find('=');
+            string field = format_key(p->data.substr(0, eq));
+            string value = (eq == string::npos) ? "" : p->data.substr(eq + 1);
+            if (eq == string::npos) field = "";
+            if (field == "rating") row.rating = to_float(value);
+            else if (field == "year") row.year = to_int(value);
+            else if (field == "director") row.director = clean_str(value);
+            else if (field == "cast" || field == "genres") {
+                LinkedList<string>& list = (field == "cast") ? row.cast : row.genres;
+                list.clear();
+                split_into(value, '|', list);
+                if (field == "cast") {
+                    for (list_node<string>* c = list.head; c; c = c->next) c->data = clean_str(c->data);
+                }
+            } else {
+                out << "unknown field '" << p->data << "'. Fields: rating, year, director, cast, genres\n";
+                return false;
+            }
+            if (field == "director" || field == "cast" || field == "genres") names = true;
+        }
+        return true;
+    }
+
+    // Parses one line into ops; false (with the reason printed after "Line n: ") if it is not a change
+    bool parse_line(const string& text, int line, ostream& out) {
+        size_t sp = text.find(' ');
+        string verb = text.substr(0, sp);
+        string rest = (sp == string::npos) ? "" : text.substr(sp + 1);
+        for (size_t i = 0; i < verb.length(); i++) {
+            if (verb[i] >= 'a' && verb[i] <= 'z') verb[i] -= 32;
+        }
+        Op op;
+        op.line = line;
+        op.row = nullptr;
+        if (verb == "ADD") {
+            stringstream reason;
+            MovieRow* row = new MovieRow();
+            if (!parse_movie_spec(rest, *row, reason)) {
+                out << "Line " << line << ": " << reason.str();
+                delete row;
+                return false;
+            }
+            op.kind = 'A';
+            op.title = row->title;
+            op.row = row;
+        } else if (verb == "UPDATE" || verb == "DELETE") {
+            size_t semi = (verb == "UPDATE") ? rest.find(';') : string::npos;
+            op.kind = verb[0];
+            op.title = clean_str(rest.substr(0, semi));
+            if (semi != string::npos) op.fields = rest.substr(semi + 1);
+        } else {
+            out << "Line " << line << ": unknown change '" << verb << "'. Expected ADD, UPDATE or DELETE\n";
+            return false;
+        }
+        op.key = format_key(op.title);
+        if (op.key == "") {
+            out << "Line " << line << ": invalid movie title.\n";
+            delete op.row;
+            return false;
+        }
+        ops.push(op);
+        return true;
+    }
+
+    // Runs the changes to one title (ops[begin, end), in file order) against the stored movie
+    template <typename LookupFn, typename FitsFn>
+    void plan_title(int begin, int end, LookupFn lookup, FitsFn fits, ostream& out) {
+        MovieRow* stored = new MovieRow();
+        bool original = lookup(ops[begin].title, *stored);
+        string stored_title = stored->title;
+        MovieRow* cur = stored;
+        if (!original) {
+            delete stored;
+            cur = nullptr;
+        }
+        bool reinsert = false, edited = false;
+        int insert_line = 0;
+        int a = 0, u = 0, d = 0, e = 0; // Counted only once the title's changes are known to apply
+        for (int i = begin; i < end; i++) {
+            Op& op = ops[i];
+            if (op.kind == 'A') {
+                if (cur) {
+                    out << "Line " << op.line << ": movie '" << op.title << "' already exists.\n";
+                    delete op.row;
+                    e++;
+                    continue;
+                }
+                cur = op.row;
+                reinsert = true;
+                insert_line = op.line;
+                a++;
+            } else if (!cur) {
+                out << "Line " << op.line << ": movie '" << op.title << "' not found.\n";
+                e++;
+            } else if (op.kind == 'D') {
+                delete cur;
+                cur = nullptr;
+                reinsert = edited = false;
+                d++;
+            } else {
+                bool names = false;
+                stringstream reason;
+                if (!apply_fields(op.fields, *cur, names, reason)) {
+                    out << "Line " << op.line << ": " << reason.str();
+                    e++;
+                    continue;
+                }
+                if (names) {
+                    reinsert = true;
+                    insert_line = op.line;
+                }
+                edited = true;
+                u++;
+            }
+        }
+        if (cur && reinsert && !fits(*cur)) {
+            out << "Line " << insert_line << ": movie '" << cur->title << "' is too large to store; "
+                << "its changes were not applied.\n";
+            delete cur;
+            errors += e + 1;
+            return;
+        }
+        added += a;
+        updated += u;
+        deleted += d;
+        errors += e;
+        if (original && (!cur || reinsert)) removals.push(stored_title);
+        if (cur && reinsert) {
+            Insert ins;
+            ins.line = insert_line;
+            ins.row = cur;
+            pending.push(ins);
+        } else if (cur) {
+            if (edited) {
+                FieldEdit e;
+                e.title = stored_title;
+                e.year = cur->year;
+                e.rating = cur->rating;
+                edits.push(e);
+            }
+            delete cur;
+        }
+    }
+
+public:
+    my_array<string> removals;   // Stored titles of the movies that go away (deleted, or added again)
+    my_array<FieldEdit> edits;    // Movies that stay, with their new year and rating
+    my_array<MovieRow*> inserts;  // New movies, in file order
+    int added, updated, deleted, errors;
+
+    BatchPlan() : added(0), updated(0), deleted(0), errors(0) {}
+    ~BatchPlan() {
+        for (int i = 0; i < inserts.size(); i++) delete inserts[i];
+    }
+    BatchPlan(const BatchPlan&) = delete;
+    BatchPlan& operator=(const BatchPlan&) = delete;
+
+    // Reads the batch file and works out its effect; lookup(title, row) fills row with the stored movie and is
+    // false if there is none, fits(row) tells whether the engine can store a movie. Unusable lines are reported
+    // and left out. False if the file cannot be read.
+    template <typename LookupFn, typename FitsFn>
+    bool build(const string& path, LookupFn lookup, FitsFn fits, ostream& out) {
+        ifstream file(path.c_str());
+        if (!file.is_open()) {
+            out << "Could not open " << path << endl;
+            return false;
+        }
+        string text;
+        for (int line = 1; getline(file, text); line++) {
+            if (!text.empty() && text[text.size() - 1] == '\r') text.erase(text.size() - 1);
+            if (text == "" || text[0] == '#') continue;
+            if (!parse_line(text, line, out)) errors++;
+        }
+        heap_sort(ops.data(), ops.size());
+        for (int i = 0; i < ops.size(); ) {
+            int end = i;
+            while (end < ops.size() && ops[end].key == ops[i].key) end++;
+            plan_title(i, end, lookup, fits, out);
+            i = end;
+        }
+        heap_sort(pending.data(), pending.size());
+        for (int i = 0; i < pending.size(); i++) inserts.push(pending[i].row);
+        return true;
+    }
+
+    void report(ostream& out) const {
+        out << "Batch applied: " << added << " added | " << updated << " updated | " << deleted << " deleted | "
+            << errors << " errors" << endl;
+    }
+};
+
+// Result of storing one parsed row (see CsvTail::read_rows)
+enum RowResult { ROW_ADDED, ROW_DUPLICATE, ROW_SKIPPED };
+
+// Row counts of one load or ingest
+struct LoadCounts {
+    int count;
+    int skipped;
+    int duplicates;
+
+    LoadCounts() : count(0), skipped(0), duplicates(0) {}
+    int rows() const { return count + skipped + duplicates; }
+
+    void print(ostream& out, const string& label) const {
+        out << label << ": " << count << " | Skipped: " << skipped << " | Duplicates: " << duplicates << endl;
+    }
+};
+
+// CSV Tail
+// Where reading of the dataset file stopped: the byte after the last line read, and the bytes just before it.
+// Rows appended to the file later are read from there, so only the new part is parsed. When reading appended
+// rows, a line that is still being written (no newline yet) is left for the next read; the first load takes
+// an unterminated last line as it is, like any other.
+// The file counts as rewritten if it got shorter or no longer holds the same bytes before the offset;
+// it then has to be loaded again from scratch.
+class CsvTail {
+public:
+    enum Status { TAIL_READ, TAIL_MISSING, TAIL_REWRITTEN };
+    static const int mark_size = 64;
+
+private:
+    string fname;
+    long long offset;
+    string mark; // Last mark_size (or fewer) bytes before offset
+    CsvSchema schema; // From the header line
+
+public:
+    CsvTail() : offset(0) {}
+
+    void set_file(const string& name) { fname = name; }
+    const string& file() const { return fname; }
+    long long position() const { return offset; }
+    const string& last_bytes() const { return mark; }
+
+    // Continues from a position saved earlier (see DiskEngine)
+    void restore(long long pos, const string& bytes) {
+        offset = pos;
+        mark = bytes;
+    }
+
+    bool readable() const {
+        ifstream file(fname);
+        return file.is_open();
+    }
+
+    // Reads the lines after offset (the first line of the file is the header, which sets the schema) and hands
+    // every parsed row to store(row), which returns a RowResult. Lines too short to parse are counted as skipped.
+    template <typename Fn>
+    Status read_rows(LoadCounts& counts, Fn store) {
+        ifstream file(fname, ios::binary);
+        if (!file.is_open()) return TAIL_MISSING;
+        file.seekg(0, ios::end);
+        long long size = file.tellg();
+        if (size < offset) return TAIL_REWRITTEN;
+        if (offset > 0) {
+            string before(mark.size(), '\0');
+            file.seekg(offset - (long long)mark.size());
+            file.read(&before[0], mark.size());
+            if (before != mark) return TAIL_REWRITTEN;
+        }
+        string line;
+        if (offset > 0 && !schema.is_bound()) {
+            file.seekg(0);
+            if (getline(file, line)) schema.bind(line);
+        }
+        file.clear();
+        file.seekg(offset);
+
+        bool first_load = (offset == 0);
+        while (getline(file, line)) {
+            bool complete = !file.eof();
+            if (!complete && !first_load) break; // No newline yet: the line may still be growing
+            bool header = (offset == 0);
+            offset += (long long)line.size() + (complete ? 1 : 0);
+            mark += complete ? line + "\n" : line;
+            if (mark.size() > (size_t)mark_size) mark.erase(0, mark.size() - mark_size);
+            if (header) schema.bind(line);
+            if (header || line.empty()) continue;
+
+            MovieRow row;
+            if (!schema.parse(line, row) || row.title.length() == 0) {
+                counts.skipped++;
+                continue;
+            }
+            RowResult r = store(row);
+            if (r == ROW_ADDED) counts.count++;
+            else if (r == ROW_DUPLICATE) counts.duplicates++;
+            else counts.skipped++;
+        }
+        return TAIL_READ;
+    }
+
+    // Prints the outcome of an ingest; returns the number of new rows, or -1 if the file is missing or rewritten
+    int report(Status status, const LoadCounts& counts, ostream& out) const {
+        if (status == TAIL_MISSING) {
+            out << "Could not open " << fname << endl;
+            return -1;
+        }
+        if (status == TAIL_REWRITTEN) {
+            out << fname << " was rewritten; restart to load it again." << endl;
+            return -1;
+        }
+        if (counts.rows() == 0) out << "No new rows.\n";
+        else counts.print(out, "Ingested");
+        return counts.rows();
+    }
+};
+
+// Catalog Writer
+// Makes the changes of one write on a draft CatalogVersion, which starts out sharing every node with the
+// current version. Each change copies only the nodes on its way (see Persistent Nodes): a rating edit costs
+// O(log n), adding or removing a movie O(log n) plus the links and keys it touches. The changes are collected
+// into a VersionDiff for the query cache as they are made.
+class CatalogWriter {
+private:
+    CatalogVersion& v;
+    Draft d;
+    VersionDiff& diff;
+
+    MovieSlot& slot(int uid) { return v.movies.slots.own(uid, d.stamp); }
+
+    // Links two movies both ways (no self links, no duplicates)
+    void link(int uid, int other) {
+        if (other == uid) return;
+        MovieSlot& a = slot(uid);
+        if (IdList::contains(a.links, other)) return;
+        d.push(a.links, other);
+        MovieSlot& b = slot(other);
+        d.push(b.links, uid);
+        v.movies.edge_count += 2;
+        diff.relink(b.rec);
+    }
+
+    // Puts a movie under a name's key; with_links also links it to the first movies already there (up to the
+    // type's link budget), which builds the graph
+    void index(int type, const string& raw_name, int uid, bool with_links) {
+        int name = names.intern(raw_name);
+        const string& k = names.key(name);
+        if (k == "") return;
+        PostingNode* p = v.postings[type].own(k, name, true, d.stamp);
+        // A movie already under the key was the last one added (a name repeated in its own cast)
+        if (IdList::last(p->movies) == uid) return;
+        ListCursor c(p->movies);
+        int other;
+        for (int i = 0; with_links && i < entity_policy[type].links && c.next(other); i++) link(uid, other);
+        d.push(p->movies, uid);
+    }
+
+    void unindex(int type, int name, int uid) {
+        const string& k = names.key(name);
+        if (k == "") return;
+        PostingNode* p = v.postings[type].own(k, name, false, d.stamp);
+        if (p) d.remove(p->movies, uid, true);
+    }
+
+    // The links add() makes for a movie under one key, worked out from the postings (in uid order): earlier gets
+    // the movies it linked to (in link order, no duplicates), later the movies indexed after it that linked to it
+    void replay(int type, int name, int uid, my_array<int>& earlier, my_array<int>& later) const {
+        const PostingNode* p = v.postings[type].find(names.key(name));
+        if (!p) return;
+        ListCursor c(p->movies);
+        int other;
+        for (int i = 0; i < entity_policy[type].links && c.next(other); i++) {
+            if (other == uid) {
+                while (c.next(other)) later.push(other);
+                return;
+            }
+            if (!earlier.contains(other)) earlier.push(other);
+        }
+    }
+
+public:
+    CatalogWriter(CatalogVersion& draft, VersionDiff& changes)
+        : v(draft), d(draft.number, draft.compact), diff(changes) {}
+
+    // Uid of the movie with the title, -1 if there is none
+    int find(const string& title) const { return v.find_title(title); }
+    const MovieRecord* movie(int uid) const { return v.movie(uid); }
+
+    // Adds a movie and indexes its cast, director and genres (names of one character or less are skipped, as in
+    // the CSV loader). with_links = false leaves the graph links for link_all(). False if the title exists.
+    bool add(const MovieRow& row, bool with_links) {
+        string key = format_key(row.title);
+        if (v.titles.find(key)) return false;
+        MovieRecord* rec = new MovieRecord();
+        rec->title = clean_str(row.title);
+        if (!v.compact) rec->search_key = key;
+        rec->key_hash = str_hash(key);
+        rec->director = names.intern(row.director);
+        rec->year = row.year;
+        rec->rating = row.rating;
+        rec->duration = row.duration;
+        my_array<int> actors, genres;
+        for (list_node<string>* a = row.cast.head; a; a = a->next) {
+            if (a->data.length() < 2) continue;
+            int id = names.intern(a->data);
+            if (!actors.contains(id)) actors.push(id);
+        }
+        for (list_node<string>* g = row.genres.head; g; g = g->next) {
+            if (g->data.length() < 2) continue;
+            int id = names.intern(g->data);
+            if (genres.contains(id)) continue;
+            genres.push(id);
+            if (names.key(id) != "") rec->genre_mask |= 1ULL << genre_bits.find(names.key(id), true);
+        }
+        rec->actors = ids_to_array(actors, rec->actor_count);
+        rec->genres = ids_to_array(genres, rec->genre_count);
+        rec->refs = 1; // Held by the movie table
+
+        int uid = v.movies.bound++;
+        MovieSlot& s = slot(uid);
+        s.rec = rec;
+        s.links = nullptr;
+        v.movies.count++;
+        v.titles.insert(rec, uid, d.stamp);
+
+        for (list_node<string>* a = row.cast.head; a; a = a->next) {
+            if (a->data.length() > 1) index(ENTITY_ACTOR, a->data, uid, with_links);
+        }
+        if (rec->director_name().length() > 1) index(ENTITY_DIRECTOR, rec->director_name(), uid, with_links);
+        for (list_node<string>* g = row.genres.head; g; g = g->next) {
+            if (g->data.length() > 1) index(ENTITY_GENRE, g->data, uid, with_links);
+        }
+        diff.changed(nullptr, rec, false);
+        diff.relink(rec);
+        return true;
+    }
+
+    // Removes a movie from the title tree, its neighbors' lists and its keys
+    void remove(int uid) {
+        MovieSlot& s = slot(uid);
+        MovieRecord* rec = s.rec;
+        ListCursor c(s.links);
+        int other;
+        while (c.next(other)) {
+            MovieSlot& o = slot(other);
+            d.remove(o.links, uid, false);
+            diff.relink(o.rec);
+        }
+        v.movies.edge_count -= 2 * IdList::size(s.links);
+        for (int a = 0; a < rec->actor_count; a++) unindex(ENTITY_ACTOR, rec->actors[a], uid);
+        if (rec->director_name().length() > 1) unindex(ENTITY_DIRECTOR, rec->director, uid);
+        for (int g = 0; g < rec->genre_count; g++) unindex(ENTITY_GENRE, rec->genres[g], uid);
+        string scratch;
+        v.titles.remove(rec->key(scratch), d.stamp);
+        diff.changed(rec, nullptr, false);
+        diff.relink(rec);
+        MovieSlot::release(s);
+        s.rec = nullptr;
+        s.links = nullptr;
+        v.movies.count--;
+    }
+
+    // New year and rating for a movie (a new record; links and keys stay)
+    void set_fields(int uid, int year, float rating) {
+        MovieSlot& s = slot(uid);
+        MovieRecord* before = s.rec;
+        MovieRecord* after = before->with_fields(year, rating);
+        after->refs = 1;
+        string scratch;
+        v.titles.set_record(after->key(scratch), after, d.stamp);
+        s.rec = after;
+        diff.changed(before, after, false);
+        release_record(before);
+    }
+
+    // Makes the graph links that add() left out, all movies at once on the worker threads. The result is the
+    // same as linking while adding: a movie's own links in key order, then the movies added after it that linked
+    // to it, in uid order. No movie may have been removed in between.
+    void link_all() {
+        int n = v.movies.bound;
+        my_array<int>* lists = new my_array<int>[n > 0 ? n : 1];
+        parallel_for(n, [this, lists](int begin, int end, int) {
+            my_array<int> later;
+            for (int u = begin; u < end; u++) {
+                const MovieRecord* m = v.movie(u);
+                if (!m) continue;
+                my_array<int>& earlier = lists[u];
+                later.clear();
+                for (int i = 0; i < m->actor_count; i++) replay(ENTITY_ACTOR, m->actors[i], u, earlier, later);
+                if (m->director_name().length() > 1) replay(ENTITY_DIRECTOR, m->director, u, earlier, later);
+                for (int i = 0; i < m->genre_count; i++) replay(ENTITY_GENRE, m->genres[i], u, earlier, later);
+                later.sort_unique();
+                for (int i = 0; i < later.size(); i++) earlier.push(later[i]);
+            }
+        });
+        v.movies.edge_count = 0;
+        for (int u = 0; u < n; u++) {
+            if (!v.movie(u)) continue;
+            MovieSlot& s = slot(u);
+            IdList::release(s.links);
+            s.links = nullptr;
+            for (int i = 0; i < lists[u].size(); i++) d.push(s.links, lists[u][i]);
+            v.movies.edge_count += lists[u].size();
+            diff.relink(s.rec);
+        }
+        delete[] lists;
+    }
+
+    // Packs what the write made (compact mode) and sorts the diff; the draft can then be published
+    void finish() {
+        d.seal();
+        diff.finish();
+    }
+};
+
+// Data Loading Logic
+// Reads the CSV, parses fields, creates the movies, and builds the graph (unless with_links is off).
+// Also used for ingesting rows appended later (tail remembers where reading stopped).
+CsvTail::Status load_rows(CsvTail& tail, CatalogWriter& w, bool with_links, LoadCounts& counts) {
+    return tail.read_rows(counts, [&](const MovieRow& row) {
+        return w.add(row, with_links) ? ROW_ADDED : ROW_DUPLICATE;
+    });
+}
+
+void load_data(CsvTail& tail, CatalogWriter& w, bool with_links) {
+    if (!tail.readable()) {
+        cout << "Could not open " << tail.file() << endl;
+        return;
+    }
+
+    cout << "Loading dataset... ";
+    LoadCounts counts;
+    load_rows(tail, w, with_links, counts);
+
+    cout << "Finished Loading!\n";
+    counts.print(cout, "Loaded");
+}
+
+// Answers SIMILAR for the movie at index id of the index (title_of gives the title of an index)
+template <typename TitleFn>
+void print_similar(const SimilarityIndex& sim, int id, int k, TitleFn title_of, ostream& out) {
+    if (k > sim.size()) k = sim.size(); // There are never more answers than movies
+    int* best = new int[k > 0 ? k : 1];
+    float* score = new float[k > 0 ? k : 1];
+    int found = sim.top_k(sim.at(id), false, k, id, best, score);
+    out << "\n--- Movies similar to '" << title_of(id) << "' ---\n";
+    for (int i = 0; i < found; i++) out << "-> " << title_of(best[i]) << " (similarity " << score[i] << ")\n";
+    if (found == 0) out << "No similar movies found.\n";
+    delete[] best;
+    delete[] score;
+}
+
+// Answers PROFILE: the movies whose genres best match the '|' separated list
+template <typename TitleFn>
+void print_profile(const SimilarityIndex& sim, const string& genres, int k, TitleFn title_of, ostream& out) {
+    MovieSignature q;
+    LinkedList<string> wanted;
+    split_into(genres, '|', wanted);
+    for (list_node<string>* g = wanted.head; g; g = g->next) {
+        string key = format_key(g->data);
+        if (key == "") continue;
+        int bit = genre_bits.find(key, false);
+        if (bit == -1) out << "Unknown genre: " << g->data << endl;
+        else q.w[0] |= 1ULL << bit;
+    }
+    if (q.w[0] == 0) {
+        out << "No matching genres.\n";
+        return;
+    }
+    if (k > sim.size()) k = sim.size();
+    int* best = new int[k > 0 ? k : 1];
+    float* score = new float[k > 0 ? k : 1];
+    int found = sim.top_k(q, true, k, -1, best, score);
+    out << "\n--- Movies matching " << genres << " ---\n";
+    for (int i = 0; i < found; i++) out << "-> " << title_of(best[i]) << " (match " << score[i] << ")\n";
+    if (found == 0) out << "None found.\n";
+    delete[] best;
+    delete[] score;
+}
+
+// One movie of a QUERY answer
+void print_query_row(ostream& out, const string& title, int year, float rating) {
+    out << "- " << title << " (" << year << ") [" << rating << "]\n";
+}
+
+// Runs a QUERY or EXPLAIN request on the source; true if the caller should now print the movies of the cursor
+bool answer_compound(const Request& req, QuerySource& src, QueryCursor& found, ostream& out) {
+    CompoundQuery q;
+    string error;
+    if (!parse_compound(req.text, q, error)) {
+        out << "Invalid query: " << error << endl;
+        return false;
+    }
+    if (req.type == REQ_EXPLAIN) {
+        out << "\n--- Plan for " << req.text << " ---\n";
+        run_compound(q, src, found, &out);
+        return false;
+    }
+    run_compound(q, src, found, nullptr);
+    out << "\n--- Query results (" << found.size() << ") ---\n";
+    if (found.size() == 0) out << "No matches found.\n";
+    return true;
+}
+
+// Catalog Engine
+// What the menu and the query server need from a catalog: loading, running requests and the rating lookup.
+// MovieEngine keeps the catalog in memory, DiskEngine in a page file, ShardedEngine in several in-memory shards.
+class CatalogEngine {
+public:
+    virtual ~CatalogEngine() {}
+
+    virtual void load(string fname) = 0;
+    virtual void execute(const Request& req, ostream& out) = 0;
+    virtual bool current_rating(const string& title, float& r) = 0;
+    // Loads the rows appended to the dataset since the last load or ingest (see CsvTail::report for the result)
+    virtual int ingest(ostream& out) = 0;
+
+    static bool is_write(RequestType type) {
+        return type == REQ_SET_RATING || type == REQ_DELETE || type == REQ_ADD || type == REQ_INGEST ||
+               type == REQ_BATCH;
+    }
+
+    // Requests answered from the graph links
+    static bool uses_links(RequestType type) {
+        return type == REQ_BFS || type == REQ_DFS || type == REQ_PATH || type == REQ_CONNECT || type == REQ_ANALYTICS;
+    }
+};
+
+// Query source over one CatalogVersion: ids are title positions (see TitleOrder), so ascending ids are in
+// title order
+class VersionQuerySource : public QuerySource {
+private:
+    CatalogVersion& v;
+    const TitleOrder& order;
+
+    // Same keys as the movie's postings (see CatalogWriter::add)
+    static bool has_key(const MovieRecord* m, int types, const string& key) {
+        if (types >> ENTITY_ACTOR & 1) {
+            for (int i = 0; i < m->actor_count; i++) if (names.key(m->actors[i]) == key) return true;
+        }
+        if ((types >> ENTITY_GENRE & 1) && m->has_genre(key)) return true;
+        return (types >> ENTITY_DIRECTOR & 1) && m->director_name().length() > 1 && names.key(m->director) == key;
+    }
+
+public:
+    VersionQuerySource(CatalogVersion& version) : v(version), order(version.title_order()) {}
+
+    int posting_count(int types, const string& key) {
+        int total = 0;
+        for (int t = 0; t < entity_type_count; t++) {
+            const PostingNode* p = (types >> t & 1) ? v.postings[t].find(key) : nullptr;
+            if (p) total += IdList::size(p->movies);
+        }
+        return total;
+    }
+
+    void posting_ids(int types, const string& key, my_array<int>& out) {
+        out.clear();
+        for (int t = 0; t < entity_type_count; t++) {
+            const PostingNode* p = (types >> t & 1) ? v.postings[t].find(key) : nullptr;
+            if (!p) continue;
+            ListCursor c(p->movies);
+            int uid;
+            while (c.next(uid)) out.push(order.pos_of[uid]);
+        }
+        out.sort_unique();
+    }
+
+    const RangeIndex& range(TermKind kind) { return v.range(kind); }
+
+    bool passes(int id, QueryTerm* const* terms, int count) {
+        const MovieRecord* m = v.movie(order.uid_at[id]);
+        for (int i = 0; i < count; i++) {
+            const QueryTerm& t = *terms[i];
+            if (t.kind == TERM_ENTITY ? !has_key(m, t.types, t.key)
+                                      : !t.accepts(t.kind == TERM_YEAR ? (float)m->year : m->rating)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int check_cost() const { return 8; }
+};
+
+// Movie Engine
+// Owns the loaded catalog and runs requests against it, writing each answer to the given stream.
+// Reads run on the current CatalogVersion and never wait for updates. Updates are serialized by write_lock:
+// each one makes the next version from the current one with a CatalogWriter and publishes it.
+// Several threads may call execute() at the same time.
+class MovieEngine : public CatalogEngine {
+private:
+    Graph graph;
+    mutex write_lock;
+    VersionStore versions;
+    long long published;
+    QueryCache cache;
+    bool compact; // Publish compact versions (see CatalogVersion)
+    CsvTail tail;
+    atomic<bool> unlinked; // Graph links deferred until a request needs them (--lazy-graph)
+
+    // Runs change(writer) on a draft of the next version and makes it visible to new reads (write_lock held).
+    // The draft shares every node the change does not touch, so a write costs O(log n) plus what it changes;
+    // a change that changed nothing is dropped. If the links did not change, the title order and analytics of
+    // the previous version carry over.
+    // Cached answers are checked against the changes before anyone can read the new version.
+    template <typename Fn>
+    void write(bool links_changed, Fn change) {
+        CatalogVersion* prev = versions.get();
+        CatalogVersion* next = prev ? new CatalogVersion(*prev, published + 1) : new CatalogVersion(published + 1, compact);
+        VersionDiff diff;
+        CatalogWriter w(*next, diff);
+        change(w);
+        w.finish();
+        if (prev && diff.empty()) {
+            delete next;
+            return;
+        }
+        published++;
+        if (prev && !links_changed) next->share_derived(*prev);
+        if (prev) cache.invalidate(diff, next->number);
+        versions.publish(next);
+    }
+
+    void list_all(CatalogVersion& v, ResultPage& page, ostream& out) const {
+        TitleTree::Cursor c(v.titles);
+        while (!page.full()) {
+            const TitleNode* t = c.next();
+            if (!t) break;
+            if (page.take()) out << t->rec->title << " (" << t->rec->year << ")\n";
+        }
+    }
+
+    void find_by_year(CatalogVersion& v, int y, ResultPage& page, ostream& out) const {
+        out << "\n--- Movies from " << y << " ---\n";
+        TitleTree::Cursor c(v.titles);
+        while (!page.full()) {
+            const TitleNode* t = c.next();
+            if (!t) break;
+            if (t->rec->year == y && page.take()) out << "- " << t->rec->title << '\n';
+        }
+        if (page.rows() == 0) out << "None found.\n";
+    }
+
+    void find_by_rating(CatalogVersion& v, float min, float max, ResultPage& page, ostream& out) const {
+        out << "\n--- Movies rated " << min << " to " << max << " ---\n";
+        TitleTree::Cursor c(v.titles);
+        while (!page.full()) {
+            const TitleNode* t = c.next();
+            if (!t) break;
+            const MovieRecord* m = t->rec;
+            if (m->rating >= min && m->rating <= max && page.take()) {
+                out << "- " << m->title << " [" << m->rating << "]\n";
+            }
+        }
+        if (page.rows() == 0) out << "None found.\n";
+    }
+
+    // Cast members of the movies the actor played in (a "director:" prefix takes the movies they directed)
+    void co_actors(CatalogVersion& v, const string& name, ResultPage& page, ostream& out) const {
+        my_array<int> res;
+        if (!v.search(name, 1 << ENTITY_ACTOR, res)) {
+            out << "Actor not found.\n";
+            return;
+        }
+        out << "\n--- Co-Actors of " << name << " ---\n";
+        string plain;
+        entity_types_of(name, 0, plain);
+        string key = format_key(plain);
+        LinkedList<int> printed;
+        for (int r = 0; r < res.size() && !page.full(); r++) {
+            const MovieRecord* m = v.movie(res[r]);
+            for (int a = 0; a < m->actor_count; a++) {
+                if (names.key(m->actors[a]) != key && !printed.has_item(m->actors[a])) {
+                    if (page.take()) out << m->actor(a) << ", ";
+                    printed.insert(m->actors[a]);
+                }
+            }
+        }
+        out << '\n';
+    }
+
+    void add_movie(CatalogWriter& w, const string& spec, ostream& out) {
+        MovieRow row;
+        if (!parse_movie_spec(spec, row, out)) return;
+        if (!w.add(row, !unlinked)) {
+            out << "Movie '" << row.title << "' already exists.\n";
+            return;
+        }
+        out << "Movie '" << row.title << "' added.\n";
+    }
+
+    void run_read(CatalogVersion& v, const Request& req, ostream& out, QueryDeps* deps) const {
+        ResultPage page(req);
+        switch (req.type) {
+            case REQ_LIST_ALL: list_all(v, page, out); break;
+            case REQ_TITLE: {
+                int id = v.find_title(req.text);
+                if (id != -1) v.show_details(id, out);
+                else out << "Not found.\n";
+                break;
+            }
+            case REQ_ENTITY: {
+                my_array<int> res;
+                if (v.search(req.text, any_entity, res)) {
+                    out << "\n--- Results ---\n";
+                    for (int i = 0; i < res.size() && !page.full(); i++) {
+                        if (page.take()) out << "- " << v.title(res[i]) << '\n';
+                    }
+                } else out << "No matches found.\n";
+                break;
+            }
+            case REQ_YEAR: find_by_year(v, req.number, page, out); break;
+            case REQ_RATING: find_by_rating(v, req.low, req.high, page, out); break;
+            case REQ_BFS:
+            case REQ_DFS: {
+                int start = v.find_title(req.text);
+                if (start == -1) out << "Movie not found.\n";
+                else if (req.type == REQ_BFS) graph.recommend_bfs(v, start, req.number, out, deps);
+                else graph.recommend_dfs(v, start, req.number, out, deps);
+                break;
+            }
+            case REQ_PATH: {
+                int m1 = v.find_title(req.text);
+                int m2 = v.find_title(req.text2);
+                if (m1 != -1 && m2 != -1) graph.shortest_path(v, m1, m2, page, out, deps);
+                else out << "Movies not found.\n";
+                break;
+            }
+            case REQ_CONNECT: graph.connect_actors(v, req.text, req.text2, page, out, deps); break;
+            case REQ_COACTORS: co_actors(v, req.text, page, out); break;
+            case REQ_ANALYTICS: graph.show_analytics(v, out); break;
+            case REQ_CACHE_STATS:
+                cache.show_stats(out);
+                v.show_stats(out);
+                break;
+            case REQ_SIMILAR: {
+                int id = v.find_title(req.text);
+                const TitleOrder& o = v.title_order();
+                auto title_of = [&v, &o](int i) { return v.title(o.uid_at[i]); };
+                if (id != -1) print_similar(v.similarity(), o.pos_of[id], req.number, title_of, out);
+                else out << "Movie not found.\n";
+                break;
+            }
+            case REQ_PROFILE: {
+                const TitleOrder& o = v.title_order();
+                print_profile(v.similarity(), req.text, req.number, [&v, &o](int i) { return v.title(o.uid_at[i]); },
+                              out);
+                break;
+            }
+            case REQ_QUERY:
+            case REQ_EXPLAIN: {
+                VersionQuerySource src(v);
+                const TitleOrder& o = v.title_order();
+                QueryCursor found;
+                int id = 0;
+                if (!answer_compound(req, src, found, out)) break;
+                while (!page.full() && found.next(id)) {
+                    const MovieRecord* m = v.movie(o.uid_at[id]);
+                    if (page.take()) print_query_row(out, m->title, m->year, m->rating);
+                }
+                break;
+            }
+            default: break;
+        }
+        page.footer(out);
+    }
+
+    // Applies a batch file (see BatchPlan) as one write: removals, then edits, then inserts, all on one draft,
+    // published as one version
+    void apply_batch(CatalogWriter& w, const string& path, ostream& out) {
+        BatchPlan plan;
+        bool ok = plan.build(path, [&w](const string& title, MovieRow& row) {
+            int uid = w.find(title);
+            if (uid == -1) return false;
+            const MovieRecord* m = w.movie(uid);
+            row.title = m->title;
+            row.director = m->director_name();
+            row.year = m->year;
+            row.rating = m->rating;
+            row.duration = m->duration;
+            for (int i = 0; i < m->actor_count; i++) row.cast.insert(m->actor(i));
+            for (int i = 0; i < m->genre_count; i++) row.genres.insert(m->genre(i));
+            return true;
+        }, [](const MovieRow&) { return true; }, out);
+        if (!ok) return;
+
+        for (int i = 0; i < plan.removals.size(); i++) w.remove(w.find(plan.removals[i]));
+        for (int i = 0; i < plan.edits.size(); i++) {
+            w.set_fields(w.find(plan.edits[i].title), plan.edits[i].year, plan.edits[i].rating);
+        }
+        for (int i = 0; i < plan.inserts.size(); i++) w.add(*plan.inserts[i], true);
+        plan.report(out);
+    }
+
+    // Everything is read from one version, so the report does not wait for writers
+    void memory_report(ostream& out) {
+        ReadGuard v(versions);
+        MemoryReport r;
+        names.account(r);
+        v->account(r);
+        cache.account(r);
+        r.print(out, v->size());
+    }
+
+    void run_write(CatalogWriter& w, const Request& req, ostream& out) {
+        switch (req.type) {
+            case REQ_SET_RATING: {
+                int uid = w.find(req.text);
+                if (uid != -1) {
+                    w.set_fields(uid, w.movie(uid)->year, req.low);
+                    out << "Rating for '" << w.movie(uid)->title << "' updated to " << req.low << "/10" << endl;
+                } else out << "Not found.\n";
+                break;
+            }
+            case REQ_DELETE: {
+                int uid = w.find(req.text);
+                if (uid == -1) {
+                    out << "Movie not found.\n";
+                    break;
+                }
+                w.remove(uid);
+                out << "Movie '" << req.text << "' deleted.\n";
+                break;
+            }
+            case REQ_ADD: add_movie(w, req.text, out); break;
+            case REQ_BATCH: apply_batch(w, req.text, out); break;
+            default: break;
+        }
+    }
+
+public:
+    // lazy_graph: index without graph links and build them all at once before the first graph request
+    MovieEngine(bool compact_mode = false, bool lazy_graph = false)
+        : published(0), cache(cache_budget), compact(compact_mode), unlinked(lazy_graph) {}
+
+    void load(string fname) {
+        lock_guard<mutex> guard(write_lock);
+        tail.set_file(fname);
+        write(true, [this](CatalogWriter& w) { load_data(tail, w, !unlinked); });
+    }
+
+    int ingest(ostream& out) {
+        lock_guard<mutex> guard(write_lock);
+        LoadCounts counts;
+        CsvTail::Status status;
+        write(true, [&](CatalogWriter& w) { status = load_rows(tail, w, !unlinked, counts); });
+        return tail.report(status, counts, out);
+    }
+
+    void execute(const Request& req, ostream& out) {
+        // Deferred links are replayed on the catalog as it was indexed, so they are built before a delete or
+        // batch too
+        if (unlinked && (uses_links(req.type) || req.type == REQ_DELETE || req.type == REQ_BATCH)) {
+            lock_guard<mutex> guard(write_lock);
+            if (unlinked) {
+                write(true, [](CatalogWriter& w) { w.link_all(); });
+                unlinked = false;
+            }
+        }
+        if (req.type == REQ_INGEST) {
+            ingest(out);
+        } else if (req.type == REQ_MEMORY) {
+            memory_report(out);
+        } else if (is_write(req.type)) {
+            lock_guard<mutex> guard(write_lock);
+            write(req.type != REQ_SET_RATING, [&](CatalogWriter& w) { run_write(w, req, out); });
+        } else if (QueryCache::cacheable(req.type)) {
+            ReadGuard v(versions);
+            string key = QueryCache::make_key(req);
+            string answer;
+            if (!cache.lookup(key, answer)) {
+                stringstream ss;
+                QueryDeps deps;
+                run_read(*v, req, ss, &deps);
+                answer = ss.str();
+                cache.insert(key, answer, req, deps, v->number);
+            }
+            out << answer;
+        } else {
+            ReadGuard v(versions);
+            run_read(*v, req, out, nullptr);
+        }
+    }
+
+    // Reads the current rating of a movie (used by the menu before asking for the new one)
+    bool current_rating(const string& title, float& r) {
+        ReadGuard v(versions);
+        int uid = v->find_title(title);
+        if (uid == -1) return false;
+        r = v->movie(uid)->rating;
+        return true;
+    }
+};
+
+// Byte helpers for the page file: page fields are little-endian, numbers inside tree keys and values are
+// big-endian so that they sort in numeric order
+void put_u16(unsigned char* p, int v) {
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)((v >> 8) & 0xff);
+}
+
+int get_u16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+
+void put_u32(unsigned char* p, unsigned int v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)((v >> (8 * i)) & 0xff);
+}
+
+unsigned int get_u32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+string be32(unsigned int v) {
+    string s(4, '\0');
+    for (int i = 0; i < 4; i++) s[i] = (char)((v >> (24 - 8 * i)) & 0xff);
+    return s;
+}
+
+unsigned int get_be32(const string& s, size_t at = 0) {
+    const unsigned char* p = (const unsigned char*)s.data() + at;
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+bool has_prefix(const string& s, const string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Buffer Pool
+// Keeps a fixed number of pages of one file in memory, so memory use does not grow with the file.
+// A page is pinned while it is read or changed; unpinned pages are replaced in clock order (a changed page is
+// written back first). The frame table and the file IO are guarded by one mutex; pinned bytes are not.
+class BufferPool {
+public:
+    static const int page_size = 4096;
+
+private:
+    struct Frame {
+        unsigned int page;
+        int pins;
+        bool used;
+        bool dirty;
+        bool referenced; // Clock bit: set on every pin, cleared when the hand passes
+        int chain;       // Next frame in the same hash bucket (-1 = end)
+        unsigned char* data;
+    };
+
+    int fd;
+    Frame* frames;
+    int frame_count;
+    unsigned char* memory;
+    int* buckets;       // Page number hash -> first frame (-1 = empty)
+    int bucket_mask;
+    int hand;
+    unsigned int pages; // Pages in the file, including new ones not written back yet
+    long long hits, misses, reads, writes;
+    mutex lock;
+    condition_variable frame_free;
+
+    int bucket_of(unsigned int page) const { return (int)((page * 2654435761u) & (unsigned int)bucket_mask); }
+
+    int lookup(unsigned int page) const {
+        for (int f = buckets[bucket_of(page)]; f != -1; f = frames[f].chain) {
+            if (frames[f].page == page) return f;
+        }
+        return -1;
+    }
+
+    void write_back(Frame& fr) {
+        if (pwrite(fd, fr.data, page_size, (off_t)fr.page * page_size) != page_size) {
+            cout << "Disk write failed: " << strerror(errno) << endl;
+        }
+        writes++;
+        fr.dirty = false;
+    }
+
+    // Next frame that can take a page (empty, or unpinned and not recently used), -1 if all are pinned
+    int victim() {
+        for (int step = 0; step < 2 * frame_count; step++) {
+            int f = hand;
+            hand = (hand + 1) % frame_count;
+            Frame& fr = frames[f];
+            if (!fr.used) return f;
+            if (fr.pins > 0) continue;
+            if (fr.referenced) {
+                fr.referenced = false;
+                continue;
+            }
+            return f;
+        }
+        return -1;
+    }
+
+    // Gives frame f to page (writing back what it held before); the frame comes back pinned once
+    void install(int f, unsigned int page) {
+        Frame& fr = frames[f];
+        if (fr.used) {
+            if (fr.dirty) write_back(fr);
+            int* link = &buckets[bucket_of(fr.page)];
+            while (*link != f) link = &frames[*link].chain;
+            *link = fr.chain;
+        }
+        int b = bucket_of(page);
+        fr.page = page;
+        fr.pins = 1;
+        fr.used = true;
+        fr.dirty = false;
+        fr.referenced = true;
+        fr.chain = buckets[b];
+        buckets[b] = f;
+    }
+
+    // Waits until some frame can be replaced (lock held)
+    int take_frame(unique_lock<mutex>& held) {
+        int f;
+        while ((f = victim()) == -1) frame_free.wait(held);
+        return f;
+    }
+
+public:
+    BufferPool(int frame_total) : fd(-1), frame_count(frame_total), hand(0), pages(0),
+                                  hits(0), misses(0), reads(0), writes(0) {
+        frames = new Frame[frame_count];
+        memory = new unsigned char[(size_t)frame_count * page_size];
+        for (int f = 0; f < frame_count; f++) {
+            frames[f].page = 0;
+            frames[f].pins = 0;
+            frames[f].used = false;
+            frames[f].dirty = false;
+            frames[f].referenced = false;
+            frames[f].chain = -1;
+            frames[f].data = memory + (size_t)f * page_size;
+        }
+        int bucket_total = 1;
+        while (bucket_total < 2 * frame_count) bucket_total *= 2;
+        buckets = new int[bucket_total];
+        for (int b = 0; b < bucket_total; b++) buckets[b] = -1;
+        bucket_mask = bucket_total - 1;
+    }
+
+    ~BufferPool() {
+        if (fd != -1) {
+            flush();
+            close(fd);
+        }
+        delete[] frames;
+        delete[] memory;
+        delete[] buckets;
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    bool open(const string& path) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) return false;
+        off_t size = lseek(fd, 0, SEEK_END);
+        pages = (size > 0) ? (unsigned int)(size / page_size) : 0;
+        return true;
+    }
+
+    unsigned int page_total() const { return pages; }
+
+    // Pins an existing page and returns its bytes (release with unpin)
+    unsigned char* pin(unsigned int page) {
+        unique_lock<mutex> held(lock);
+        while (true) {
+            int f = lookup(page);
+            if (f != -1) {
+                hits++;
+                frames[f].pins++;
+                frames[f].referenced = true;
+                return frames[f].data;
+            }
+            f = victim();
+            if (f == -1) {
+                frame_free.wait(held); // Another thread may load the page meanwhile, so look again
+                continue;
+            }
+            misses++;
+            install(f, page);
+            if (pread(fd, frames[f].data, page_size, (off_t)page * page_size) != page_size) {
+                memset(frames[f].data, 0, page_size);
+            }
+            reads++;
+            return frames[f].data;
+        }
+    }
+
+    void unpin(unsigned int page, bool dirty) {
+        lock_guard<mutex> guard(lock);
+        Frame& fr = frames[lookup(page)];
+        if (dirty) fr.dirty = true;
+        if (--fr.pins == 0) frame_free.notify_all();
+    }
+
+    // Appends a zeroed page to the file and returns its number
+    unsigned int allocate() {
+        unique_lock<mutex> held(lock);
+        unsigned int page = pages++;
+        int f = take_frame(held);
+        install(f, page);
+        memset(frames[f].data, 0, page_size);
+        frames[f].dirty = true;
+        frames[f].pins = 0;
+        frame_free.notify_all();
+        return page;
+    }
+
+    // Writes every changed page back and waits until the file is on disk
+    void flush() {
+        lock_guard<mutex> guard(lock);
+        for (int f = 0; f < frame_count; f++) {
+            if (frames[f].used && frames[f].dirty) write_back(frames[f]);
+        }
+        fsync(fd);
+    }
+
+    // Frames, page memory and the page hash (fixed at construction)
+    void account(MemoryReport& r) const {
+        int p = r.part("Buffer pool", "pages");
+        r.add(p, (long long)frame_count * (sizeof(Frame) + page_size) + (long long)(bucket_mask + 1) * sizeof(int), 3);
+        r.count(p, frame_count);
+    }
+
+    void show_stats(ostream& out) {
+        lock_guard<mutex> guard(lock);
+        int in_use = 0;
+        for (int f = 0; f < frame_count; f++) if (frames[f].used) in_use++;
+        long long total = hits + misses;
+        out << "\n--- Buffer Pool ---\n";
+        out << "Frames: " << in_use << "/" << frame_count << " in use (" << page_size << " byte pages)\n";
+        out << "File: " << pages << " pages (" << (long long)pages * page_size / 1024 << " KB)\n";
+        out << "Hits: " << hits << " | Misses: " << misses;
+        if (total > 0) out << " | Hit rate: " << (100.0 * hits / total) << "%";
+        out << "\n";
+        out << "Page reads: " << reads << " | Page writes: " << writes << "\n";
+    }
+};
+
+// Pins one page for the lifetime of the handle
+class PageRef {
+    BufferPool& pool;
+    unsigned int page;
+    unsigned char* bytes;
+    bool dirty;
+
+public:
+    PageRef(BufferPool& p, unsigned int id) : pool(p), page(id), bytes(p.pin(id)), dirty(false) {}
+    ~PageRef() { pool.unpin(page, dirty); }
+    PageRef(const PageRef&) = delete;
+    PageRef& operator=(const PageRef&) = delete;
+
+    unsigned char* data() { return bytes; }
+    void mark_dirty() { dirty = true; }
+};
+
+// B+ Tree
+// Ordered map from byte-string keys to byte-string values, stored in BufferPool pages.
+// Page layout: [type u8][unused u8][count u16][cell_start u16][unused u16][link u32][slot u16 x count] ... cells
+// Slots hold the offsets of the cells in key order; cells fill the page from the end and are
+// [key_len u16][value_len u16][key][value]. In an inner page each cell's value is the child page holding keys
+// >= its key, and link is the child for keys below the first one; in a leaf, link is the next leaf (0 = none).
+// Erasing never merges pages: an emptied leaf stays in the chain and scans skip it.
+class BTree {
+public:
+    static const int max_key = 512;
+    static const int max_value = 1024;
+
+    // Forward scan over the leaf chain
+    class Cursor {
+        BufferPool* pool;
+        unsigned int page;
+        int slot;
+        bool ok;
+        string k;
+        string v;
+
+        // Moves to the entry at slot, or the first one after it
+        void settle() {
+            ok = false;
+            while (page != 0) {
+                PageRef ref(*pool, page);
+                const unsigned char* p = ref.data();
+                if (slot < count(p)) {
+                    const unsigned char* c = cell(p, slot);
+                    k = cell_key(c);
+                    v = cell_value(c);
+                    ok = true;
+                    return;
+                }
+                page = link(p);
+                slot = 0;
+            }
+        }
+
+    public:
+        Cursor(BufferPool* p, unsigned int leaf, int at) : pool(p), page(leaf), slot(at), ok(false) { settle(); }
+
+        bool valid() const { return ok; }
+        const string& key() const { return k; }
+        const string& value() const { return v; }
+        void next() {
+            slot++;
+            settle();
+        }
+    };
+
+private:
+    static const unsigned char leaf_type = 1;
+    static const unsigned char inner_type = 2;
+    static const int header_size = 12;
+    static const int page_size = BufferPool::page_size;
+
+    struct Entry {
+        string key;
+        string value;
+    };
+
+    BufferPool& pool;
+    unsigned int root;
+
+    static int count(const unsigned char* p) { return get_u16(p + 2); }
+    static unsigned int link(const unsigned char* p) { return get_u32(p + 8); }
+    static const unsigned char* cell(const unsigned char* p, int i) { return p + get_u16(p + header_size + 2 * i); }
+    static int cell_size(const unsigned char* c) { return 4 + get_u16(c) + get_u16(c + 2); }
+    static string cell_key(const unsigned char* c) { return string((const char*)c + 4, get_u16(c)); }
+    static string cell_value(const unsigned char* c) { return string((const char*)c + 4 + get_u16(c), get_u16(c + 2)); }
+    static int free_space(const unsigned char* p) { return get_u16(p + 4) - (header_size + 2 * count(p)); }
+
+    static unsigned int child(const unsigned char* p, int i) {
+        const unsigned char* c = cell(p, i);
+        return get_be32(string((const char*)c + 4 + get_u16(c), 4));
+    }
+
+    // Byte-wise comparison of a cell's key with key (like string::compare)
+    static int compare(const unsigned char* c, const string& key) {
+        int len = get_u16(c);
+        int n = (len < (int)key.size()) ? len : (int)key.size();
+        int r = memcmp(c + 4, key.data(), n);
+        if (r != 0) return r;
+        return len - (int)key.size();
+    }
+
+    // First slot whose key is >= key (> key if strict)
+    static int search(const unsigned char* p, const string& key, bool strict) {
+        int lo = 0, hi = count(p);
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            int r = compare(cell(p, mid), key);
+            if (r < 0 || (strict && r == 0)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    static void init_node(unsigned char* p, unsigned char type, unsigned int link_page) {
+        memset(p, 0, header_size);
+        p[0] = type;
+        put_u16(p + 4, page_size);
+        put_u32(p + 8, link_page);
+    }
+
+    // Rewrites the cells back to back at the end of the page, dropping the space of erased cells
+    static void compact(unsigned char* p) {
+        unsigned char buf[page_size];
+        int top = page_size;
+        for (int i = 0; i < count(p); i++) {
+            const unsigned char* c = cell(p, i);
+            int size = cell_size(c);
+            top -= size;
+            memcpy(buf + top, c, size);
+            put_u16(p + header_size + 2 * i, top);
+        }
+        memcpy(p + top, buf + top, page_size - top);
+        put_u16(p + 4, top);
+    }
+
+    // Puts a cell at slot pos, false if the page is too full even after compacting
+    static bool insert_cell(unsigned char* p, int pos, const string& key, const string& value) {
+        int size = 4 + (int)key.size() + (int)value.size();
+        if (free_space(p) < size + 2) {
+            int live = 0;
+            for (int i = 0; i < count(p); i++) live += cell_size(cell(p, i));
+            if (page_size - header_size - 2 * count(p) - live < size + 2) return false;
+            compact(p);
+        }
+        int n = count(p);
+        int top = get_u16(p + 4) - size;
+        unsigned char* c = p + top;
+        put_u16(c, (int)key.size());
+        put_u16(c + 2, (int)value.size());
+        memcpy(c + 4, key.data(), key.size());
+        memcpy(c + 4 + key.size(), value.data(), value.size());
+        unsigned char* slots = p + header_size;
+        memmove(slots + 2 * (pos + 1), slots + 2 * pos, 2 * (n - pos));
+        put_u16(slots + 2 * pos, top);
+        put_u16(p + 2, n + 1);
+        put_u16(p + 4, top);
+        return true;
+    }
+
+    static void erase_cell(unsigned char* p, int pos) {
+        int n = count(p);
+        unsigned char* slots = p + header_size;
+        memmove(slots + 2 * pos, slots + 2 * (pos + 1), 2 * (n - pos - 1));
+        put_u16(p + 2, n - 1);
+    }
+
+    // Page bytes an entry takes: its cell and its slot
+    static int entry_bytes(const Entry& e) { return 4 + (int)e.key.size() + (int)e.value.size() + 2; }
+
+    // Writes e[from, to) into an empty page; false if they do not fit
+    static bool fill(unsigned char* p, unsigned char type, unsigned int link_page, const my_array<Entry>& e,
+                     int from, int to) {
+        init_node(p, type, link_page);
+        for (int i = from; i < to; i++) {
+            if (!insert_cell(p, i - from, e[i].key, e[i].value)) return false;
+        }
+        return true;
+    }
+
+    // Where to split n entries: the most even cut for which both pages fit. A leaf keeps e[0, mid) and moves
+    // e[mid, n) right; an inner page passes e[mid] up and moves e[mid + 1, n) right. A cut always exists: the
+    // entries of a full page plus one more exceed a page by less than one maximum entry.
+    static int split_point(const my_array<Entry>& e, bool leaf) {
+        const int room = page_size - header_size;
+        int n = e.size();
+        int total = 0;
+        for (int i = 0; i < n; i++) total += entry_bytes(e[i]);
+        int best = -1, best_larger = 0, left = 0;
+        for (int mid = 1; mid < (leaf ? n : n - 1); mid++) {
+            left += entry_bytes(e[mid - 1]);
+            int right = total - left - (leaf ? 0 : entry_bytes(e[mid]));
+            int larger = get_max(left, right);
+            if (left <= room && right <= room && (best == -1 || larger < best_larger)) {
+                best = mid;
+                best_larger = larger;
+            }
+        }
+        return best;
+    }
+
+    // Splits a full page that should take (key, value) at slot pos. The upper part moves to a new right page;
+    // sep is the first key of the right page (an inner page passes its middle key up instead of keeping it).
+    void split(PageRef& ref, int pos, const string& key, const string& value, string& sep, unsigned int& right) {
+        unsigned char* p = ref.data();
+        bool leaf = p[0] == leaf_type;
+        my_array<Entry> all;
+        for (int i = 0; i <= count(p); i++) {
+            Entry e;
+            if (i == pos) {
+                e.key = key;
+                e.value = value;
+                all.push(e);
+            }
+            if (i == count(p)) break;
+            e.key = cell_key(cell(p, i));
+            e.value = cell_value(cell(p, i));
+            all.push(e);
+        }
+        int n = all.size();
+        int mid = split_point(all, leaf);
+        if (mid == -1) overflow();
+
+        right = pool.allocate();
+        PageRef rref(pool, right);
+        sep = all[mid].key;
+        bool ok;
+        if (leaf) {
+            ok = fill(rref.data(), leaf_type, link(p), all, mid, n) && fill(p, leaf_type, right, all, 0, mid);
+        } else {
+            ok = fill(rref.data(), inner_type, get_be32(all[mid].value), all, mid + 1, n) &&
+                 fill(p, inner_type, link(p), all, 0, mid);
+        }
+        if (!ok) overflow();
+        rref.mark_dirty();
+        ref.mark_dirty();
+    }
+
+    // A split that cannot place every entry would lose data in the file, so it stops the program instead
+    static void overflow() {
+        cout << "B+ tree page overflow (entry larger than the page format allows)." << endl;
+        exit(1);
+    }
+
+    // Inserts into the subtree at page; returns true if the page split (see split)
+    bool put_rec(unsigned int page, const string& key, const string& value, string& sep, unsigned int& right) {
+        PageRef ref(pool, page);
+        unsigned char* p = ref.data();
+        if (p[0] == leaf_type) {
+            int pos = search(p, key, false);
+            if (pos < count(p) && compare(cell(p, pos), key) == 0) erase_cell(p, pos);
+            ref.mark_dirty();
+            if (insert_cell(p, pos, key, value)) return false;
+            split(ref, pos, key, value, sep, right);
+            return true;
+        }
+        int pos = search(p, key, true);
+        unsigned int next = (pos == 0) ? link(p) : child(p, pos - 1);
+        string child_sep;
+        unsigned int child_right;
+        if (!put_rec(next, key, value, child_sep, child_right)) return false;
+        ref.mark_dirty();
+        if (insert_cell(p, pos, child_sep, be32(child_right))) return false;
+        split(ref, pos, child_sep, be32(child_right), sep, right);
+        return true;
+    }
+
+    unsigned int leaf_for(const string& key) const {
+        unsigned int page = root;
+        while (true) {
+            PageRef ref(pool, page);
+            const unsigned char* p = ref.data();
+            if (p[0] == leaf_type) return page;
+            int pos = search(p, key, true);
+            page = (pos == 0) ? link(p) : child(p, pos - 1);
+        }
+    }
+
+public:
+    BTree(BufferPool& p) : pool(p), root(0) {}
+
+    // Starts an empty tree in a new page
+    void create() {
+        root = pool.allocate();
+        PageRef ref(pool, root);
+        init_node(ref.data(), leaf_type, 0);
+        ref.mark_dirty();
+    }
+
+    void attach(unsigned int root_page) { root = root_page; }
+    unsigned int root_page() const { return root; }
+
+    bool find(const string& key, string& value) const {
+        PageRef ref(pool, leaf_for(key));
+        const unsigned char* p = ref.data();
+        int pos = search(p, key, false);
+        if (pos == count(p) || compare(cell(p, pos), key) != 0) return false;
+        value = cell_value(cell(p, pos));
+        return true;
+    }
+
+    // Inserts or replaces (key up to max_key bytes, value up to max_value bytes)
+    void put(const string& key, const string& value) {
+        string sep;
+        unsigned int right;
+        if (!put_rec(root, key, value, sep, right)) return;
+        unsigned int top = pool.allocate();
+        PageRef ref(pool, top);
+        init_node(ref.data(), inner_type, root);
+        insert_cell(ref.data(), 0, sep, be32(right));
+        ref.mark_dirty();
+        root = top;
+    }
+
+    bool erase(const string& key) {
+        PageRef ref(pool, leaf_for(key));
+        unsigned char* p = ref.data();
+        int pos = search(p, key, false);
+        if (pos == count(p) || compare(cell(p, pos), key) != 0) return false;
+        erase_cell(p, pos);
+        ref.mark_dirty();
+        return true;
+    }
+
+    // Cursor at the first key >= key
+    Cursor seek(const string& key) const {
+        unsigned int page = leaf_for(key);
+        int pos;
+        {
+            PageRef ref(pool, page);
+            pos = search(ref.data(), key, false);
+        }
+        return Cursor(&pool, page, pos);
+    }
+};
+
+// Movie Data
+// A movie with its names as text: the record format of DiskEngine and what CatalogQueries reads from any engine
+struct MovieData {
+    string title;
+    string director;
+    int year;
+    float rating;
+    int duration;
+    my_array<string> actors;
+    my_array<string> genres;
+
+    MovieData() : year(0), rating(0.0f), duration(0) {}
+
+    static void put_text(string& out, const string& s) {
+        unsigned char len[2];
+        put_u16(len, (int)s.size());
+        out.append((const char*)len, 2);
+        out += s;
+    }
+
+    static string get_text(const string& in, size_t& at) {
+        int len = get_u16((const unsigned char*)in.data() + at);
+        string s = in.substr(at + 2, len);
+        at += 2 + len;
+        return s;
+    }
+
+    string encode() const {
+        string out = "";
+        put_text(out, title);
+        put_text(out, director);
+        unsigned int rating_bits;
+        memcpy(&rating_bits, &rating, 4);
+        out += be32((unsigned int)year) + be32(rating_bits) + be32((unsigned int)duration);
+        out += be32(actors.size());
+        for (int i = 0; i < actors.size(); i++) put_text(out, actors[i]);
+        out += be32(genres.size());
+        for (int i = 0; i < genres.size(); i++) put_text(out, genres[i]);
+        return out;
+    }
+
+    void decode(const string& in) {
+        size_t at = 0;
+        title = get_text(in, at);
+        director = get_text(in, at);
+        year = (int)get_be32(in, at);
+        unsigned int rating_bits = get_be32(in, at + 4);
+        memcpy(&rating, &rating_bits, 4);
+        duration = (int)get_be32(in, at + 8);
+        at += 12;
+        int n = (int)get_be32(in, at);
+        at += 4;
+        actors.clear();
+        for (int i = 0; i < n; i++) actors.push(get_text(in, at));
+        n = (int)get_be32(in, at);
+        at += 4;
+        genres.clear();
+        for (int i = 0; i < n; i++) genres.push(get_text(in, at));
+    }
+
+    static string join(const my_array<string>& list) {
+        string joined = "";
+        for (int i = 0; i < list.size(); i++) {
+            joined += list[i];
+            if (i + 1 < list.size()) joined += ", ";
+        }
+        return joined;
+    }
+
+    void show_details(ostream& out) const {
+        print_details(out, title, year, director, rating, join(actors), join(genres));
+    }
+
+    // True if the movie is indexed under the entity key in one of the types (see insert_movie)
+    bool indexed_under(int types, const string& key) const {
+        for (int i = 0; i < actors.size() && (types >> ENTITY_ACTOR & 1); i++) {
+            if (format_key(actors[i]) == key) return true;
+        }
+        for (int i = 0; i < genres.size() && (types >> ENTITY_GENRE & 1); i++) {
+            if (format_key(genres[i]) == key) return true;
+        }
+        return (types >> ENTITY_DIRECTOR & 1) && director.length() > 1 && format_key(director) == key;
+    }
+};
+
+// A title with its search key, for putting results into title order
+struct KeyedLine {
+    string key;
+    string line;
+    int id;
+    bool operator<(const KeyedLine& o) const { return key < o.key; }
+};
+
+// Receives the link list of one movie (see CatalogQueries::visit_links)
+class LinkVisitor {
+public:
+    virtual ~LinkVisitor() {}
+    virtual void visit(int id, const my_array<int>& nbrs) = 0;
+};
+
+template <typename Fn>
+class LinkLambda : public LinkVisitor {
+    Fn fn;
+public:
+    LinkLambda(Fn f) : fn(f) {}
+    void visit(int id, const my_array<int>& nbrs) { fn(id, nbrs); }
+};
+
+template <typename Fn>
+LinkLambda<Fn> link_visitor(Fn fn) { return LinkLambda<Fn>(fn); }
+
+// Catalog Queries
+// Requests for engines that keep movies as plain records and link lists rather than CatalogVersions (DiskEngine,
+// ShardedEngine). Movies are addressed by engine-defined ids below id_bound(); the engine supplies lookups and
+// link lists, and the searches here give the same answers in the same order as Graph.
+// Reads share rw; updates (run_write) hold it exclusively.
+class CatalogQueries : public CatalogEngine {
+protected:
+    shared_mutex rw;
+
+    // Cached analytics, indexed by id (valid while analysed == true, dropped when links change)
+    mutex analyse_lock;
+    atomic<bool> analysed;
+    float* rank;
+    int* comp;
+    AnalyticsReport report;
+
+    CsvTail tail; // Position in the dataset file (see ingest)
+
+    // Similarity signatures by title order: similar_ids[i] is the movie of signature i, similar_pos the reverse
+    // (by id); built on first use like the analytics
+    mutex similar_lock;
+    my_array<int> similar_ids;
+    int* similar_pos;
+    SimilarityIndex similar;
+
+    // Movies by year and rating for compound queries; built on first use, ratings also dropped by SETRATING
+    mutex range_lock;
+    RangeIndex years, ratings;
+
+    // Query source over the engine's records
+    class Source : public QuerySource {
+    private:
+        CatalogQueries& c;
+
+    public:
+        Source(CatalogQueries& engine) : c(engine) {}
+
+        int posting_count(int types, const string& key) {
+            my_array<int> found;
+            int total = 0;
+            for (int t = 0; t < entity_type_count; t++) {
+                if ((types >> t & 1) && c.entity_movies(t, key, found)) total += found.size();
+            }
+            return total;
+        }
+
+        void posting_ids(int types, const string& key, my_array<int>& out) {
+            my_array<int> found;
+            out.clear();
+            for (int t = 0; t < entity_type_count; t++) {
+                if (!(types >> t & 1) || !c.entity_movies(t, key, found)) continue;
+                for (int i = 0; i < found.size(); i++) out.push(found[i]);
+            }
+            out.sort_unique();
+        }
+
+        const RangeIndex& range(TermKind kind) { return c.range(kind); }
+
+        bool passes(int id, QueryTerm* const* terms, int count) {
+            MovieData m;
+            c.get_movie(id, m);
+            for (int i = 0; i < count; i++) {
+                const QueryTerm& t = *terms[i];
+                if (t.kind == TERM_ENTITY ? !m.indexed_under(t.types, t.key)
+                                          : !t.accepts(t.kind == TERM_YEAR ? (float)m.year : m.rating)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        int check_cost() const { return c.record_cost(); }
+    };
+
+    virtual int id_bound() const = 0;
+    virtual int find_id(const string& title) const = 0;
+    virtual void get_movie(int id, MovieData& m) const = 0;
+    virtual void neighbors(int id, my_array<int>& out) const = 0;
+    // Movies under a search key in the type's index, in the order they were indexed; false if the key was
+    // never indexed there
+    virtual bool entity_movies(int type, const string& key, my_array<int>& out) const = 0;
+    virtual void movies_by_title(my_array<int>& out) const = 0;
+    // Calls visit for every movie that has links, in any order
+    virtual void visit_links(LinkVisitor& visit) const = 0;
+    // Prints the LIST / YEAR / RATING lines (see match_line) of the page in title order
+    virtual void print_matches(const Request& req, ResultPage& page, ostream& out) const = 0;
+    virtual void show_stats(ostream& out) = 0;
+    // Adds the engine's own structures to the report (rw held shared); returns the number of movies
+    virtual int account(MemoryReport& r) = 0;
+    virtual void run_write(const Request& req, ostream& out) = 0;
+    // Stores a movie whose title is not taken yet, false if the engine cannot hold it
+    virtual bool insert_movie(const MovieRow& row) = 0;
+    // Whether insert_movie would accept the row (checked before a batch removes anything)
+    virtual bool can_store(const MovieRow&) const { return true; }
+    virtual void remove_movie(const string& t, ostream& out) = 0;
+    // Changes the year and rating of a stored movie (nothing indexed depends on them)
+    virtual void set_fields(int id, int year, float rating) = 0;
+
+    // Link lists of several movies at once (lists[i] for ids[i])
+    virtual void expand(const my_array<int>& ids, my_array<int>* lists) const {
+        for (int i = 0; i < ids.size(); i++) neighbors(ids[i], lists[i]);
+    }
+
+    // Cost of reading one record compared to one posting entry (see QuerySource::check_cost)
+    virtual int record_cost() const { return 8; }
+
+    // Output of one movie for LIST, YEAR and RATING requests ("" if it does not match)
+    static string match_line(const Request& req, const string& title, int year, float rating) {
+        stringstream line;
+        if (req.type == REQ_LIST_ALL) line << title << " (" << year << ")\n";
+        else if (req.type == REQ_YEAR && year == req.number) line << "- " << title << '\n';
+        else if (req.type == REQ_RATING && rating >= req.low && rating <= req.high) {
+            line << "- " << title << " [" << rating << "]\n";
+        }
+        return line.str();
+    }
+
+    // Movies of an entity search text over the default types (see entity_search)
+    bool find_entity(const string& text, int default_types, my_array<int>& out) const {
+        return entity_search(text, default_types, [this](int type, const string& k, my_array<int>& ids) {
+            return entity_movies(type, k, ids);
+        }, out);
+    }
+
+    string title_of(int id) const {
+        MovieData m;
+        get_movie(id, m);
+        return m.title;
+    }
+
+    // Drops what was computed from all movies at once: the analytics and the similarity signatures
+    void drop_derived() {
+        analysed = false;
+        delete[] rank;
+        delete[] comp;
+        rank = nullptr;
+        comp = nullptr;
+        similar.clear();
+        delete[] similar_pos;
+        similar_pos = nullptr;
+        years.clear();
+        ratings.clear();
+    }
+
+    // Movies ordered by year or rating; both are built in one pass over the records
+    const RangeIndex& range(TermKind kind) {
+        lock_guard<mutex> guard(range_lock);
+        if (!years.built() || !ratings.built()) {
+            my_array<int> ids;
+            movies_by_title(ids);
+            int n = ids.size();
+            float* year = new float[n > 0 ? n : 1];
+            float* rating = new float[n > 0 ? n : 1];
+            for (int i = 0; i < n; i++) {
+                MovieData m;
+                get_movie(ids[i], m);
+                year[i] = (float)m.year;
+                rating[i] = m.rating;
+            }
+            years.build(n, [&](int i, float& value, int& id) { value = year[i]; id = ids[i]; });
+            ratings.build(n, [&](int i, float& value, int& id) { value = rating[i]; id = ids[i]; });
+            delete[] year;
+            delete[] rating;
+        }
+        return (kind == TERM_YEAR) ? years : ratings;
+    }
+
+    // The engine's structures, then the derived ones that are built at the moment
+    void memory_report(ostream& out) {
+        MemoryReport r;
+        names.account(r);
+        int movies = account(r);
+        long long size = (id_bound() > 0) ? id_bound() : 1;
+        {
+            lock_guard<mutex> guard(analyse_lock);
+            if (analysed) r.add(r.part("Graph analytics"), size * (sizeof(int) + sizeof(float)), 2);
+        }
+        {
+            lock_guard<mutex> guard(similar_lock);
+            similar.account(r);
+            if (similar_pos) {
+                int p = r.part("Similarity signatures", "movies");
+                r.add_array(p, similar_ids);
+                r.add(p, size * sizeof(int));
+            }
+        }
+        {
+            lock_guard<mutex> guard(range_lock);
+            years.account(r);
+            ratings.account(r);
+        }
+        r.print(out, movies);
+    }
+
+    void compound_query(const Request& req, ResultPage& page, ostream& out) {
+        Source src(*this);
+        QueryCursor found;
+        if (!answer_compound(req, src, found, out)) return;
+        my_array<KeyedLine> lines;
+        int id = 0;
+        while (found.next(id)) {
+            MovieData m;
+            get_movie(id, m);
+            stringstream line;
+            print_query_row(line, m.title, m.year, m.rating);
+            KeyedLine item;
+            item.key = format_key(m.title);
+            item.line = line.str();
+            item.id = id;
+            lines.push(item);
+        }
+        heap_sort(lines.data(), lines.size());
+        for (int i = 0; i < lines.size() && !page.full(); i++) {
+            if (page.take()) out << lines[i].line;
+        }
+    }
+
+    const SimilarityIndex& similarity() {
+        lock_guard<mutex> guard(similar_lock);
+        if (similar_pos) return similar;
+        movies_by_title(similar_ids);
+        int size = (id_bound() > 0) ? id_bound() : 1;
+        similar_pos = new int[size];
+        for (int v = 0; v < size; v++) similar_pos[v] = -1;
+        for (int i = 0; i < similar_ids.size(); i++) similar_pos[similar_ids[i]] = i;
+        similar.build(similar_ids.size(), [this](int i, MovieSignature& sig) {
+            MovieData m;
+            get_movie(similar_ids[i], m);
+            for (int g = 0; g < m.genres.size(); g++) sig.add_genre(format_key(m.genres[g]));
+            for (int a = 0; a < m.actors.size(); a++) sig.add_person(format_key(m.actors[a]));
+            if (m.director.length() > 1) sig.add_person(format_key(m.director));
+        });
+        return similar;
+    }
+
+    // Level-by-level BFS from the sources. Stops after the first level that holds a target (returning the one
+    // first in title order) or once stop_count movies were reached; -1 if no target was reached.
+    // order lists the visited movies by level, level_start[d] is where level d begins (plus an end entry),
+    // parent[] (by id, -1 = not visited) leads back to a source.
+    int bfs(const int* sources, int source_count, const bool* is_target, int stop_count, my_array<int>& order,
+            my_array<int>& level_start, int* parent) const {
+        my_array<int> frontier, next;
+        for (int i = 0; i < source_count; i++) {
+            int s = sources[i];
+            if (parent[s] != -1) continue;
+            parent[s] = s;
+            frontier.push(s);
+        }
+        int hit = -1;
+        string hit_key = "";
+        level_start.push(0);
+        while (frontier.size() > 0) {
+            for (int i = 0; i < frontier.size(); i++) {
+                int v = frontier[i];
+                order.push(v);
+                if (is_target && is_target[v]) {
+                    string key = format_key(title_of(v));
+                    if (hit == -1 || key < hit_key) {
+                        hit = v;
+                        hit_key = key;
+                    }
+                }
+            }
+            level_start.push(order.size());
+            if (hit != -1) break;
+            if (stop_count >= 0 && order.size() >= stop_count) break;
+
+            my_array<int>* lists = new my_array<int>[frontier.size()];
+            expand(frontier, lists);
+            next.clear();
+            for (int i = 0; i < frontier.size(); i++) {
+                for (int j = 0; j < lists[i].size(); j++) {
+                    int w = lists[i][j];
+                    if (parent[w] == -1) {
+                        parent[w] = frontier[i];
+                        next.push(w);
+                    }
+                }
+            }
+            delete[] lists;
+            frontier.swap(next);
+        }
+        return hit;
+    }
+
+    int* new_parents() const {
+        int size = id_bound();
+        int* parent = new int[size > 0 ? size : 1];
+        for (int i = 0; i < size; i++) parent[i] = -1;
+        return parent;
+    }
+
+    bool* new_marks() const {
+        int size = id_bound();
+        bool* marks = new bool[size > 0 ? size : 1];
+        for (int i = 0; i < size; i++) marks[i] = false;
+        return marks;
+    }
+
+    void print_path(const int* parent, int id, ResultPage& page, ostream& out) const {
+        my_array<int> path;
+        while (true) {
+            path.push(id);
+            if (parent[id] == id) break;
+            id = parent[id];
+        }
+        print_steps(path, [this](int step) { return title_of(step); }, page, out);
+    }
+
+    // Same ordering as Graph::recommend_bfs: BFS levels, highest PageRank first within a level, ties in title order
+    void recommend_bfs(int start, int limit, ostream& out) {
+        analyse();
+        int* parent = new_parents();
+        my_array<int> order, level_start;
+        bfs(&start, 1, nullptr, limit + 1, order, level_start, parent);
+        delete[] parent;
+
+        out << "\n--- Top " << limit << " Recommendations for '" << title_of(start) << "' ---\n";
+        int count = 0;
+        for (int d = 1; d + 1 < level_start.size() && count < limit; d++) {
+            int size = level_start[d + 1] - level_start[d];
+            MovieData* level = new MovieData[size];
+            string* keys = new string[size];
+            int* ids = new int[size];
+            for (int i = 0; i < size; i++) {
+                ids[i] = order[level_start[d] + i];
+                get_movie(ids[i], level[i]);
+                keys[i] = format_key(level[i].title);
+            }
+            // Partial selection sort over indexes into the level
+            int* pick = new int[size];
+            for (int i = 0; i < size; i++) pick[i] = i;
+            for (int i = 0; i < size && count < limit; i++) {
+                int best = i;
+                for (int j = i + 1; j < size; j++) {
+                    float a = rank[ids[pick[j]]], b = rank[ids[pick[best]]];
+                    if (a > b || (a == b && keys[pick[j]] < keys[pick[best]])) best = j;
+                }
+                int p = pick[best];
+                pick[best] = pick[i];
+                pick[i] = p;
+                out << "-> " << level[p].title << " (" << level[p].rating << "/10)\n";
+                count++;
+            }
+            delete[] pick;
+            delete[] ids;
+            delete[] keys;
+            delete[] level;
+        }
+        if (count == 0) out << "No related movies found.\n";
+    }
+
+    void recommend_dfs(int start, int limit, ostream& out) const {
+        bool* visited = new_marks();
+        my_stack<int> s;
+        s.push(start);
+        visited[start] = true;
+
+        out << "\n--- DFS Recommendation for '" << title_of(start) << "' ---\n";
+        int count = 0;
+        my_array<int> nbrs;
         while (!s.empty()) {
-            MovieNode* curr = s.pop();
-            
+            int curr = s.pop();
             if (curr != start) {
-                cout << "-> " << curr->title << "\n";
+                out << "-> " << title_of(curr) << "\n";
                 count++;
             }
             if (count >= limit) break;
 
-            list_node<MovieNode*>* n_ptr = curr->neighbors.head;
-            while (n_ptr) {
-                MovieNode* neighbor = n_ptr->data;
-                if (neighbor && !neighbor->visited) {
-                    neighbor->visited = true;
-                    s.push(neighbor);
-                }
-                n_ptr = n_ptr->next;
+            neighbors(curr, nbrs);
+            for (int i = 0; i < nbrs.size(); i++) {
+                if (!visited[nbrs[i]]) {
+                    visited[nbrs[i]] = true;
+                    s.push(nbrs[i]);
+                }
+            }
+        }
+        delete[] visited;
+    }
+
+    void shortest_path(int start, int end, ResultPage& page, ostream& out) const {
+        if (analysed && comp[start] != comp[end]) {
+            out << "\nNo connection found.\n";
+            return;
+        }
+        bool* is_target = new_marks();
+        is_target[end] = true;
+
+        int* parent = new_parents();
+        my_array<int> order, level_start;
+        int hit = bfs(&start, 1, is_target, -1, order, level_start, parent);
+        delete[] is_target;
+
+        if (hit != -1) {
+            out << "\n--- Shortest Connection Path ---\n";
+            print_path(parent, hit, page, out);
+            out << '\n';
+        } else {
+            out << "\nNo connection found.\n";
+        }
+        delete[] parent;
+    }
+
+    void connect_actors(const string& a1, const string& a2, ResultPage& page, ostream& out) const {
+        my_array<int> sources, found;
+        if (!find_entity(a1, person_entity, sources)) {
+            out << "Actor/Director 1 (" << a1 << ") not found.\n";
+            return;
+        }
+        bool* is_target = new_marks();
+        find_entity(a2, person_entity, found);
+        for (int i = 0; i < found.size(); i++) is_target[found[i]] = true;
+
+        int* parent = new_parents();
+        my_array<int> order, level_start;
+        int hit = bfs(sources.data(), sources.size(), is_target, -1, order, level_start, parent);
+        delete[] is_target;
+
+        if (hit != -1) {
+            out << "\n--- Connection Found! ---\n";
+            out << a1 << " is connected to " << a2 << " via:\n";
+            print_path(parent, hit, page, out);
+            out << " -> (Involved: " << a2 << ")\n";
+        } else {
+            out << "No connection found between these actors/directors.\n";
+        }
+        delete[] parent;
+    }
+
+    void co_actors(const string& name, ResultPage& page, ostream& out) const {
+        my_array<int> found;
+        if (!find_entity(name, 1 << ENTITY_ACTOR, found)) {
+            out << "Actor not found.\n";
+            return;
+        }
+        out << "\n--- Co-Actors of " << name << " ---\n";
+        string plain;
+        entity_types_of(name, 0, plain);
+        string key = format_key(plain);
+        my_array<string> printed;
+        for (int i = 0; i < found.size() && !page.full(); i++) {
+            MovieData m;
+            get_movie(found[i], m);
+            for (int a = 0; a < m.actors.size(); a++) {
+                if (format_key(m.actors[a]) != key && !printed.contains(m.actors[a])) {
+                    if (page.take()) out << m.actors[a] << ", ";
+                    printed.push(m.actors[a]);
+                }
+            }
+        }
+        out << '\n';
+    }
+
+    static int uf_find(int* uf, int v) {
+        while (uf[v] != v) {
+            uf[v] = uf[uf[v]]; // Path halving
+            v = uf[v];
+        }
+        return v;
+    }
+
+    // Same results as GraphAnalytics, computed in passes over the link lists instead of a CSR copy.
+    // Movies are visited in title order wherever the order shows in the output (labels, ties, float sums).
+    void analyse() {
+        lock_guard<mutex> guard(analyse_lock);
+        if (analysed) return;
+        int size = (id_bound() > 0) ? id_bound() : 1;
+        my_array<int> by_title;
+        movies_by_title(by_title);
+        int n = by_title.size();
+
+        int* deg = new int[size];
+        int* uf = new int[size];
+        for (int v = 0; v < size; v++) {
+            deg[v] = 0;
+            uf[v] = v;
+        }
+        long long edge_count = 0;
+        auto count_links = link_visitor([&](int v, const my_array<int>& nbrs) {
+            deg[v] = nbrs.size();
+            edge_count += nbrs.size();
+            for (int i = 0; i < nbrs.size(); i++) {
+                int a = uf_find(uf, v);
+                int b = uf_find(uf, nbrs[i]);
+                if (a != b) uf[(a < b) ? b : a] = (a < b) ? a : b;
+            }
+        });
+        visit_links(count_links);
+
+        AnalyticsReport r;
+        r.movies = n;
+        r.edge_count = edge_count;
+        comp = new int[size];
+        int* comp_size = new int[n > 0 ? n : 1];
+        int* label = new int[size];
+        for (int v = 0; v < size; v++) label[v] = -1;
+        for (int i = 0; i < n; i++) {
+            int v = by_title[i];
+            int root = uf_find(uf, v);
+            if (label[root] == -1) {
+                label[root] = r.comp_count;
+                comp_size[r.comp_count++] = 0;
+            }
+            comp[v] = label[root];
+            comp_size[comp[v]]++;
+            r.hist[GraphAnalytics::degree_bin(deg[v])]++;
+            r.max_degree = get_max(r.max_degree, deg[v]);
+        }
+        for (int c = 0; c < r.comp_count; c++) {
+            if (r.largest == -1 || comp_size[c] > r.largest) r.largest = comp_size[c];
+        }
+        delete[] label;
+        delete[] comp_size;
+        delete[] uf;
+
+        // PageRank: 20 pull iterations with damping 0.85; each movie's sum follows its link order
+        const float damping = 0.85f;
+        rank = new float[size];
+        float* next = new float[size];
+        for (int i = 0; i < n; i++) rank[by_title[i]] = 1.0f / n;
+        for (int it = 0; it < 20; it++) {
+            float dangling = 0.0f;
+            for (int i = 0; i < n; i++) {
+                if (deg[by_title[i]] == 0) dangling += rank[by_title[i]];
+            }
+            float base = (1.0f - damping) / n + damping * dangling / n;
+            for (int i = 0; i < n; i++) next[by_title[i]] = base;
+            const float* cur = rank;
+            auto pull = link_visitor([&](int v, const my_array<int>& nbrs) {
+                float sum = 0.0f;
+                for (int i = 0; i < nbrs.size(); i++) sum += cur[nbrs[i]] / deg[nbrs[i]];
+                next[v] = base + damping * sum;
+            });
+            visit_links(pull);
+            float* done = next;
+            next = rank;
+            rank = done;
+        }
+        delete[] next;
+
+        float* score = new float[n > 0 ? n : 1];
+        int top[AnalyticsReport::top_count];
+        for (int i = 0; i < n; i++) score[i] = (float)deg[by_title[i]];
+        r.hubs = top_k_scores(score, n, AnalyticsReport::top_count, top);
+        for (int i = 0; i < r.hubs; i++) {
+            r.hub_title[i] = title_of(by_title[top[i]]);
+            r.hub_links[i] = deg[by_title[top[i]]];
+        }
+        for (int i = 0; i < n; i++) score[i] = rank[by_title[i]];
+        r.centrals = top_k_scores(score, n, AnalyticsReport::top_count, top);
+        for (int i = 0; i < r.centrals; i++) {
+            r.central_title[i] = title_of(by_title[top[i]]);
+            r.central_rank[i] = score[top[i]];
+        }
+        delete[] score;
+        delete[] deg;
+        report = r;
+        analysed = true;
+    }
+
+    RowResult store_row(const MovieRow& row) {
+        if (find_id(row.title) != -1) return ROW_DUPLICATE;
+        return insert_movie(row) ? ROW_ADDED : ROW_SKIPPED;
+    }
+
+    // Reads the CSV with the same checks and counts as load_data (rw held exclusively)
+    void load_rows(const string& fname) {
+        tail.set_file(fname);
+        if (!tail.readable()) {
+            cout << "Could not open " << fname << endl;
+            return;
+        }
+
+        cout << "Loading dataset... ";
+        LoadCounts counts;
+        tail.read_rows(counts, [&](const MovieRow& row) { return store_row(row); });
+
+        cout << "Finished Loading!\n";
+        counts.print(cout, "Loaded");
+    }
+
+    // Called after an ingest, with rw still held
+    virtual void ingest_done() {}
+
+    // Applies a batch file (see BatchPlan) through the engine's single-movie steps, all under one exclusive
+    // hold of rw, so the derived caches are dropped and (in disk mode) the file is written once
+    void apply_batch(const string& path, ostream& out) {
+        BatchPlan plan;
+        bool ok = plan.build(path, [this](const string& title, MovieRow& row) {
+            int id = find_id(title);
+            if (id == -1) return false;
+            MovieData m;
+            get_movie(id, m);
+            row.title = m.title;
+            row.director = m.director;
+            row.year = m.year;
+            row.rating = m.rating;
+            row.duration = m.duration;
+            for (int i = 0; i < m.actors.size(); i++) row.cast.insert(m.actors[i]);
+            for (int i = 0; i < m.genres.size(); i++) row.genres.insert(m.genres[i]);
+            return true;
+        }, [this](const MovieRow& row) { return can_store(row); }, out);
+        if (!ok) return;
+        stringstream quiet;
+        for (int i = 0; i < plan.removals.size(); i++) remove_movie(plan.removals[i], quiet);
+        for (int i = 0; i < plan.edits.size(); i++) {
+            set_fields(find_id(plan.edits[i].title), plan.edits[i].year, plan.edits[i].rating);
+        }
+        for (int i = 0; i < plan.inserts.size(); i++) {
+            if (insert_movie(*plan.inserts[i])) continue;
+            out << "Movie '" << plan.inserts[i]->title << "' is too large for disk storage.\n";
+            plan.errors++;
+        }
+        plan.report(out);
+    }
+
+    void run_read(const Request& req, ostream& out) {
+        ResultPage page(req);
+        switch (req.type) {
+            case REQ_LIST_ALL: print_matches(req, page, out); break;
+            case REQ_TITLE: {
+                int id = find_id(req.text);
+                if (id != -1) {
+                    MovieData m;
+                    get_movie(id, m);
+                    m.show_details(out);
+                } else out << "Not found.\n";
+                break;
+            }
+            case REQ_ENTITY: {
+                my_array<int> found;
+                if (find_entity(req.text, any_entity, found)) {
+                    out << "\n--- Results ---\n";
+                    for (int i = 0; i < found.size() && !page.full(); i++) {
+                        if (page.take()) out << "- " << title_of(found[i]) << '\n';
+                    }
+                } else out << "No matches found.\n";
+                break;
+            }
+            case REQ_YEAR:
+                out << "\n--- Movies from " << req.number << " ---\n";
+                print_matches(req, page, out);
+                if (page.rows() == 0) out << "None found.\n";
+                break;
+            case REQ_RATING:
+                out << "\n--- Movies rated " << req.low << " to " << req.high << " ---\n";
+                print_matches(req, page, out);
+                if (page.rows() == 0) out << "None found.\n";
+                break;
+            case REQ_BFS:
+            case REQ_DFS: {
+                int start = find_id(req.text);
+                if (start == -1) out << "Movie not found.\n";
+                else if (req.type == REQ_BFS) recommend_bfs(start, req.number, out);
+                else recommend_dfs(start, req.number, out);
+                break;
+            }
+            case REQ_PATH: {
+                int m1 = find_id(req.text);
+                int m2 = find_id(req.text2);
+                if (m1 != -1 && m2 != -1) shortest_path(m1, m2, page, out);
+                else out << "Movies not found.\n";
+                break;
+            }
+            case REQ_CONNECT: connect_actors(req.text, req.text2, page, out); break;
+            case REQ_COACTORS: co_actors(req.text, page, out); break;
+            case REQ_ANALYTICS:
+                analyse();
+                report.print(out);
+                break;
+            case REQ_CACHE_STATS: show_stats(out); break;
+            case REQ_MEMORY: memory_report(out); break;
+            case REQ_SIMILAR: {
+                int id = find_id(req.text);
+                if (id == -1) {
+                    out << "Movie not found.\n";
+                    break;
+                }
+                const SimilarityIndex& sim = similarity();
+                print_similar(sim, similar_pos[id], req.number, [this](int i) { return title_of(similar_ids[i]); }, out);
+                break;
+            }
+            case REQ_PROFILE:
+                print_profile(similarity(), req.text, req.number, [this](int i) { return title_of(similar_ids[i]); }, out);
+                break;
+            case REQ_QUERY:
+            case REQ_EXPLAIN: compound_query(req, page, out); break;
+            default: break;
+        }
+        page.footer(out);
+    }
+
+public:
+    CatalogQueries() : analysed(false), rank(nullptr), comp(nullptr), similar_pos(nullptr) {}
+
+    ~CatalogQueries() {
+        delete[] rank;
+        delete[] comp;
+        delete[] similar_pos;
+    }
+
+    int ingest(ostream& out) {
+        unique_lock<shared_mutex> guard(rw);
+        LoadCounts counts;
+        CsvTail::Status status = tail.read_rows(counts, [&](const MovieRow& row) { return store_row(row); });
+        if (counts.count > 0) drop_derived();
+        ingest_done();
+        return tail.report(status, counts, out);
+    }
+
+    void execute(const Request& req, ostream& out) {
+        if (req.type == REQ_INGEST) {
+            ingest(out);
+        } else if (is_write(req.type)) {
+            unique_lock<shared_mutex> guard(rw);
+            run_write(req, out);
+            if (req.type != REQ_SET_RATING) drop_derived();
+            else ratings.clear();
+        } else {
+            shared_lock<shared_mutex> guard(rw);
+            run_read(req, out);
+        }
+    }
+
+    bool current_rating(const string& title, float& r) {
+        shared_lock<shared_mutex> guard(rw);
+        int id = find_id(title);
+        if (id == -1) return false;
+        MovieData m;
+        get_movie(id, m);
+        r = m.rating;
+        return true;
+    }
+};
+
+// Disk Engine
+// Keeps the catalog in a page file (through a BufferPool) instead of memory, for catalogs larger than RAM.
+// Memory use is the pool plus per-request arrays indexed by movie id. The catalog is six B+Trees:
+//   records:  mid -> MovieData                titles:      search key -> mid
+//   postings: entity key, seq -> mid          posting_set: entity key, mid -> seq
+//   links:    mid, seq -> neighbor mid        link_set:    mid, neighbor mid -> seq
+// mid is a movie id that is never reused. seq comes from one global counter, so scans see postings and links in
+// the order they were made, like the id lists of the EntityPostings. Every indexed entity key also has a
+// marker posting with seq 0, which stays when its last movie goes (as an emptied PostingNode does).
+// Entity keys carry their type (see entity_key), so each type has its own postings.
+// Page 0 holds the file header. Updates flush the file before returning.
+class DiskEngine : public CatalogQueries {
+private:
+    static const int tree_count = 6;
+
+    string path;
+    BufferPool pool;
+    BTree records, titles, postings, posting_set, links, link_set;
+    unsigned int next_mid;
+    unsigned int next_seq;
+    int movie_count;
+    bool usable;
+
+    BTree* tree(int i) {
+        BTree* all[tree_count] = { &records, &titles, &postings, &posting_set, &links, &link_set };
+        return all[i];
+    }
+
+    // Header: "MDMDISK2", tree roots, next_mid, next_seq, movie_count, then the dataset position (see CsvTail):
+    // offset as two 32 bit halves, mark length and mark bytes
+    void save_header() {
+        PageRef head(pool, 0);
+        unsigned char* p = head.data();
+        memcpy(p, "MDMDISK2", 8);
+        for (int i = 0; i < tree_count; i++) put_u32(p + 8 + 4 * i, tree(i)->root_page());
+        put_u32(p + 32, next_mid);
+        put_u32(p + 36, next_seq);
+        put_u32(p + 40, (unsigned int)movie_count);
+        long long offset = tail.position();
+        put_u32(p + 44, (unsigned int)(offset & 0xffffffff));
+        put_u32(p + 48, (unsigned int)(offset >> 32));
+        put_u16(p + 52, (int)tail.last_bytes().size());
+        memcpy(p + 54, tail.last_bytes().data(), tail.last_bytes().size());
+        head.mark_dirty();
+    }
+
+    bool read_header() {
+        PageRef head(pool, 0);
+        const unsigned char* p = head.data();
+        if (memcmp(p, "MDMDISK2", 8) != 0) return false;
+        for (int i = 0; i < tree_count; i++) tree(i)->attach(get_u32(p + 8 + 4 * i));
+        next_mid = get_u32(p + 32);
+        next_seq = get_u32(p + 36);
+        movie_count = (int)get_u32(p + 40);
+        long long offset = get_u32(p + 44) | ((long long)get_u32(p + 48) << 32);
+        int mark_len = get_u16(p + 52);
+        if (mark_len > CsvTail::mark_size) mark_len = 0;
+        tail.restore(offset, string((const char*)p + 54, mark_len));
+        return true;
+    }
+
+    void commit() {
+        save_header();
+        pool.flush();
+    }
+
+    int id_bound() const { return (int)next_mid; }
+
+    int record_cost() const { return 32; } // A record read is a B+tree lookup through the pool
+
+    int find_id(const string& title) const {
+        string value;
+        if (!titles.find(format_key(title), value)) return -1;
+        return (int)get_be32(value);
+    }
+
+    void get_movie(int mid, MovieData& m) const {
+        string bytes;
+        if (records.find(be32(mid), bytes)) m.decode(bytes);
+    }
+
+    void neighbors(int mid, my_array<int>& out) const {
+        out.clear();
+        string prefix = be32(mid);
+        for (BTree::Cursor c = links.seek(prefix); c.valid() && has_prefix(c.key(), prefix); c.next()) {
+            out.push((int)get_be32(c.value()));
+        }
+    }
+
+    bool entity_movies(int type, const string& key, my_array<int>& out) const {
+        out.clear();
+        string prefix = entity_key(type, key) + '\0';
+        BTree::Cursor c = postings.seek(prefix);
+        if (!c.valid() || c.key() != prefix + be32(0)) return false;
+        for (c.next(); c.valid() && has_prefix(c.key(), prefix); c.next()) out.push((int)get_be32(c.value()));
+        return true;
+    }
+
+    void movies_by_title(my_array<int>& out) const {
+        out.clear();
+        for (BTree::Cursor c = titles.seek(""); c.valid(); c.next()) out.push((int)get_be32(c.value()));
+    }
+
+    // The links tree is ordered by mid, so each movie's list is one run of entries
+    void visit_links(LinkVisitor& visit) const {
+        my_array<int> nbrs;
+        int v = -1;
+        for (BTree::Cursor c = links.seek(""); c.valid(); c.next()) {
+            int from = (int)get_be32(c.key());
+            if (from != v) {
+                if (v != -1) visit.visit(v, nbrs);
+                v = from;
+                nbrs.clear();
+            }
+            nbrs.push((int)get_be32(c.value()));
+        }
+        if (v != -1) visit.visit(v, nbrs);
+    }
+
+    void print_matches(const Request& req, ResultPage& page, ostream& out) const {
+        MovieData m;
+        for (BTree::Cursor c = titles.seek(""); c.valid() && !page.full(); c.next()) {
+            get_movie((int)get_be32(c.value()), m);
+            string line = match_line(req, m.title, m.year, m.rating);
+            if (!line.empty() && page.take()) out << line;
+        }
+    }
+
+    void show_stats(ostream& out) { pool.show_stats(out); }
+
+    // Everything else is in the file
+    int account(MemoryReport& r) {
+        pool.account(r);
+        return movie_count;
+    }
+
+    // Same checks as MovieNode::add_link (no self links, no duplicates)
+    void add_link(int a, int b) {
+        if (a == b) return;
+        string pair = be32(a) + be32(b);
+        string seq;
+        if (link_set.find(pair, seq)) return;
+        seq = be32(next_seq++);
+        links.put(be32(a) + seq, be32(b));
+        link_set.put(pair, seq);
+    }
+
+    void remove_link(int a, int b) {
+        string pair = be32(a) + be32(b);
+        string seq;
+        if (!link_set.find(pair, seq)) return;
+        links.erase(be32(a) + seq);
+        link_set.erase(pair);
+    }
+
+    // Same as CatalogWriter::index: a movie joining a key is linked to the first movies under it
+    void index_key(int type, const string& raw_key, int mid) {
+        string k = format_key(raw_key);
+        if (k == "") return;
+        string prefix = entity_key(type, k) + '\0';
+        string value;
+        if (!postings.find(prefix + be32(0), value)) {
+            postings.put(prefix + be32(0), "");
+        } else {
+            if (posting_set.find(prefix + be32(mid), value)) return;
+            my_array<int> first;
+            for (BTree::Cursor c = postings.seek(prefix + be32(1));
+                 c.valid() && has_prefix(c.key(), prefix) && first.size() < entity_policy[type].links; c.next()) {
+                first.push((int)get_be32(c.value()));
+            }
+            for (int i = 0; i < first.size(); i++) {
+                add_link(mid, first[i]);
+                add_link(first[i], mid);
+            }
+        }
+        string seq = be32(next_seq++);
+        postings.put(prefix + seq, be32(mid));
+        posting_set.put(prefix + be32(mid), seq);
+    }
+
+    void unindex_key(int type, const string& raw_key, int mid) {
+        string prefix = entity_key(type, format_key(raw_key)) + '\0';
+        string seq;
+        if (!posting_set.find(prefix + be32(mid), seq)) return;
+        postings.erase(prefix + seq);
+        posting_set.erase(prefix + be32(mid));
+    }
+
+    static bool fits(const MovieData& m) {
+        if (format_key(m.title).size() > (size_t)BTree::max_key) return false;
+        if (m.encode().size() > (size_t)BTree::max_value) return false;
+        // Entity keys get a type tag, a separator and a 4 byte number added (see entity_key)
+        if (format_key(m.director).size() + 7 > (size_t)BTree::max_key) return false;
+        for (int i = 0; i < m.actors.size(); i++) {
+            if (format_key(m.actors[i]).size() + 7 > (size_t)BTree::max_key) return false;
+        }
+        for (int i = 0; i < m.genres.size(); i++) {
+            if (format_key(m.genres[i]).size() + 7 > (size_t)BTree::max_key) return false;
+        }
+        return true;
+    }
+
+    // Fills in the record of a row (names of one character or less are skipped, like in CatalogWriter::add)
+    static void record_of(const MovieRow& row, MovieData& m) {
+        m.title = row.title;
+        m.director = row.director;
+        m.year = row.year;
+        m.rating = row.rating;
+        m.duration = row.duration;
+        for (list_node<string>* a = row.cast.head; a; a = a->next) {
+            if (a->data.length() > 1 && !m.actors.contains(a->data)) m.actors.push(a->data);
+        }
+        for (list_node<string>* g = row.genres.head; g; g = g->next) {
+            if (g->data.length() > 1 && !m.genres.contains(g->data)) m.genres.push(g->data);
+        }
+    }
+
+    bool can_store(const MovieRow& row) const {
+        MovieData m;
+        record_of(row, m);
+        return fits(m);
+    }
+
+    // Stores a new movie and indexes it like CatalogWriter::add
+    bool insert_movie(const MovieRow& row) {
+        MovieData m;
+        record_of(row, m);
+        if (!fits(m)) return false;
+
+        int mid = (int)next_mid++;
+        for (int i = 0; i < m.actors.size(); i++) index_key(ENTITY_ACTOR, m.actors[i], mid);
+        if (m.director.length() > 1) index_key(ENTITY_DIRECTOR, m.director, mid);
+        for (int i = 0; i < m.genres.size(); i++) index_key(ENTITY_GENRE, m.genres[i], mid);
+        records.put(be32(mid), m.encode());
+        titles.put(format_key(m.title), be32(mid));
+        movie_count++;
+        return true;
+    }
+
+    void add_movie(const string& spec, ostream& out) {
+        MovieRow row;
+        if (!parse_movie_spec(spec, row, out)) return;
+        if (find_id(row.title) != -1) {
+            out << "Movie '" << row.title << "' already exists.\n";
+            return;
+        }
+        if (!insert_movie(row)) {
+            out << "Movie '" << row.title << "' is too large for disk storage.\n";
+            return;
+        }
+        out << "Movie '" << row.title << "' added.\n";
+    }
+
+    void remove_movie(const string& t, ostream& out) {
+        int mid = find_id(t);
+        if (mid == -1) {
+            out << "Movie not found.\n";
+            return;
+        }
+        MovieData m;
+        get_movie(mid, m);
+        my_array<int> nbrs;
+        neighbors(mid, nbrs);
+        for (int i = 0; i < nbrs.size(); i++) {
+            remove_link(nbrs[i], mid);
+            remove_link(mid, nbrs[i]);
+        }
+        for (int i = 0; i < m.actors.size(); i++) unindex_key(ENTITY_ACTOR, m.actors[i], mid);
+        for (int i = 0; i < m.genres.size(); i++) unindex_key(ENTITY_GENRE, m.genres[i], mid);
+        unindex_key(ENTITY_DIRECTOR, m.director, mid);
+        records.erase(be32(mid));
+        titles.erase(format_key(m.title));
+        movie_count--;
+        out << "Movie '" << t << "' deleted.\n";
+    }
+
+    void set_rating(const string& t, float r, ostream& out) {
+        int mid = find_id(t);
+        if (mid == -1) {
+            out << "Not found.\n";
+            return;
+        }
+        MovieData m;
+        get_movie(mid, m);
+        m.rating = r;
+        records.put(be32(mid), m.encode());
+        out << "Rating for '" << m.title << "' updated to " << r << "/10" << endl;
+    }
+
+    void set_fields(int id, int year, float rating) {
+        MovieData m;
+        get_movie(id, m);
+        m.year = year;
+        m.rating = rating;
+        records.put(be32(id), m.encode());
+    }
+
+    void run_write(const Request& req, ostream& out) {
+        switch (req.type) {
+            case REQ_SET_RATING: set_rating(req.text, req.low, out); break;
+            case REQ_DELETE: remove_movie(req.text, out); break;
+            case REQ_ADD: add_movie(req.text, out); break;
+            case REQ_BATCH: apply_batch(req.text, out); break;
+            default: break;
+        }
+        commit();
+    }
+
+    void ingest_done() { commit(); }
+
+public:
+    // Opens the catalog file, or starts an empty one if the file is new
+    DiskEngine(const string& file) : path(file), pool(disk_pool_pages), records(pool), titles(pool), postings(pool),
+                                     posting_set(pool), links(pool), link_set(pool), next_mid(0), next_seq(1),
+                                     movie_count(0), usable(false) {
+        if (!pool.open(path)) {
+            cout << "Could not open " << path << ": " << strerror(errno) << endl;
+            return;
+        }
+        if (pool.page_total() == 0) {
+            pool.allocate(); // Header page
+            for (int i = 0; i < tree_count; i++) tree(i)->create();
+            commit();
+        } else if (!read_header()) {
+            PageRef head(pool, 0);
+            if (memcmp(head.data(), "MDMDISK1", 8) == 0) {
+                cout << path << " was written before entity types were indexed separately; remove it to rebuild.\n";
+            } else cout << path << " is not a catalog file." << endl;
+            return;
+        }
+        usable = true;
+    }
+
+    ~DiskEngine() {
+        if (usable) commit();
+    }
+
+    bool ok() const { return usable; }
+
+    // Imports the CSV into an empty catalog file; a file that already holds movies is used as it is
+    void load(string fname) {
+        unique_lock<shared_mutex> guard(rw);
+        if (movie_count > 0) {
+            tail.set_file(fname);
+            cout << "Opened " << path << ": " << movie_count << " movies" << endl;
+            return;
+        }
+        load_rows(fname);
+        commit();
+    }
+};
+
+// Shard Postings
+// Typed entity key (see entity_key) -> the movies of one shard under that key, as (seq << 32 | movie id) entries
+// in indexing order.
+// A key stays after its last movie is gone, like an emptied PostingNode.
+struct ShardPosting {
+    string key;
+    my_array<long long> entries;
+    ShardPosting* next;
+    ShardPosting(const string& k) : key(k), next(nullptr) {}
+};
+
+class ShardPostings {
+private:
+    static const int tbl_size = 20011;
+    ShardPosting* table[tbl_size];
+    int key_total;
+
+public:
+    ShardPostings() : key_total(0) {
+        for (int i = 0; i < tbl_size; i++) table[i] = nullptr;
+    }
+
+    ~ShardPostings() {
+        for (int i = 0; i < tbl_size; i++) {
+            ShardPosting* curr = table[i];
+            while (curr != nullptr) {
+                ShardPosting* temp = curr;
+                curr = curr->next;
+                delete temp;
+            }
+        }
+    }
+
+    // Looks up a normalized key
+    ShardPosting* find(const string& k) const {
+        ShardPosting* curr = table[str_hash(k) % tbl_size];
+        while (curr != nullptr && curr->key != k) curr = curr->next;
+        return curr;
+    }
+
+    ShardPosting* find_or_add(const string& k) {
+        ShardPosting* p = find(k);
+        if (p) return p;
+        int idx = str_hash(k) % tbl_size;
+        p = new ShardPosting(k);
+        p->next = table[idx];
+        table[idx] = p;
+        key_total++;
+        return p;
+    }
+
+    int key_count() const { return key_total; }
+
+    // Key nodes and their entry lists (the table itself is part of the Shard)
+    void account(MemoryReport& r) const {
+        int keys = r.part("Shard posting keys", "keys");
+        int entries = r.part("Shard posting entries", "postings");
+        for (int i = 0; i < tbl_size; i++) {
+            for (const ShardPosting* p = table[i]; p; p = p->next) {
+                r.add(keys, sizeof(ShardPosting));
+                r.add_string(keys, p->key);
+                r.count(keys, 1);
+                r.add_array(entries, p->entries);
+                r.count(entries, p->entries.size());
+            }
+        }
+    }
+};
+
+// One unit of scatter-gather work: run(s) is called once on the worker thread of every shard,
+// wait() returns when all of them are done
+class ShardJob {
+private:
+    mutex lock;
+    condition_variable all_done;
+    int pending;
+
+public:
+    ShardJob(int shards) : pending(shards) {}
+    virtual ~ShardJob() {}
+    virtual void run(int shard) = 0;
+
+    void finish() {
+        lock_guard<mutex> guard(lock);
+        if (--pending == 0) all_done.notify_all();
+    }
+
+    void wait() {
+        unique_lock<mutex> guard(lock);
+        while (pending > 0) all_done.wait(guard);
+    }
+};
+
+template <typename Fn>
+class ShardJobFn : public ShardJob {
+    Fn fn;
+public:
+    ShardJobFn(int shards, Fn f) : ShardJob(shards), fn(f) {}
+    void run(int shard) { fn(shard); }
+};
+
+// One partition of the sharded catalog: its movies in an AVLTree, their postings and their graph links
+// (MovieNode::neighbors, holding global movie ids), served by its own worker thread
+struct Shard {
+    AVLTree tree;
+    my_array<MovieNode*> node_at; // Slot -> node (nullptr once deleted); movie id = slot * shard count + shard
+    ShardPostings postings;
+    int movies;
+
+    thread worker;
+    mutex job_lock;
+    condition_variable job_ready;
+    my_queue<ShardJob*> jobs;
+    bool stopping;
+    atomic<long long> jobs_run;
+
+    Shard() : movies(0), stopping(false), jobs_run(0) {}
+};
+
+// Sharded Engine
+// Splits the catalog by title hash into independent shards (see Shard), each served by a worker thread.
+// Lookups by title or movie id go straight to the owning shard. Entity searches, listings, filters, BFS
+// levels and top-k ranking are scattered to all shards and their partial answers merged in the same order as
+// in memory mode. Links may cross shards: they hold global movie ids, so searches follow them to other shards.
+// Postings of an entity are spread over the shards of its movies; the global seq number stamped on every
+// posting restores the indexing order that decides which movies a new one is linked to.
+// Updates run on the calling thread while rw is held exclusively, so no shard work is in flight.
+class ShardedEngine : public CatalogQueries {
+private:
+    Shard* shards;
+    int shard_count;
+    long long next_seq;
+
+    int shard_of(const string& search_key) const { return (int)(str_hash(search_key) % shard_count); }
+
+    MovieNode* node_of(int id) const {
+        Shard& sh = shards[id % shard_count];
+        int slot = id / shard_count;
+        return (slot < sh.node_at.size()) ? sh.node_at[slot] : nullptr;
+    }
+
+    void serve(int s) {
+        Shard& sh = shards[s];
+        while (true) {
+            ShardJob* job = nullptr;
+            {
+                unique_lock<mutex> guard(sh.job_lock);
+                while (!sh.stopping && sh.jobs.empty()) sh.job_ready.wait(guard);
+                if (sh.jobs.empty()) return;
+                job = sh.jobs.dequeue();
             }
+            job->run(s);
+            sh.jobs_run++;
+            job->finish();
         }
     }
 
-    // Finds the shortest path between two movies using BFS and parent pointers
-    void shortest_path(MovieNode* start, MovieNode* end, AVLTree& tree) {
-        if (!start || !end) return;
-        tree.clear_flags();
+    // Runs fn(shard) on every shard's thread and waits for all of them
+    template <typename Fn>
+    void scatter(Fn fn) const {
+        ShardJobFn<Fn> job(shard_count, fn);
+        for (int s = 0; s < shard_count; s++) {
+            lock_guard<mutex> guard(shards[s].job_lock);
+            shards[s].jobs.enqueue(&job);
+            shards[s].job_ready.notify_one();
+        }
+        job.wait();
+    }
 
-        my_queue<MovieNode*> q;
-        q.enqueue(start);
-        start->visited = true;
-        
+    int id_bound() const {
+        int slots = 0;
+        for (int s = 0; s < shard_count; s++) slots = get_max(slots, shards[s].node_at.size());
+        return slots * shard_count;
+    }
+
+    int find_id(const string& title) const {
+        MovieNode* n = shards[shard_of(format_key(title))].tree.find_movie(title);
+        return n ? n->mid : -1;
+    }
+
+    void get_movie(int id, MovieData& m) const {
+        const MovieNode* n = node_of(id);
+        m.title = n->title;
+        m.director = n->director_name();
+        m.year = n->year;
+        m.rating = n->rating;
+        m.duration = n->duration;
+        m.actors.clear();
+        for (int i = 0; i < n->actors.size(); i++) m.actors.push(names.name(n->actors[i]));
+        m.genres.clear();
+        for (int i = 0; i < n->genres.size(); i++) m.genres.push(names.name(n->genres[i]));
+    }
+
+    static void read_links(const MovieNode* n, my_array<int>& out) {
+        out.clear();
+        IdCursor c = n->neighbors.cursor();
+        int id;
+        while (c.next(id)) out.push(id);
+    }
+
+    void neighbors(int id, my_array<int>& out) const { read_links(node_of(id), out); }
+
+    // Every shard expands the frontier movies it owns
+    void expand(const my_array<int>& ids, my_array<int>* lists) const {
+        scatter([&](int s) {
+            for (int i = 0; i < ids.size(); i++) {
+                if (ids[i] % shard_count == s) read_links(node_of(ids[i]), lists[i]);
+            }
+        });
+    }
+
+    // Sorted by seq, so the result is in indexing order across shards.
+    // With limit >= 0 only the first limit entries of every shard are gathered (enough for the first limit overall).
+    bool gather_postings(const string& k, int limit, my_array<long long>& out) const {
+        my_array<long long>* parts = new my_array<long long>[shard_count];
+        bool* known = new bool[shard_count];
+        scatter([&](int s) {
+            const ShardPosting* p = shards[s].postings.find(k);
+            known[s] = (p != nullptr);
+            if (!p) return;
+            for (int i = 0; i < p->entries.size() && (limit < 0 || i < limit); i++) parts[s].push(p->entries[i]);
+        });
         bool found = false;
-        
-        while (!q.empty()) {
-            MovieNode* curr = q.dequeue();
-            if (curr == end) {
-                found = true;
-                break;
+        out.clear();
+        for (int s = 0; s < shard_count; s++) {
+            found = found || known[s];
+            for (int i = 0; i < parts[s].size(); i++) out.push(parts[s][i]);
+        }
+        delete[] parts;
+        delete[] known;
+        heap_sort(out.data(), out.size());
+        return found;
+    }
+
+    bool entity_movies(int type, const string& key, my_array<int>& out) const {
+        out.clear();
+        my_array<long long> entries;
+        if (!gather_postings(entity_key(type, key), -1, entries)) return false;
+        for (int i = 0; i < entries.size(); i++) out.push((int)(entries[i] & 0xffffffff));
+        return true;
+    }
+
+    // Every shard lists its movies in title order (formatted by line_of, skipped if empty), then they are merged.
+    // With a cap every shard stops after that many lines, which still leaves the first cap merged lines complete.
+    template <typename LineFn>
+    void gather_by_title(LineFn line_of, my_array<KeyedLine>& out, int cap = -1) const {
+        my_array<KeyedLine>* parts = new my_array<KeyedLine>[shard_count];
+        scatter([&](int s) {
+            AVLTree::Cursor c(shards[s].tree);
+            while (MovieNode* n = c.next()) {
+                if (parts[s].size() == cap) break;
+                KeyedLine item;
+                item.line = line_of(n);
+                if (item.line.empty()) continue;
+                item.key = n->search_key;
+                item.id = n->mid;
+                parts[s].push(item);
             }
-            list_node<MovieNode*>* n_ptr = curr->neighbors.head;
-            while (n_ptr != nullptr) {
-                MovieNode* neighbor = n_ptr->data;
-                if (!neighbor->visited) {
-                    neighbor->visited = true;
-                    neighbor->parent = curr; 
-                    q.enqueue(neighbor);
-                }
-                n_ptr = n_ptr->next;
+        });
+        out.clear();
+        for (int s = 0; s < shard_count; s++) {
+            for (int i = 0; i < parts[s].size(); i++) out.push(parts[s][i]);
+        }
+        delete[] parts;
+        heap_sort(out.data(), out.size());
+    }
+
+    void movies_by_title(my_array<int>& out) const {
+        my_array<KeyedLine> all;
+        gather_by_title([](const MovieNode*) { return string("+"); }, all);
+        out.clear();
+        for (int i = 0; i < all.size(); i++) out.push(all[i].id);
+    }
+
+    void print_matches(const Request& req, ResultPage& page, ostream& out) const {
+        my_array<KeyedLine> all;
+        gather_by_title([&](const MovieNode* n) { return match_line(req, n->title, n->year, n->rating); }, all,
+                        page.needed());
+        for (int i = 0; i < all.size() && !page.full(); i++) {
+            if (page.take()) out << all[i].line;
+        }
+    }
+
+    void visit_links(LinkVisitor& visit) const {
+        my_array<int> nbrs;
+        for (int s = 0; s < shard_count; s++) {
+            const Shard& sh = shards[s];
+            for (int slot = 0; slot < sh.node_at.size(); slot++) {
+                const MovieNode* n = sh.node_at[slot];
+                if (!n || n->neighbors.size() == 0) continue;
+                read_links(n, nbrs);
+                visit.visit(n->mid, nbrs);
             }
         }
+    }
 
-        if (found) {
-            cout << "\n--- Shortest Connection Path ---\n";
-            print_path(end);
-            cout << endl;
-        } else {
-            cout << "\nNo connection found.\n";
+    void show_stats(ostream& out) {
+        out << "\n--- Shards ---\n";
+        for (int s = 0; s < shard_count; s++) {
+            const Shard& sh = shards[s];
+            long long links = 0;
+            for (int slot = 0; slot < sh.node_at.size(); slot++) {
+                if (sh.node_at[slot]) links += sh.node_at[slot]->neighbors.size();
+            }
+            out << "Shard " << s << ": " << sh.movies << " movies | " << sh.postings.key_count() << " keys | "
+                << links << " links | " << sh.jobs_run << " jobs\n";
         }
     }
 
-    // Connects two people (Actors/Director) via movies they participated in.
-    void connect_actors(string a1, string a2, HashTable& idx, AVLTree& tree) {
-        LinkedList<MovieNode*>* movies1 = idx.find_item(a1);
-        if (!movies1) {
-            cout << "Actor/Director 1 (" << a1 << ") not found.\n";
-            return;
+    // Every shard's tree and postings, and the shard objects with their inline posting tables.
+    // A key's movies are spread over the shards, so no largest buckets are noted.
+    int account(MemoryReport& r) {
+        MemoryReport::Top most(5);
+        int table = r.part("Shard tables", "shards");
+        int movies = 0;
+        r.add(table, (long long)shard_count * sizeof(Shard));
+        r.count(table, shard_count);
+        for (int s = 0; s < shard_count; s++) {
+            shards[s].tree.account(r, most);
+            shards[s].postings.account(r);
+            r.add_array(table, shards[s].node_at);
+            movies += shards[s].movies;
         }
+        r.note("Most linked movies: " + most.join());
+        return movies;
+    }
 
-        tree.clear_flags();
-        my_queue<MovieNode*> q;
+    // MovieNode::add_link with movie ids instead of uids (which are only unique inside one shard)
+    static void add_link(MovieNode* from, const MovieNode* to) {
+        if (from == to) return;
+        if (!from->neighbors.contains(to->mid)) from->neighbors.push(to->mid);
+    }
 
-        // Initialize queue with all movies of the first person
-        list_node<MovieNode*>* curr_mov = movies1->head;
-        while(curr_mov) {
-            curr_mov->data->visited = true;
-            q.enqueue(curr_mov->data);
-            curr_mov = curr_mov->next;
+    // Same as CatalogWriter::index: a movie joining a key is linked to the first movies under it
+    void index_key(int type, const string& raw_key, MovieNode* m) {
+        string k = format_key(raw_key);
+        if (k == "") return;
+        k = entity_key(type, k);
+        int links = entity_policy[type].links;
+        Shard& home = shards[m->mid % shard_count];
+        ShardPosting* own = home.postings.find(k);
+        if (own) {
+            for (int i = 0; i < own->entries.size(); i++) {
+                if ((int)(own->entries[i] & 0xffffffff) == m->mid) return;
+            }
+        }
+        my_array<long long> first;
+        gather_postings(k, links, first);
+        for (int i = 0; i < first.size() && i < links; i++) {
+            MovieNode* other = node_of((int)(first[i] & 0xffffffff));
+            add_link(m, other);
+            add_link(other, m);
         }
+        home.postings.find_or_add(k)->entries.push((next_seq++ << 32) | (long long)m->mid);
+    }
 
-        bool found = false;
-        MovieNode* meet = nullptr;
+    void unindex_key(int type, const string& raw_key, const MovieNode* m) {
+        ShardPosting* p = shards[m->mid % shard_count].postings.find(entity_key(type, format_key(raw_key)));
+        if (!p) return;
+        for (int i = 0; i < p->entries.size(); i++) {
+            if ((int)(p->entries[i] & 0xffffffff) == m->mid) {
+                p->entries.remove(p->entries[i]);
+                return;
+            }
+        }
+    }
 
-        while(!q.empty()) {
-            MovieNode* curr = q.dequeue();
+    // Same steps as CatalogWriter::add, in the home shard of the title
+    bool insert_movie(const MovieRow& row) {
+        MovieNode* m = new MovieNode(row.title, row.year, row.rating, row.duration, row.director);
+        int s = shard_of(m->search_key);
+        Shard& sh = shards[s];
+        m->mid = sh.node_at.size() * shard_count + s;
+        sh.tree.track(m);
+        sh.node_at.push(m);
+        for (list_node<string>* a = row.cast.head; a; a = a->next) {
+            if (a->data.length() > 1) {
+                m->add_actor(a->data);
+                index_key(ENTITY_ACTOR, a->data, m);
+            }
+        }
+        if (m->director_name().length() > 1) index_key(ENTITY_DIRECTOR, m->director_name(), m);
+        for (list_node<string>* g = row.genres.head; g; g = g->next) {
+            if (g->data.length() > 1) {
+                m->add_genre(g->data);
+                index_key(ENTITY_GENRE, g->data, m);
+            }
+        }
+        sh.tree.insert(m);
+        sh.movies++;
+        return true;
+    }
 
-            // Check if actor 2 is in cast
-            list_node<string>* cast = curr->actors.head;
-            while(cast) {
-                if(format_key(cast->data) == format_key(a2)) {
-                    found = true;
-                    meet = curr;
-                    break;
-                }
-                cast = cast->next;
-            }
-            // Check if person 2 is the director
-            if (!found && format_key(curr->director) == format_key(a2)) {
-                found = true;
-                meet = curr;
-            }
-            
-            if(found) break;
-
-            list_node<MovieNode*>* n_ptr = curr->neighbors.head;
-            while (n_ptr != nullptr) {
-                MovieNode* neighbor = n_ptr->data;
-                if (!neighbor->visited) {
-                    neighbor->visited = true;
-                    neighbor->parent = curr;
-                    q.enqueue(neighbor);
-                }
-                n_ptr = n_ptr->next;
+    void add_movie(const string& spec, ostream& out) {
+        MovieRow row;
+        if (!parse_movie_spec(spec, row, out)) return;
+        if (find_id(row.title) != -1) {
+            out << "Movie '" << row.title << "' already exists.\n";
+            return;
+        }
+        insert_movie(row);
+        out << "Movie '" << row.title << "' added.\n";
+    }
+
+    void remove_movie(const string& t, ostream& out) {
+        int id = find_id(t);
+        if (id == -1) {
+            out << "Movie not found.\n";
+            return;
+        }
+        Shard& sh = shards[id % shard_count];
+        MovieNode* m = node_of(id);
+        my_array<int> nbrs;
+        read_links(m, nbrs);
+        for (int i = 0; i < nbrs.size(); i++) node_of(nbrs[i])->neighbors.remove(id);
+        for (int i = 0; i < m->actors.size(); i++) unindex_key(ENTITY_ACTOR, names.name(m->actors[i]), m);
+        for (int i = 0; i < m->genres.size(); i++) unindex_key(ENTITY_GENRE, names.name(m->genres[i]), m);
+        unindex_key(ENTITY_DIRECTOR, m->director_name(), m);
+
+        // A node with two children takes over the data of its in-order successor, whose node is freed instead
+        MovieNode* next = nullptr;
+        if (m->left && m->right) {
+            next = m->right;
+            while (next->left) next = next->left;
+            read_links(next, nbrs);
+        }
+        int next_id = next ? next->mid : -1;
+        sh.tree.remove_node(t, out);
+        sh.node_at[id / shard_count] = nullptr;
+        if (next_id != -1) {
+            sh.node_at[next_id / shard_count] = m;
+            for (int i = 0; i < nbrs.size(); i++) m->neighbors.push(nbrs[i]);
+        }
+        sh.movies--;
+    }
+
+    void run_write(const Request& req, ostream& out) {
+        switch (req.type) {
+            case REQ_SET_RATING: {
+                int id = find_id(req.text);
+                if (id != -1) node_of(id)->set_rating(req.low, out);
+                else out << "Not found.\n";
+                break;
             }
+            case REQ_DELETE: remove_movie(req.text, out); break;
+            case REQ_ADD: add_movie(req.text, out); break;
+            case REQ_BATCH: apply_batch(req.text, out); break;
+            default: break;
         }
+    }
 
-        if (found) {
-            cout << "\n--- Connection Found! ---\n";
-            cout << a1 << " is connected to " << a2 << " via:\n";
-            print_path(meet);
-            cout << " -> (Involved: " << a2 << ")\n";
-        } else {
-            cout << "No connection found between these actors/directors.\n";
+    void set_fields(int id, int year, float rating) {
+        MovieNode* m = node_of(id);
+        m->year = year;
+        m->rating = rating;
+    }
+
+public:
+    ShardedEngine(int count) : shard_count(count), next_seq(1) {
+        shards = new Shard[shard_count];
+        for (int s = 0; s < shard_count; s++) shards[s].worker = thread(&ShardedEngine::serve, this, s);
+    }
+
+    ~ShardedEngine() {
+        for (int s = 0; s < shard_count; s++) {
+            lock_guard<mutex> guard(shards[s].job_lock);
+            shards[s].stopping = true;
+            shards[s].job_ready.notify_one();
         }
+        for (int s = 0; s < shard_count; s++) shards[s].worker.join();
+        delete[] shards;
     }
 
-    // Recursively prints path from end node back to start
-    void print_path(MovieNode* node) const {
-        if (node == nullptr) return;
-        print_path(node->parent);
-        if (node->parent != nullptr) cout << " -> ";
-        cout << "[" << node->title << "]";
+    void load(string fname) {
+        unique_lock<shared_mutex> guard(rw);
+        load_rows(fname);
     }
 };
 
-// CSV Parsing Logic
-LinkedList<string>* parse_csv_line(string line) {
-    LinkedList<string>* tokens = new LinkedList<string>();
-    string curr_tok = "";
-    bool in_quotes = false;
-    
-    for (size_t i = 0; i < line.length(); i++) {
-        char c = line[i];
-        if (c == '\"') {
-            if (in_quotes && i + 1 < line.length() && line[i + 1] == '\"') {
-                curr_tok += '\"'; // handle escaped double quotes
-                i++;
-            } else {
-                in_quotes = !in_quotes; 
-            }
-        } 
-        else if (c == ',' && !in_quotes) {
-            tokens->insert(curr_tok);
-            curr_tok = "";
-        } 
-        else curr_tok += c;
+// Server Protocol
+// One request per line, "VERB arguments". Two-operand requests separate the operands with '|':
+//   LIST | TITLE <title> | SEARCH [actor:|director:|genre:]<name> | YEAR <y> | RATING <min> <max>
+//   BFS <n> <title> | DFS <n> <title> | PATH <title1>|<title2> | CONNECT <person1>|<person2>
+//   SETRATING <r> <title> | DELETE <title> | COACTORS <actor> | ANALYTICS | CACHESTATS | MEMORY | INGEST
+//   SIMILAR <n> <title> | PROFILE <n> <genre1|genre2> | QUERY <query> | EXPLAIN <query> (see parse_compound)
+//   ADD <title;year;rating;duration;director;actor1|actor2;genre1|genre2> | BATCH <file> (see BatchPlan) | QUIT
+//   (the server resolves the BATCH file in its batch directory, see QueryServer)
+//   PAGE <offset> <limit> <request>: only rows offset+1 .. offset+limit of a listing (see ResultPage)
+// Replies are "OK <bytes>\n" followed by exactly that many bytes of output, or "ERR <message>\n".
+bool parse_request(const string& line, Request& req, string& error) {
+    string verb = "", rest = "";
+    size_t sp = line.find(' ');
+    verb = (sp == string::npos) ? line : line.substr(0, sp);
+    if (sp != string::npos) rest = line.substr(sp + 1);
+    for (size_t i = 0; i < verb.length(); i++) {
+        if (verb[i] >= 'a' && verb[i] <= 'z') verb[i] -= 32;
+    }
+
+    stringstream ss(rest);
+    if (verb == "LIST") req.type = REQ_LIST_ALL;
+    else if (verb == "ANALYTICS") req.type = REQ_ANALYTICS;
+    else if (verb == "CACHESTATS") req.type = REQ_CACHE_STATS;
+    else if (verb == "MEMORY") req.type = REQ_MEMORY;
+    else if (verb == "INGEST") req.type = REQ_INGEST;
+    else if (verb == "TITLE") { req.type = REQ_TITLE; req.text = rest; }
+    else if (verb == "SEARCH") { req.type = REQ_ENTITY; req.text = rest; }
+    else if (verb == "DELETE") { req.type = REQ_DELETE; req.text = rest; }
+    else if (verb == "COACTORS") { req.type = REQ_COACTORS; req.text = rest; }
+    else if (verb == "ADD") { req.type = REQ_ADD; req.text = rest; }
+    else if (verb == "BATCH") { req.type = REQ_BATCH; req.text = rest; }
+    else if (verb == "QUERY") { req.type = REQ_QUERY; req.text = rest; }
+    else if (verb == "EXPLAIN") { req.type = REQ_EXPLAIN; req.text = rest; }
+    else if (verb == "YEAR") {
+        req.type = REQ_YEAR;
+        if (!(ss >> req.number)) { error = "YEAR needs a number"; return false; }
+    }
+    else if (verb == "RATING") {
+        req.type = REQ_RATING;
+        if (!(ss >> req.low >> req.high)) { error = "RATING needs <min> <max>"; return false; }
+    }
+    else if (verb == "BFS" || verb == "DFS" || verb == "SIMILAR" || verb == "PROFILE") {
+        if (verb == "BFS") req.type = REQ_BFS;
+        else if (verb == "DFS") req.type = REQ_DFS;
+        else req.type = (verb == "SIMILAR") ? REQ_SIMILAR : REQ_PROFILE;
+        if (!(ss >> req.number)) { error = verb + " needs <n> <title>"; return false; }
+        getline(ss >> ws, req.text);
+    }
+    else if (verb == "SETRATING") {
+        req.type = REQ_SET_RATING;
+        if (!(ss >> req.low)) { error = "SETRATING needs <rating> <title>"; return false; }
+        getline(ss >> ws, req.text);
+    }
+    else if (verb == "PAGE") {
+        int offset = 0, limit = 0;
+        string inner;
+        if (!(ss >> offset >> limit) || offset < 0 || limit < 1) {
+            error = "PAGE needs <offset> <limit> <request>";
+            return false;
+        }
+        getline(ss >> ws, inner);
+        if (!parse_request(inner, req, error)) return false;
+        req.offset = offset;
+        req.limit = limit;
+    }
+    else if (verb == "PATH" || verb == "CONNECT") {
+        req.type = (verb == "PATH") ? REQ_PATH : REQ_CONNECT;
+        size_t bar = rest.find('|');
+        if (bar == string::npos) { error = verb + " needs <first>|<second>"; return false; }
+        req.text = rest.substr(0, bar);
+        req.text2 = rest.substr(bar + 1);
+    }
+    else {
+        error = "Unknown request '" + verb + "'";
+        return false;
     }
-    tokens->insert(curr_tok); 
-    return tokens;
+    return true;
 }
 
-// Data Loading Logic
-// Reads the CSV, parses fields, creates nodes, and builds the graph.
-void load_data(string fname, AVLTree& tree, HashTable& idx) {
-    ifstream file(fname);
-    if (!file.is_open()) {
-        cout << "Could not open " << fname << endl;
-        return;
+volatile sig_atomic_t server_stop = 0;
+
+void on_stop_signal(int) { server_stop = 1; }
+
+// Query Server
+// Single event loop (poll) owns all sockets; parsed requests are handed to a pool of worker threads
+// that call CatalogEngine::execute(). Finished replies come back through a queue and a wake-up pipe.
+// Each connection has at most one request in flight, so its replies stay in order.
+// BATCH names a file in the batch directory (--batch-dir); without one, clients cannot make the server read files.
+class QueryServer {
+private:
+    struct Client {
+        int fd;
+        int id;
+        string in;
+        string out;
+        bool busy;     // A request of this client is being processed
+        bool eof;      // Peer finished sending; answer what is left, then close
+        bool closing;  // QUIT or protocol error: close once pending output is written
+        bool dead;     // Socket failed; drop as soon as no worker refers to it
+    };
+    struct Job {
+        int client_id;
+        Request req;
+    };
+    struct Reply {
+        int client_id;
+        string body;
+    };
+
+    static const size_t max_line = 65536;
+
+    CatalogEngine& engine;
+    string batch_dir;
+    int listen_fd;
+    int wake_pipe[2];
+    my_array<Client*> clients;
+    int next_id;
+
+    mutex job_lock;
+    condition_variable job_ready;
+    my_queue<Job*> jobs;
+    bool stopping;
+
+    mutex reply_lock;
+    my_queue<Reply*> replies;
+
+    thread* workers;
+    int worker_total;
+
+    static void set_nonblocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
     }
-    
-    cout << "Loading dataset... ";
-    string line;
-    int count = 0;
-    int skipped = 0;
-    int duplicates = 0;
-    getline(file, line); // Skip Header
 
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        
-        LinkedList<string>* row = parse_csv_line(line);
-        // Ensure row has enough columns (Index 25 is imdb_score)
-        if (row->size <= 25) { 
-            skipped++; 
-            delete row; 
-            continue; 
+    void worker_loop() {
+        while (true) {
+            Job* job = nullptr;
+            {
+                unique_lock<mutex> guard(job_lock);
+                while (!stopping && jobs.empty()) job_ready.wait(guard);
+                if (stopping && jobs.empty()) return;
+                job = jobs.dequeue();
+            }
+            stringstream out;
+            engine.execute(job->req, out);
+            Reply* reply = new Reply;
+            reply->client_id = job->client_id;
+            reply->body = out.str();
+            delete job;
+            {
+                lock_guard<mutex> guard(reply_lock);
+                replies.enqueue(reply);
+            }
+            char b = 1;
+            if (write(wake_pipe[1], &b, 1) < 0) { /* Pipe full: the loop is awake anyway */ }
         }
+    }
 
-        string raw_title = row->get_at(11); 
-        string clean_t = clean_str(raw_title);
-        
-        if (clean_t.length() > 0) {
-            // Check for duplicates
-            if (tree.find_movie(clean_t) != nullptr) {
-                duplicates++;
-                delete row;
-                continue; 
-            }
+    Client* find_client(int id) {
+        for (int i = 0; i < clients.size(); i++) {
+            if (clients[i]->id == id) return clients[i];
+        }
+        return nullptr;
+    }
 
-            string d = clean_str(row->get_at(1));
-            int dur = to_int(row->get_at(3));
-            
-            // Extract Actors
-            string act1 = clean_str(row->get_at(10));
-            string act2 = clean_str(row->get_at(6));
-            string act3 = clean_str(row->get_at(14)); 
+    void accept_clients() {
+        while (true) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) return;
+            set_nonblocking(fd);
+            Client* c = new Client;
+            c->fd = fd;
+            c->id = next_id++;
+            c->busy = false;
+            c->eof = false;
+            c->closing = false;
+            c->dead = false;
+            clients.push(c);
+        }
+    }
 
-            string g_str = row->get_at(9);
-            int y = to_int(row->get_at(23));
-            float r = to_float(row->get_at(25));
+    void collect_replies() {
+        char buf[256];
+        while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {}
+        lock_guard<mutex> guard(reply_lock);
+        while (!replies.empty()) {
+            Reply* reply = replies.dequeue();
+            Client* c = find_client(reply->client_id);
+            if (c) {
+                c->out += "OK " + to_string(reply->body.length()) + "\n" + reply->body;
+                c->busy = false;
+            }
+            delete reply;
+        }
+    }
 
-            MovieNode* m = new MovieNode(clean_t, y, r, dur, d);
+    // Turns the file name of a BATCH request into its path in the batch directory; false with the reason if the
+    // server takes no batches or the name is not a plain file name
+    bool batch_path(Request& req, string& error) const {
+        if (batch_dir == "") {
+            error = "BATCH is disabled (start the server with --batch-dir <dir>)";
+            return false;
+        }
+        string name = clean_str(req.text);
+        if (name == "" || name == "." || name == ".." || name.find('/') != string::npos ||
+            name.find('\\') != string::npos) {
+            error = "BATCH needs the name of a file in the batch directory";
+            return false;
+        }
+        req.text = batch_dir + "/" + name;
+        return true;
+    }
 
-            // Index Actors and add to Node
-            if (act1.length() > 1) { 
-                m->add_actor(act1); 
-                idx.insert_item(act1, m); 
+    // Starts the next complete request line of a client, answering protocol errors directly
+    void dispatch(Client* c) {
+        while (!c->busy && !c->closing) {
+            size_t nl = c->in.find('\n');
+            if (nl == string::npos) {
+                if (c->in.length() > max_line) {
+                    c->out += "ERR Request too long\n";
+                    c->closing = true;
+                }
+                return;
+            }
+            string line = c->in.substr(0, nl);
+            c->in.erase(0, nl + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            if (line == "QUIT" || line == "quit") {
+                c->closing = true;
+                return;
             }
-            if (act2.length() > 1) { 
-                m->add_actor(act2); 
-                idx.insert_item(act2, m); 
+            Job* job = new Job;
+            string error;
+            bool ok = parse_request(line, job->req, error);
+            if (ok && job->req.type == REQ_BATCH) ok = batch_path(job->req, error);
+            if (!ok) {
+                c->out += "ERR " + error + "\n";
+                delete job;
+                continue;
             }
-            if (act3.length() > 1) { 
-                m->add_actor(act3); 
-                idx.insert_item(act3, m); 
+            job->client_id = c->id;
+            c->busy = true;
+            {
+                lock_guard<mutex> guard(job_lock);
+                jobs.enqueue(job);
             }
+            job_ready.notify_one();
+        }
+    }
 
-            // Index Director
-            if (d.length() > 1) {
-                idx.insert_item(d, m);
+    // Reads and writes whatever the socket allows without blocking; returns false if the socket failed
+    bool pump(Client* c, short events) {
+        if (events & (POLLERR | POLLNVAL)) return false;
+        if (events & (POLLIN | POLLHUP)) {
+            char buf[4096];
+            while (true) {
+                ssize_t got = recv(c->fd, buf, sizeof(buf), 0);
+                if (got > 0) c->in.append(buf, got);
+                else if (got == 0) { c->eof = true; break; }
+                else if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                else return false;
             }
+        }
+        if (!c->out.empty()) {
+            ssize_t sent = send(c->fd, c->out.data(), c->out.length(), MSG_NOSIGNAL);
+            if (sent > 0) c->out.erase(0, sent);
+            else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        }
+        return true;
+    }
 
-            // Parse and Index Genres (separated by '|')
-            string temp_g = "";
-            for (char c : g_str) {
-                if (c == '|') {
-                    if (temp_g.length() > 1) {
-                        m->add_genre(temp_g);
-                        idx.insert_item(temp_g, m); 
-                    }
-                    temp_g = "";
-                } else temp_g += c;
+    bool finished(const Client* c) const {
+        if (c->busy) return false;
+        if (c->dead) return true;
+        if (!c->out.empty()) return false;
+        return c->closing || (c->eof && c->in.find('\n') == string::npos);
+    }
+
+    void drop_client(int i) {
+        close(clients[i]->fd);
+        delete clients[i];
+        Client* last = clients.pop();
+        if (i < clients.size()) clients[i] = last;
+    }
+
+public:
+    QueryServer(CatalogEngine& e, const string& batches)
+        : engine(e), batch_dir(batches), listen_fd(-1), next_id(1), stopping(false), workers(nullptr), worker_total(0) {
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
+
+    ~QueryServer() {
+        for (int i = 0; i < clients.size(); i++) {
+            close(clients[i]->fd);
+            delete clients[i];
+        }
+        while (!jobs.empty()) delete jobs.dequeue();
+        while (!replies.empty()) delete replies.dequeue();
+        if (listen_fd >= 0) close(listen_fd);
+        if (wake_pipe[0] >= 0) { close(wake_pipe[0]); close(wake_pipe[1]); }
+    }
+
+    // Binds to 127.0.0.1:port; returns false (with a message) on failure
+    bool open_port(int port) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            cout << "Could not create socket: " << strerror(errno) << endl;
+            return false;
+        }
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+            cout << "Could not listen on port " << port << ": " << strerror(errno) << endl;
+            return false;
+        }
+        set_nonblocking(listen_fd);
+        if (pipe(wake_pipe) < 0) return false;
+        set_nonblocking(wake_pipe[0]);
+        set_nonblocking(wake_pipe[1]);
+        return true;
+    }
+
+    // Serves clients until SIGINT/SIGTERM
+    void run() {
+        worker_total = get_max(2, worker_count());
+        workers = new thread[worker_total];
+        for (int w = 0; w < worker_total; w++) workers[w] = thread(&QueryServer::worker_loop, this);
+
+        while (!server_stop) {
+            int n = clients.size() + 2;
+            pollfd* fds = new pollfd[n];
+            fds[0].fd = listen_fd;
+            fds[0].events = POLLIN;
+            fds[1].fd = wake_pipe[0];
+            fds[1].events = POLLIN;
+            for (int i = 0; i < clients.size(); i++) {
+                fds[i + 2].fd = clients[i]->fd;
+                fds[i + 2].events = (clients[i]->eof ? 0 : POLLIN) | (clients[i]->out.empty() ? 0 : POLLOUT);
+            }
+            for (int i = 0; i < n; i++) fds[i].revents = 0;
+
+            int ready = poll(fds, n, 1000);
+            if (ready < 0 && errno != EINTR) {
+                delete[] fds;
+                break;
             }
-            if (temp_g.length() > 1) {
-                m->add_genre(temp_g);
-                idx.insert_item(temp_g, m);
+            if (ready > 0) {
+                if (fds[1].revents & POLLIN) collect_replies();
+                // Walk backwards so dropping a client only moves one that was already visited
+                for (int i = clients.size() - 1; i >= 0; i--) {
+                    Client* c = clients[i];
+                    if (!c->dead && !pump(c, fds[i + 2].revents)) c->dead = true;
+                    if (!c->dead) {
+                        dispatch(c);
+                        if (!pump(c, 0)) c->dead = true;
+                    }
+                    if (finished(c)) drop_client(i);
+                }
+                if (fds[0].revents & POLLIN) accept_clients();
             }
+            delete[] fds;
+        }
 
-            tree.insert(m);
-            count++;
-        } else {
-            skipped++;
+        {
+            lock_guard<mutex> guard(job_lock);
+            stopping = true;
+        }
+        job_ready.notify_all();
+        for (int w = 0; w < worker_total; w++) workers[w].join();
+        delete[] workers;
+    }
+};
+
+int run_server(CatalogEngine& engine, int port, const string& batch_dir) {
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    signal(SIGPIPE, SIG_IGN);
+    QueryServer server(engine, batch_dir);
+    if (!server.open_port(port)) return 1;
+    cout << "Serving on 127.0.0.1:" << port << " (Ctrl+C to stop)" << endl;
+    server.run();
+    cout << "Server stopped." << endl;
+    return 0;
+}
+
+// Tail Poller
+// Ingests rows appended to the dataset every few seconds (--poll) and prints what it found.
+// A missing or rewritten file is reported once, not on every poll.
+class TailPoller {
+private:
+    CatalogEngine& engine;
+    int seconds;
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+    thread worker;
+
+    void poll_loop() {
+        int last = 0;
+        unique_lock<mutex> guard(lock);
+        while (!wake.wait_for(guard, chrono::seconds(seconds), [this] { return stopping; })) {
+            guard.unlock();
+            stringstream out;
+            int rows = engine.ingest(out);
+            if (rows > 0 || (rows == -1 && last != -1)) cout << out.str() << flush;
+            last = rows;
+            guard.lock();
         }
+    }
 
-        delete row;
+public:
+    TailPoller(CatalogEngine& e, int every) : engine(e), seconds(every), stopping(false) {
+        worker = thread(&TailPoller::poll_loop, this);
     }
-    file.close();
 
-    cout << "Finished Loading!\n";
-    cout << "Loaded: " << count << " | Skipped: " << skipped << " | Duplicates: " << duplicates << endl;
+    ~TailPoller() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+};
+
+// Trace Recorder
+// Engine wrapper that appends every request to a binary trace before running it, including the ingests of
+// --poll. Trace layout: "MDMTRACE", then one record per request:
+//   varint microseconds since the previous record, one byte request type,
+//   text and text2 (varint length + bytes), varint zigzag number / offset / limit, varint bits of low and high.
+// Records are buffered and written in 64 KB blocks; the last block is written when the recorder is destroyed.
+class TraceRecorder : public CatalogEngine {
+private:
+    static const int block = 1 << 16;
+    CatalogEngine& engine;
+    ofstream file;
+    mutex lock;
+    string buf;
+    chrono::steady_clock::time_point last;
+
+    static void put_number(string& out, unsigned int v) {
+        unsigned char tmp[5];
+        out.append((const char*)tmp, put_varint(tmp, v) - tmp);
+    }
+
+    static void put_text(string& out, const string& text) {
+        put_number(out, (unsigned int)text.size());
+        out += text;
+    }
+
+    static unsigned int float_bits(float f) {
+        unsigned int bits;
+        memcpy(&bits, &f, sizeof bits);
+        return bits;
+    }
+
+    void record(const Request& req) {
+        lock_guard<mutex> guard(lock);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        long long gap = chrono::duration_cast<chrono::microseconds>(now - last).count();
+        last = now;
+        put_number(buf, (gap > UINT_MAX) ? UINT_MAX : (unsigned int)gap);
+        buf += (char)req.type;
+        put_text(buf, req.text);
+        put_text(buf, req.text2);
+        put_number(buf, zigzag(req.number));
+        put_number(buf, zigzag(req.offset));
+        put_number(buf, zigzag(req.limit));
+        put_number(buf, float_bits(req.low));
+        put_number(buf, float_bits(req.high));
+        if ((int)buf.size() >= block) {
+            file.write(buf.data(), buf.size());
+            buf.clear();
+        }
+    }
+
+public:
+    TraceRecorder(CatalogEngine& e, const string& path)
+        : engine(e), file(path.c_str(), ios::binary | ios::trunc), last(chrono::steady_clock::now()) {
+        file << "MDMTRACE";
+    }
+
+    ~TraceRecorder() {
+        file.write(buf.data(), buf.size());
+    }
+
+    bool ok() const { return (bool)file; }
+
+    void load(string fname) { engine.load(fname); }
+
+    void execute(const Request& req, ostream& out) {
+        record(req);
+        engine.execute(req, out);
+    }
+
+    bool current_rating(const string& title, float& r) { return engine.current_rating(title, r); }
+
+    int ingest(ostream& out) {
+        record(Request(REQ_INGEST));
+        return engine.ingest(out);
+    }
+};
+
+// Reads a trace written by TraceRecorder into out (a cut-off last record is dropped);
+// span gets the recorded time from the first to the last request in microseconds
+bool read_trace(const string& path, my_array<Request>& out, long long& span, string& error) {
+    ifstream file(path.c_str(), ios::binary);
+    if (!file) {
+        error = "Could not open " + path;
+        return false;
+    }
+    stringstream whole;
+    whole << file.rdbuf();
+    string data = whole.str();
+    if (data.compare(0, 8, "MDMTRACE") != 0) {
+        error = path + " is not a trace file.";
+        return false;
+    }
+    const unsigned char* p = (const unsigned char*)data.data() + 8;
+    const unsigned char* end = (const unsigned char*)data.data() + data.size();
+    // Varint with a bounds check (false at the end of the data)
+    auto number = [&p, end](unsigned int& v) {
+        v = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            v |= (unsigned int)(*p & 0x7f) << shift;
+            if (!(*p++ & 0x80)) return true;
+        }
+        return false;
+    };
+    auto text = [&p, end, &number](string& s) {
+        unsigned int len;
+        if (!number(len) || len > (unsigned int)(end - p)) return false;
+        s.assign((const char*)p, len);
+        p += len;
+        return true;
+    };
+    out.clear();
+    span = 0;
+    long long at = 0;
+    while (p < end) {
+        Request req;
+        unsigned int gap, type, number_bits, offset_bits, limit_bits, low_bits, high_bits;
+        if (!number(gap) || p == end) break;
+        type = *p++;
+        if (type >= (unsigned int)request_type_count) {
+            error = path + " has an unknown request type.";
+            return false;
+        }
+        if (!text(req.text) || !text(req.text2) || !number(number_bits) || !number(offset_bits) ||
+            !number(limit_bits) || !number(low_bits) || !number(high_bits)) {
+            break;
+        }
+        req.type = (RequestType)type;
+        req.number = unzigzag(number_bits);
+        req.offset = unzigzag(offset_bits);
+        req.limit = unzigzag(limit_bits);
+        memcpy(&req.low, &low_bits, sizeof low_bits);
+        memcpy(&req.high, &high_bits, sizeof high_bits);
+        if (out.size() > 0) at += gap;
+        out.push(req);
+    }
+    span = at;
+    return true;
+}
+
+// Trace Replay
+// Runs a recorded trace against the loaded engine as fast as it can on the given number of threads and prints
+// throughput, latency percentiles per request type and a checksum of all answers in trace order.
+// Writes and ingests run alone, in trace order; the reads between two of them are shared out among the threads.
+// So every request sees the same catalog as in a single-threaded replay, and the checksum does not depend on the
+// thread count. CACHESTATS answers depend on the timing of cache hits and are left out of the checksum.
+int replay_trace(CatalogEngine& engine, const string& path, int threads) {
+    my_array<Request> reqs;
+    long long span = 0;
+    string error;
+    if (!read_trace(path, reqs, span, error)) {
+        cout << error << endl;
+        return 1;
+    }
+    int n = reqs.size();
+    if (threads < 1) threads = 1;
+    long long* latency = new long long[n > 0 ? n : 1];
+    unsigned long* digest = new unsigned long[n > 0 ? n : 1];
+    auto run_one = [&](int i) {
+        stringstream answer;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        engine.execute(reqs[i], answer);
+        latency[i] = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+        digest[i] = (reqs[i].type == REQ_CACHE_STATS || reqs[i].type == REQ_MEMORY) ? 0 : str_hash(answer.str());
+    };
+    auto alone = [&reqs](int i) { return CatalogEngine::is_write(reqs[i].type); };
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < n; ) {
+        if (alone(i)) {
+            run_one(i++);
+            continue;
+        }
+        int stop = i;
+        while (stop < n && !alone(stop)) stop++;
+        int workers = (stop - i < threads) ? stop - i : threads;
+        atomic<int> next(i);
+        auto drain = [&]() {
+            for (int k = next++; k < stop; k = next++) run_one(k);
+        };
+        thread* pool = new thread[workers > 1 ? workers - 1 : 1];
+        for (int w = 1; w < workers; w++) pool[w - 1] = thread(drain);
+        drain();
+        for (int w = 1; w < workers; w++) pool[w - 1].join();
+        delete[] pool;
+        i = stop;
+    }
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    unsigned long checksum = 0;
+    for (int i = 0; i < n; i++) checksum = checksum * 1000003 + digest[i];
+    cout << "\n--- Replay of " << path << " ---\n";
+    cout << "Requests: " << n << " (recorded over " << span / 1e6 << " s) | Threads: " << threads << "\n";
+    cout << "Time: " << wall << " s | Throughput: " << (wall > 0 ? n / wall : 0.0) << " requests/s\n";
+    cout << "Latency in microseconds (p50 / p90 / p99 / max):\n";
+    my_array<long long> by_type;
+    for (int t = -1; t < request_type_count; t++) {
+        by_type.clear();
+        for (int i = 0; i < n; i++) if (t == -1 || reqs[i].type == t) by_type.push(latency[i]);
+        if (by_type.size() == 0) continue;
+        heap_sort(by_type.data(), by_type.size());
+        int last = by_type.size() - 1;
+        cout << "  " << (t == -1 ? "all" : request_names[t]) << ": " << by_type.size() << " | "
+             << by_type[last * 50 / 100] << " / " << by_type[last * 90 / 100] << " / " << by_type[last * 99 / 100]
+             << " / " << by_type[last] << "\n";
+    }
+    cout << "Answer checksum: " << checksum << endl;
+    delete[] latency;
+    delete[] digest;
+    return 0;
 }
 
 int get_valid_input() {
@@ -971,20 +8355,99 @@ int get_valid_input() {
     return x;
 }
 
-int main() {
-    AVLTree tree;
-    HashTable idx; 
-    Graph graph;
+int main(int argc, char* argv[]) {
+    // Options: --compact (compressed catalog versions), --serve <port> (server mode),
+    // --disk <file> (catalog kept in a page file instead of memory), --shards <n> (catalog split into n shards),
+    // --poll <seconds> (ingest rows appended to the dataset while running),
+    // --lazy-graph (graph links built before the first graph request instead of while loading),
+    // --record <file> (trace of all requests),
+    // --replay <file> [--threads <n>] (benchmark a trace, then exit; not with --disk),
+    // --memory-report (memory use per data structure after loading),
+    // --batch-dir <dir> (the only directory BATCH requests of server clients may read from)
+    bool compact = false;
+    bool lazy_graph = false;
+    bool memory_report = false;
+    int port = -1;
+    string disk_file = "";
+    int shard_total = 0;
+    int poll_seconds = 0;
+    string record_file = "", replay_file = "";
+    string batch_dir = "";
+    int replay_threads = 1;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--compact") compact = true;
+        else if (arg == "--serve" && i + 1 < argc) port = to_int(argv[++i]);
+        else if (arg == "--disk" && i + 1 < argc) disk_file = argv[++i];
+        else if (arg == "--shards" && i + 1 < argc) shard_total = to_int(argv[++i]);
+        else if (arg == "--poll" && i + 1 < argc) poll_seconds = to_int(argv[++i]);
+        else if (arg == "--lazy-graph") lazy_graph = true;
+        else if (arg == "--memory-report") memory_report = true;
+        else if (arg == "--record" && i + 1 < argc) record_file = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc) replay_file = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc) replay_threads = to_int(argv[++i]);
+        else if (arg == "--batch-dir" && i + 1 < argc) batch_dir = argv[++i];
+    }
+
+    // A replay applies the trace's updates again; on a page file they would stay in it
+    if (replay_file != "" && disk_file != "") {
+        cout << "--replay cannot be used with --disk (the trace's updates would change " << disk_file << ")" << endl;
+        return 1;
+    }
+
+    CatalogEngine* engine;
+    if (disk_file != "") {
+        DiskEngine* disk = new DiskEngine(disk_file);
+        if (!disk->ok()) {
+            delete disk;
+            return 1;
+        }
+        engine = disk;
+    } else if (shard_total > 0) {
+        engine = new ShardedEngine(shard_total);
+    } else {
+        engine = new MovieEngine(compact, lazy_graph);
+    }
+    engine->load("movie_metadata.csv");
+    if (memory_report) {
+        Request req;
+        req.type = REQ_MEMORY;
+        engine->execute(req, cout);
+    }
+    if (replay_file != "") {
+        int code = replay_trace(*engine, replay_file, replay_threads);
+        delete engine;
+        return code;
+    }
+
+    // With --record every request goes through the recorder (front) on its way to the engine
+    TraceRecorder* recorder = nullptr;
+    if (record_file != "") {
+        recorder = new TraceRecorder(*engine, record_file);
+        if (!recorder->ok()) {
+            cout << "Could not create " << record_file << endl;
+            delete recorder;
+            delete engine;
+            return 1;
+        }
+    }
+    CatalogEngine* front = recorder ? (CatalogEngine*)recorder : engine;
+    TailPoller* poller = (poll_seconds > 0) ? new TailPoller(*front, poll_seconds) : nullptr;
 
-    tree.set_idx(&idx);
-    load_data("movie_metadata.csv", tree, idx);
+    if (port != -1) {
+        int code = run_server(*front, port, batch_dir);
+        delete poller;
+        delete recorder;
+        delete engine;
+        return code;
+    }
 
     int choice;
     string in_str, in_str2;
-    int y_in;
-    float min_r, max_r;
-    float new_r;
-    int limit;
+    float cur_r;
+    // Answers are written through one buffered sink, flushed before the next prompt
+    OutputSink console(cout.rdbuf());
+    ostream screen(&console);
 
     do {
         cout << "\n=== MOVIES MANAGER ===\n";
@@ -1000,116 +8463,103 @@ int main() {
         cout << "10. Update Rating\n"; 
         cout << "11. Delete Movie\n";
         cout << "12. Find Co-Actors\n";
-        cout << "13. Exit\n";
+        cout << "13. Graph Analytics\n";
+        cout << "14. Cache Statistics\n";
+        cout << "15. Ingest New Rows\n";
+        cout << "16. Similar Movies\n";
+        cout << "17. Movies by Genre Profile\n";
+        cout << "18. Compound Search\n";
+        cout << "19. Memory Report\n";
+        cout << "20. Apply Batch File\n";
+        cout << "21. Exit\n";
         cout << "Choice: ";
         
         choice = get_valid_input(); 
+        Request req;
 
         switch(choice) {
-            case 1: tree.print_all(); break;
+            case 1: req.type = REQ_LIST_ALL; break;
             case 2:
                 cout << "Title: "; getline(cin, in_str);
-                { 
-                    MovieNode* res = tree.find_movie(in_str); 
-                    if (res) res->show_details(); 
-                    else cout << "Not found.\n"; 
-                }
+                req.type = REQ_TITLE; req.text = in_str;
                 break;
             case 3:
-                cout << "Actor/Genre/Director: "; getline(cin, in_str);
-                {
-                    LinkedList<MovieNode*>* res = idx.find_item(in_str);
-                    if (res) {
-                        cout << "\n--- Results ---\n";
-                        list_node<MovieNode*>* curr = res->head;
-                        while (curr) { cout << "- " << curr->data->title << endl; curr = curr->next; }
-                    } else cout << "No matches found.\n";
-                }
+                cout << "Actor/Genre/Director (actor:, director: or genre: for one type): "; getline(cin, in_str);
+                req.type = REQ_ENTITY; req.text = in_str;
                 break;
             case 4:
-                cout << "Year: "; y_in = get_valid_input();
-                tree.find_by_year(y_in);
+                cout << "Year: "; 
+                req.type = REQ_YEAR; req.number = get_valid_input();
                 break;
             case 5:
-                cout << "Min Rating: "; cin >> min_r;
-                cout << "Max Rating: "; cin >> max_r; cin.ignore();
-                tree.find_by_rating(min_r, max_r);
+                cout << "Min Rating: "; cin >> req.low;
+                cout << "Max Rating: "; cin >> req.high; cin.ignore();
+                req.type = REQ_RATING;
                 break;
             case 6:
-                cout << "Movie: "; getline(cin, in_str);
-                cout << "Num recs: "; limit = get_valid_input();
-                {
-                    MovieNode* start = tree.find_movie(in_str);
-                    if (start) graph.recommend_bfs(start, tree, limit);
-                    else cout << "Movie not found.\n";
-                }
-                break;
             case 7:
                 cout << "Movie: "; getline(cin, in_str);
-                cout << "Num recs: "; limit = get_valid_input();
-                {
-                    MovieNode* start = tree.find_movie(in_str);
-                    if (start) graph.recommend_dfs(start, tree, limit);
-                    else cout << "Movie not found.\n";
-                }
+                cout << "Num recs: "; 
+                req.type = (choice == 6) ? REQ_BFS : REQ_DFS; 
+                req.text = in_str; req.number = get_valid_input();
                 break;
             case 8:
-                cout << "Movie 1: "; getline(cin, in_str);
-                cout << "Movie 2: "; getline(cin, in_str2);
-                {
-                    MovieNode* m1 = tree.find_movie(in_str);
-                    MovieNode* m2 = tree.find_movie(in_str2);
-                    if (m1 && m2) graph.shortest_path(m1, m2, tree);
-                    else cout << "Movies not found.\n";
-                }
-                break;
-            case 9: 
-                cout << "Person 1: "; getline(cin, in_str);
-                cout << "Person 2: "; getline(cin, in_str2);
-                graph.connect_actors(in_str, in_str2, idx, tree);
+            case 9:
+                cout << ((choice == 8) ? "Movie 1: " : "Person 1: "); getline(cin, in_str);
+                cout << ((choice == 8) ? "Movie 2: " : "Person 2: "); getline(cin, in_str2);
+                req.type = (choice == 8) ? REQ_PATH : REQ_CONNECT;
+                req.text = in_str; req.text2 = in_str2;
                 break;
             case 10:
                 cout << "Title: "; getline(cin, in_str);
-                {
-                    MovieNode* res = tree.find_movie(in_str);
-                    if (res) {
-                        cout << "Current: " << res->rating << ". New: ";
-                        cin >> new_r;
-                        res->set_rating(new_r);
-                    } else cout << "Not found.\n";
+                if (!front->current_rating(in_str, cur_r)) {
+                    cout << "Not found.\n";
+                    continue;
                 }
+                cout << "Current: " << cur_r << ". New: ";
+                cin >> req.low;
+                req.type = REQ_SET_RATING; req.text = in_str;
                 break;
             case 11: 
                 cout << "Title to delete: "; getline(cin, in_str);
-                tree.remove_node(in_str);
+                req.type = REQ_DELETE; req.text = in_str;
                 break;
             case 12: 
                 cout << "Actor: "; getline(cin, in_str);
-                {
-                    LinkedList<MovieNode*>* res = idx.find_item(in_str);
-                    if (res) {
-                        cout << "\n--- Co-Actors of " << in_str << " ---\n";
-                        LinkedList<string> printed; 
-                        list_node<MovieNode*>* m = res->head;
-                        while(m) {
-                            list_node<string>* a = m->data->actors.head;
-                            while(a) {
-                                if (format_key(a->data) != format_key(in_str) && !printed.has_item(a->data)) {
-                                    cout << a->data << ", ";
-                                    printed.insert(a->data);
-                                }
-                                a = a->next;
-                            }
-                            m = m->next;
-                        }
-                        cout << endl;
-                    } else cout << "Actor not found.\n";
-                }
+                req.type = REQ_COACTORS; req.text = in_str;
+                break;
+            case 13: req.type = REQ_ANALYTICS; break;
+            case 14: req.type = REQ_CACHE_STATS; break;
+            case 15: req.type = REQ_INGEST; break;
+            case 16:
+                cout << "Movie: "; getline(cin, in_str);
+                cout << "Num results: ";
+                req.type = REQ_SIMILAR; req.text = in_str; req.number = get_valid_input();
+                break;
+            case 17:
+                cout << "Genres (e.g. Action|Sci-Fi): "; getline(cin, in_str);
+                cout << "Num results: ";
+                req.type = REQ_PROFILE; req.text = in_str; req.number = get_valid_input();
+                break;
+            case 18:
+                cout << "Query (e.g. Tom Hanks AND Drama AND year=1990-2000 AND rating>=7.5): ";
+                getline(cin, in_str);
+                req.type = REQ_QUERY; req.text = in_str;
+                break;
+            case 19: req.type = REQ_MEMORY; break;
+            case 20:
+                cout << "Batch file (ADD / UPDATE / DELETE lines): "; getline(cin, in_str);
+                req.type = REQ_BATCH; req.text = in_str;
                 break;
-            case 13: cout << "Exiting...\n"; break;
-            default: cout << "Invalid choice.\n";
+            case 21: cout << "Exiting...\n"; continue;
+            default: cout << "Invalid choice.\n"; continue;
         }
-    } while (choice != 13);
+        front->execute(req, screen);
+        screen.flush();
+    } while (choice != 21);
 
+    delete poller;
+    delete recorder;
+    delete engine;
     return 0;
 }
\ No newline at end of file
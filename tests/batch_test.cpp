@@ -0,0 +1,134 @@
+// Batch test
+// Applies one batch file (deletes, a rating edit, a cast change, new movies, a title deleted and added again) to
+// a loaded engine, and the same changes one request at a time to another engine, in the order a batch applies
+// them: removals, then edits, then inserts in file order. Listings, details, searches, BFS, DFS, paths and
+// analytics then have to give the same answers on both engines. Runs in default, compact and sharded mode.
+// Build and run from the repository root (it loads movie_metadata.csv):
+//   g++ -O2 -pthread tests/batch_test.cpp -o batch_test && ./batch_test
+#define main movie_manager_main
+#include "../24I-0118_24I-2013_DS Project.cpp"
+#undef main
+
+const char* dataset = "movie_metadata.csv";
+const char* batch_file = "batch_test.txt";
+
+const char* const batch_lines =
+    "# batch_test\n"
+    "DELETE Inception\n"
+    "UPDATE The Dark Knight;rating=9.5\n"
+    "UPDATE The Dark Knight Rises;cast=Christian Bale|Anne Hathaway|Michael Caine\n"
+    "ADD Batch Test One;2013;7.0;100;Christopher Nolan;Tom Hardy|Leonardo DiCaprio;Action|Sci-Fi\n"
+    "\n"
+    "DELETE Avatar\n"
+    "ADD Avatar;2009;6.0;162;James Cameron;Sam Worthington|Zoe Saldana;Action|Adventure\n"
+    "UPDATE Batch Test One;rating=7.5\n"
+    "UPDATE Interstellar;rating=8.9\n";
+
+// The same changes as single requests. A movie whose cast changes is removed and added again with its stored
+// fields (the dataset's title ends in a no-break space, which the CSV loader keeps).
+const int step_count = 8;
+
+void make_steps(Request* steps) {
+    const char* deletes[3] = {"Inception", "The Dark Knight Rises", "Avatar"};
+    for (int i = 0; i < 3; i++) {
+        steps[i] = Request(REQ_DELETE);
+        steps[i].text = deletes[i];
+    }
+    steps[3] = Request(REQ_SET_RATING);
+    steps[3].text = "The Dark Knight";
+    steps[3].low = 9.5f;
+    steps[4] = Request(REQ_SET_RATING);
+    steps[4].text = "Interstellar";
+    steps[4].low = 8.9f;
+    const char* adds[3] = {
+        "The Dark Knight Rises\xc2\xa0;2012;8.5;164;Christopher Nolan;Christian Bale|Anne Hathaway|Michael Caine;"
+        "Action|Thriller",
+        "Batch Test One;2013;7.5;100;Christopher Nolan;Tom Hardy|Leonardo DiCaprio;Action|Sci-Fi",
+        "Avatar;2009;6.0;162;James Cameron;Sam Worthington|Zoe Saldana;Action|Adventure"
+    };
+    for (int i = 0; i < 3; i++) {
+        steps[5 + i] = Request(REQ_ADD);
+        steps[5 + i].text = adds[i];
+    }
+}
+
+const int read_count = 12;
+
+void make_reads(Request* reads) {
+    const RequestType types[read_count] = {REQ_LIST_ALL, REQ_TITLE, REQ_TITLE, REQ_TITLE, REQ_ENTITY, REQ_COACTORS,
+                                           REQ_BFS, REQ_DFS, REQ_BFS, REQ_PATH, REQ_CONNECT, REQ_ANALYTICS};
+    const char* texts[read_count] = {"", "The Dark Knight Rises", "Batch Test One", "Interstellar", "Christian Bale",
+                                     "Tom Hardy", "The Dark Knight", "The Dark Knight Rises", "Avatar", "Avatar",
+                                     "Sam Worthington", ""};
+    const char* texts2[read_count] = {"", "", "", "", "", "", "", "", "", "Batch Test One", "Leonardo DiCaprio", ""};
+    for (int r = 0; r < read_count; r++) {
+        reads[r] = Request(types[r]);
+        reads[r].text = texts[r];
+        reads[r].text2 = texts2[r];
+        reads[r].number = 20;
+    }
+}
+
+string answer(CatalogEngine& e, const Request& req) {
+    stringstream ss;
+    e.execute(req, ss);
+    return ss.str();
+}
+
+CatalogEngine* make_engine(int mode) {
+    if (mode == 2) return new ShardedEngine(4);
+    return new MovieEngine(mode == 1);
+}
+
+// Loads the dataset without the loading messages
+void load_quietly(CatalogEngine& e) {
+    streambuf* saved = cout.rdbuf();
+    stringstream sink;
+    cout.rdbuf(sink.rdbuf());
+    e.load(dataset);
+    cout.rdbuf(saved);
+}
+
+bool run_mode(int mode, const Request* steps, const Request* reads) {
+    const char* mode_names[3] = {"default mode", "compact mode", "sharded mode"};
+    string name = mode_names[mode];
+    CatalogEngine* batched = make_engine(mode);
+    CatalogEngine* single = make_engine(mode);
+    load_quietly(*batched);
+    load_quietly(*single);
+
+    Request batch(REQ_BATCH);
+    batch.text = batch_file;
+    string report = answer(*batched, batch);
+    bool ok = true;
+    if (report.find("Batch applied: 2 added | 4 updated | 2 deleted | 0 errors") == string::npos) {
+        cout << name << ": unexpected batch report: " << report;
+        ok = false;
+    }
+    for (int i = 0; i < step_count; i++) answer(*single, steps[i]);
+
+    for (int r = 0; r < read_count; r++) {
+        if (answer(*batched, reads[r]) != answer(*single, reads[r])) {
+            cout << name << ": " << request_names[reads[r].type] << " " << reads[r].text << " differs" << endl;
+            ok = false;
+        }
+    }
+    cout << (ok ? "PASS " : "FAIL ") << name << endl;
+    delete batched;
+    delete single;
+    return ok;
+}
+
+int main() {
+    ofstream file(batch_file);
+    file << batch_lines;
+    file.close();
+
+    Request steps[step_count], reads[read_count];
+    make_steps(steps);
+    make_reads(reads);
+    bool ok = true;
+    for (int mode = 0; mode < 3; mode++) ok = run_mode(mode, steps, reads) && ok;
+    unlink(batch_file);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// B+ tree test
+// Fills BTrees with entries of the largest allowed size (512-byte keys, 1024-byte values), alone and mixed with
+// small ones, in ascending, descending and shuffled order, then checks that every entry can be found and that a
+// scan returns all of them in key order. A few large entries among many small ones are the hard case for a split:
+// the cut has to keep a large entry from tipping either page over. Build and run from the repository root:
+//   g++ -O2 -pthread tests/btree_test.cpp -o btree_test && ./btree_test
+#define main movie_manager_main
+#include "../24I-0118_24I-2013_DS Project.cpp"
+#undef main
+
+const char* test_file = "btree_test.db";
+
+// Key of entry i: the number in 8 digits (so keys sort like the numbers), padded to the given length
+string test_key(int i, int length) {
+    string digits = to_string(i);
+    string key = string(8 - digits.size(), '0') + digits;
+    key.resize(length, 'k');
+    return key;
+}
+
+string test_value(int i, int round, int length) { return string(length, (char)('a' + (i + round) % 26)); }
+
+// One entry in every `every` (spread by a multiplier) has a maximum size key and value, the others are small
+bool large(int i, int every) { return (i * 7919) % every == 0; }
+int key_length(int i, int every) { return large(i, every) ? BTree::max_key : 8; }
+int value_length(int i, int every) { return large(i, every) ? BTree::max_value : 3; }
+
+// Inserts n entries in the given order (twice, so the second round replaces every value) and checks them
+bool run_case(const string& name, const int* order, int n, int every) {
+    unlink(test_file);
+    BufferPool pool(16);
+    if (!pool.open(test_file)) {
+        cout << name << ": could not create " << test_file << endl;
+        return false;
+    }
+    pool.allocate(); // Page 0 is the file header in DiskEngine
+    BTree tree(pool);
+    tree.create();
+
+    bool ok = true;
+    for (int round = 0; round < 2 && ok; round++) {
+        for (int j = 0; j < n; j++) {
+            int i = order[j];
+            tree.put(test_key(i, key_length(i, every)), test_value(i, round, value_length(i, every)));
+        }
+        for (int i = 0; i < n && ok; i++) {
+            string value;
+            if (!tree.find(test_key(i, key_length(i, every)), value) ||
+                value != test_value(i, round, value_length(i, every))) {
+                cout << name << ": entry " << i << " lost or wrong after round " << round + 1 << endl;
+                ok = false;
+            }
+        }
+        int seen = 0;
+        for (BTree::Cursor c = tree.seek(""); c.valid() && ok; c.next()) {
+            if (seen >= n || c.key() != test_key(seen, key_length(seen, every))) {
+                cout << name << ": scan out of order at entry " << seen << endl;
+                ok = false;
+            }
+            seen++;
+        }
+        if (ok && seen != n) {
+            cout << name << ": scan found " << seen << " of " << n << " entries" << endl;
+            ok = false;
+        }
+    }
+    unlink(test_file);
+    cout << (ok ? "PASS " : "FAIL ") << name << endl;
+    return ok;
+}
+
+int main() {
+    const int n = 3000;
+    int* up = new int[n];
+    int* down = new int[n];
+    int* shuffled = new int[n];
+    for (int i = 0; i < n; i++) {
+        up[i] = i;
+        down[i] = n - 1 - i;
+        shuffled[i] = i;
+    }
+    unsigned int seed = 12345;
+    for (int i = n - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        int j = (int)((seed >> 16) % (unsigned int)(i + 1));
+        swap(shuffled[i], shuffled[j]);
+    }
+
+    const int* orders[3] = { up, down, shuffled };
+    const char* order_names[3] = { "ascending", "descending", "shuffled" };
+    const int everies[5] = { 1, 3, 60, 100, 400 };
+    int failed = 0;
+    for (int e = 0; e < 5; e++) {
+        for (int o = 0; o < 3; o++) {
+            string name = "1 in " + to_string(everies[e]) + " max-size, " + order_names[o];
+            if (!run_case(name, orders[o], n, everies[e])) failed++;
+        }
+    }
+
+    delete[] up;
+    delete[] down;
+    delete[] shuffled;
+    cout << (failed == 0 ? "All B+ tree tests passed." : "Some B+ tree tests failed.") << endl;
+    return failed == 0 ? 0 : 1;
+}
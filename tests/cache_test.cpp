@@ -0,0 +1,110 @@
+// Query cache test
+// Runs a set of cached reads (filters, searches, co-actors, BFS, DFS, paths, connections) on one engine, then makes
+// a SETRATING, a DELETE and an ADD. After each change the reads run again, so they are answered from whatever the
+// cache kept. Every answer is compared with the one a freshly loaded engine gives after the same changes (its
+// cache is empty). Each change also has to alter at least one answer, so the test cannot pass with stale entries
+// that happen to match. Build and run from the repository root (it loads movie_metadata.csv):
+//   g++ -O2 -pthread tests/cache_test.cpp -o cache_test && ./cache_test
+#define main movie_manager_main
+#include "../24I-0118_24I-2013_DS Project.cpp"
+#undef main
+
+const char* dataset = "movie_metadata.csv";
+
+Request make_request(RequestType type, const string& text, const string& text2 = "", int number = 0,
+                     float low = 0.0f, float high = 0.0f) {
+    Request req(type);
+    req.text = text;
+    req.text2 = text2;
+    req.number = number;
+    req.low = low;
+    req.high = high;
+    return req;
+}
+
+const int read_count = 9;
+
+void make_reads(Request* reads) {
+    reads[0] = make_request(REQ_RATING, "", "", 0, 8.4f, 10.0f);
+    reads[1] = make_request(REQ_YEAR, "", "", 2012);
+    reads[2] = make_request(REQ_ENTITY, "Christian Bale");
+    reads[3] = make_request(REQ_COACTORS, "Tom Hardy");
+    reads[4] = make_request(REQ_BFS, "The Dark Knight", "", 15);
+    reads[5] = make_request(REQ_DFS, "The Dark Knight Rises", "", 15);
+    reads[6] = make_request(REQ_PATH, "Avatar", "The Dark Knight Rises");
+    reads[7] = make_request(REQ_PATH, "Inception", "Interstellar");
+    reads[8] = make_request(REQ_CONNECT, "Christian Bale", "Leonardo DiCaprio");
+}
+
+const int change_count = 3;
+
+void make_changes(Request* changes) {
+    changes[0] = make_request(REQ_SET_RATING, "The Dark Knight Rises", "", 0, 3.0f);
+    changes[1] = make_request(REQ_DELETE, "Inception");
+    changes[2] = make_request(REQ_ADD, "Cache Test Movie;2012;8.8;120;Christopher Nolan;Christian Bale|Tom Hardy|"
+                                       "Leonardo DiCaprio;Action|Drama");
+}
+
+// The title of a change (without the rest of an ADD spec)
+string change_title(const Request& change) { return change.text.substr(0, change.text.find(';')); }
+
+string answer(CatalogEngine& e, const Request& req) {
+    stringstream ss;
+    e.execute(req, ss);
+    return ss.str();
+}
+
+// Loads the dataset without the loading messages
+void load_quietly(CatalogEngine& e) {
+    streambuf* saved = cout.rdbuf();
+    stringstream sink;
+    cout.rdbuf(sink.rdbuf());
+    e.load(dataset);
+    cout.rdbuf(saved);
+}
+
+int main() {
+    Request reads[read_count], changes[change_count];
+    make_reads(reads);
+    make_changes(changes);
+
+    MovieEngine cached;
+    load_quietly(cached);
+    string before[read_count];
+    for (int r = 0; r < read_count; r++) before[r] = answer(cached, reads[r]);
+    if (before[4].find("No related movies") != string::npos || before[7].find("No connection") != string::npos) {
+        cout << "FAIL the reads do not find the test movies in " << dataset << endl;
+        return 1;
+    }
+
+    bool ok = true;
+    for (int c = 0; c < change_count; c++) {
+        answer(cached, changes[c]);
+        MovieEngine fresh;
+        load_quietly(fresh);
+        for (int i = 0; i <= c; i++) answer(fresh, changes[i]);
+
+        int changed = 0;
+        bool same = true;
+        for (int r = 0; r < read_count; r++) {
+            string got = answer(cached, reads[r]);
+            string again = answer(cached, reads[r]);
+            string expected = answer(fresh, reads[r]);
+            if (got != expected || again != expected) {
+                cout << "  " << request_names[reads[r].type] << " " << reads[r].text << " is stale after "
+                     << request_names[changes[c].type] << " " << change_title(changes[c]) << endl;
+                same = false;
+            }
+            if (expected != before[r]) changed++;
+            before[r] = expected;
+        }
+        if (changed == 0) {
+            cout << "  " << request_names[changes[c].type] << " changed none of the answers" << endl;
+            same = false;
+        }
+        cout << (same ? "PASS " : "FAIL ") << request_names[changes[c].type] << " (" << changed << " of "
+             << read_count << " answers changed)" << endl;
+        ok = ok && same;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+// Lazy graph test
+// Loads the dataset twice, once linking every movie while it is added and once without links (as --lazy-graph
+// does), and adds a few movies on top (one repeating a name in its own cast). The unlinked catalog is then linked
+// by CatalogWriter::link_all in a later write, as the engine does before the first graph request. Every movie has
+// to end up with the same neighbors in the same order, since DFS and the order of equal-length paths depend on
+// it. Runs in default and compact mode. Build and run from the repository root (it loads movie_metadata.csv):
+//   g++ -O2 -pthread tests/lazy_graph_test.cpp -o lazy_graph_test && ./lazy_graph_test
+#define main movie_manager_main
+#include "../24I-0118_24I-2013_DS Project.cpp"
+#undef main
+
+const char* dataset = "movie_metadata.csv";
+
+const int extra_count = 3;
+const char* const extras[extra_count] = {
+    "Lazy Test One;2012;7.1;110;Christopher Nolan;Christian Bale|Tom Hardy|Michael Caine;Action|Drama",
+    "Lazy Test Two;2015;6.4;95;Steven Spielberg;Tom Hanks|Tom Hanks|Christian Bale;Drama|Drama|History",
+    "Lazy Test Three;1999;5.0;80;Unknown Director;Nobody Known;Documentary"
+};
+
+// Version 1: the dataset and the extra movies, linked while adding or not at all
+CatalogVersion* load_version(bool compact, bool with_links) {
+    CatalogVersion* v = new CatalogVersion(1, compact);
+    VersionDiff diff;
+    CatalogWriter w(*v, diff);
+    CsvTail tail;
+    tail.set_file(dataset);
+    LoadCounts counts;
+    load_rows(tail, w, with_links, counts);
+    stringstream errors;
+    for (int i = 0; i < extra_count; i++) {
+        MovieRow row;
+        if (parse_movie_spec(extras[i], row, errors)) w.add(row, with_links);
+    }
+    w.finish();
+    return v;
+}
+
+// Version 2 of an unlinked version, with all links made at once
+CatalogVersion* link_version(CatalogVersion& prev) {
+    CatalogVersion* v = new CatalogVersion(prev, 2);
+    VersionDiff diff;
+    CatalogWriter w(*v, diff);
+    w.link_all();
+    w.finish();
+    return v;
+}
+
+bool same_links(const string& name, CatalogVersion& eager, CatalogVersion& lazy) {
+    if (eager.movies.bound != lazy.movies.bound || eager.size() != lazy.size()) {
+        cout << name << ": " << eager.size() << " movies linked while adding, " << lazy.size() << " lazily" << endl;
+        return false;
+    }
+    if (eager.size() < 1000 || eager.movies.edge_count == 0) {
+        cout << name << ": could not load " << dataset << endl;
+        return false;
+    }
+    for (int uid = 0; uid < eager.movies.bound; uid++) {
+        const MovieRecord* m = eager.movie(uid);
+        if (!m) continue;
+        ListCursor a = eager.movies.edges(uid);
+        ListCursor b = lazy.movies.edges(uid);
+        int x, y, at = 0;
+        while (true) {
+            bool more_a = a.next(x), more_b = b.next(y);
+            if (!more_a && !more_b) break;
+            if (more_a != more_b || x != y) {
+                cout << name << ": neighbor " << at << " of '" << m->title << "' differs" << endl;
+                return false;
+            }
+            at++;
+        }
+    }
+    if (eager.movies.edge_count != lazy.movies.edge_count) {
+        cout << name << ": " << eager.movies.edge_count << " links against " << lazy.movies.edge_count << endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool ok = true;
+    for (int mode = 0; mode < 2; mode++) {
+        bool compact = (mode == 1);
+        string name = compact ? "compact mode" : "default mode";
+        CatalogVersion* eager = load_version(compact, true);
+        CatalogVersion* unlinked = load_version(compact, false);
+        CatalogVersion* lazy = link_version(*unlinked);
+        bool same = same_links(name, *eager, *lazy);
+        cout << (same ? "PASS " : "FAIL ") << name << " (" << eager->movies.edge_count << " links)" << endl;
+        ok = ok && same;
+        delete lazy;
+        delete unlinked;
+        delete eager;
+    }
+    return ok ? 0 : 1;
+}